@@ -39,6 +39,8 @@ Args::Args()
   verbose = 2;
   pretrainedVectors = "";
   saveOutput = false;
+  cacheTokens = false;
+  cbowWindowSum = false;
   seed = 0;
 
   qout = false;
@@ -46,6 +48,8 @@ Args::Args()
   qnorm = false;
   cutoff = 0;
   dsub = 2;
+  qbits = 8;
+  qint8 = false;
 
   autotuneValidationFile = "";
   autotuneMetric = "f1";
@@ -217,6 +221,14 @@ void Args::parseArgs(const std::vector<std::string>& args)
         saveOutput = true;
         ai--;
       }
+      else if (args[ai] == "-cacheTokens") {
+        cacheTokens = true;
+        ai--;
+      }
+      else if (args[ai] == "-cbowWindowSum") {
+        cbowWindowSum = true;
+        ai--;
+      }
       else if (args[ai] == "-seed") {
         seed = std::stoi(args.at(ai1));
       }
@@ -238,6 +250,13 @@ void Args::parseArgs(const std::vector<std::string>& args)
       else if (args[ai] == "-dsub") {
         dsub = std::stoi(args.at(ai1));
       }
+      else if (args[ai] == "-qbits") {
+        qbits = std::stoi(args.at(ai1));
+      }
+      else if (args[ai] == "-qint8") {
+        qint8 = true;
+        ai--;
+      }
       else if (args[ai] == "-autotune-validation") {
         autotuneValidationFile = std::string(args.at(ai1));
       }
@@ -335,6 +354,12 @@ void Args::printTrainingHelp()
       << pretrainedVectors << "]\n"
       << "  -saveOutput         whether output params should be saved ["
       << boolToString(saveOutput) << "]\n"
+      << "  -cacheTokens        whether the tokenized input is cached for the "
+         "epochs of cbow and skipgram ["
+      << boolToString(cacheTokens) << "]\n"
+      << "  -cbowWindowSum      whether cbow sums context windows from "
+         "running sums and updates input rows once per sentence ["
+      << boolToString(cbowWindowSum) << "]\n"
       << "  -seed               random generator seed  [" << seed << "]\n";
 }
 
@@ -368,7 +393,12 @@ void Args::printQuantizationHelp()
       << boolToString(qnorm) << "]\n"
       << "  -qout               whether the classifier is quantized ["
       << boolToString(qout) << "]\n"
-      << "  -dsub               size of each sub-vector [" << dsub << "]\n";
+      << "  -dsub               size of each sub-vector [" << dsub << "]\n"
+      << "  -qbits              bits per sub-vector code, 8 or 4 [" << qbits
+      << "]\n"
+      << "  -qint8              whether rows are stored as int8 values instead "
+         "of sub-vector codes ["
+      << boolToString(qint8) << "]\n";
 }
 
 void Args::save(std::ostream& out)
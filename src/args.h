@@ -60,6 +60,8 @@ class Args
   int verbose;
   std::string pretrainedVectors;
   bool saveOutput;
+  bool cacheTokens;
+  bool cbowWindowSum;
   int seed;
 
   bool qout;
@@ -67,6 +69,8 @@ class Args
   bool qnorm;
   size_t cutoff;
   size_t dsub;
+  int qbits;
+  bool qint8;
 
   std::string autotuneValidationFile;
   std::string autotuneMetric;
@@ -16,8 +16,6 @@
 #include <iostream>
 #include <random>
 #include <thread>
-#include <codecvt>
-#include <locale>
 
 #define LOG_VAL(name, val)                        \
   if (autotuneArgs.verbose > 2) {                 \
@@ -419,8 +417,7 @@ void Autotune::printSkippedArgs(const Args& autotuneArgs)
 
 void Autotune::train(const Args& autotuneArgs)
 {
-  std::wifstream validationFileStream(cstr_to_wstr(autotuneArgs.autotuneValidationFile));
-  validationFileStream.imbue(std::locale(std::locale::empty(), new std::codecvt_utf8<wchar_t>));
+  std::ifstream validationFileStream(cstr_to_wstr(autotuneArgs.autotuneValidationFile));
   if (!validationFileStream.is_open()) {
     throw std::invalid_argument("Validation file cannot be opened!");
   }
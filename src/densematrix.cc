@@ -12,29 +12,61 @@
 #include <stdexcept>
 #include <thread>
 #include <utility>
+#include "kernels.h"
 #include "utils.h"
 #include "vector.h"
 
 namespace fasttext {
 
+// First model file version that pads the header so that the values start at
+// a multiple of DENSE_DATA_ALIGNMENT bytes from the start of the file, where
+// a mapped model can use them in place.
+constexpr int32_t DENSE_ALIGNED_VERSION = 13;
+constexpr int64_t DENSE_DATA_ALIGNMENT = 64;
+
 DenseMatrix::DenseMatrix() : DenseMatrix(0, 0)
 {}
 
+DenseMatrix::DenseMatrix(int32_t fileVersion) : DenseMatrix(0, 0)
+{
+  fileVersion_ = fileVersion;
+}
+
 DenseMatrix::DenseMatrix(int64_t m, int64_t n)
-   : Matrix(m, n), data_(m * n)
-{}
+   : Matrix(m, n), storage_(m * n), fileVersion_(DENSE_ALIGNED_VERSION)
+{
+  data_ = storage_.data();
+}
+
+DenseMatrix::DenseMatrix(const DenseMatrix& other)
+   : Matrix(other.m_, other.n_),
+     storage_(other.data_, other.data_ + (other.m_ * other.n_)),
+     fileVersion_(other.fileVersion_)
+{
+  data_ = storage_.data();
+}
 
 DenseMatrix::DenseMatrix(DenseMatrix&& other) noexcept
-   : Matrix(other.m_, other.n_), data_(std::move(other.data_))
-{}
+   : Matrix(other.m_, other.n_),
+     data_(other.data_),
+     storage_(std::move(other.storage_)),
+     mapping_(std::move(other.mapping_)),
+     fileVersion_(other.fileVersion_)
+{
+  other.data_ = nullptr;
+}
 
 DenseMatrix::DenseMatrix(int64_t m, int64_t n, real* dataPtr)
-   : Matrix(m, n), data_(dataPtr, dataPtr + (m * n))
-{}
+   : Matrix(m, n),
+     storage_(dataPtr, dataPtr + (m * n)),
+     fileVersion_(DENSE_ALIGNED_VERSION)
+{
+  data_ = storage_.data();
+}
 
 void DenseMatrix::zero()
 {
-  std::fill(data_.begin(), data_.end(), 0.0);
+  std::fill(data_, data_ + (m_ * n_), 0.0);
 }
 
 void DenseMatrix::uniformThread(real a, int block, int32_t seed)
@@ -117,19 +149,14 @@ void DenseMatrix::l2NormRow(Vector& norms) const
   }
 }
 
+// NaN is not checked here, this being the innermost loop of training: see
+// Model::update.
 real DenseMatrix::dotRow(const Vector& vec, int64_t i) const
 {
   assert(i >= 0);
   assert(i < m_);
   assert(vec.size() == n_);
-  real d = 0.0;
-  for (int64_t j = 0; j < n_; j++) {
-    d += at(i, j) * vec[j];
-  }
-  if (std::isnan(d)) {
-    throw EncounteredNaNError();
-  }
-  return d;
+  return kernels::dot(data_ + i * n_, vec.data(), n_);
 }
 
 void DenseMatrix::addVectorToRow(const Vector& vec, int64_t i, real a)
@@ -137,9 +164,7 @@ void DenseMatrix::addVectorToRow(const Vector& vec, int64_t i, real a)
   assert(i >= 0);
   assert(i < m_);
   assert(vec.size() == n_);
-  for (int64_t j = 0; j < n_; j++) {
-    data_[i * n_ + j] += a * vec[j];
-  }
+  kernels::axpy(a, vec.data(), data_ + i * n_, n_);
 }
 
 void DenseMatrix::addRowToVector(Vector& x, int32_t i) const
@@ -147,9 +172,7 @@ void DenseMatrix::addRowToVector(Vector& x, int32_t i) const
   assert(i >= 0);
   assert(i < this->size(0));
   assert(x.size() == this->size(1));
-  for (int64_t j = 0; j < n_; j++) {
-    x[j] += at(i, j);
-  }
+  kernels::add(data_ + i * n_, x.data(), n_);
 }
 
 void DenseMatrix::addRowToVector(Vector& x, int32_t i, real a) const
@@ -157,24 +180,119 @@ void DenseMatrix::addRowToVector(Vector& x, int32_t i, real a) const
   assert(i >= 0);
   assert(i < this->size(0));
   assert(x.size() == this->size(1));
-  for (int64_t j = 0; j < n_; j++) {
-    x[j] += a * at(i, j);
-  }
+  kernels::axpy(a, data_ + i * n_, x.data(), n_);
+}
+
+void DenseMatrix::dotRows(const Vector& vec, Vector& out) const
+{
+  assert(vec.size() == n_);
+  assert(out.size() == m_);
+  kernels::gemv(data_, nullptr, m_, n_, vec.data(), out.data());
 }
 
+void DenseMatrix::addVectorToRows(
+    const Vector& vec,
+    const Vector& alpha,
+    Vector& grad)
+{
+  assert(vec.size() == n_);
+  assert(alpha.size() == m_);
+  assert(grad.size() == n_);
+  kernels::updateRows(
+      alpha.data(), vec.data(), data_, nullptr, m_, n_, grad.data());
+}
+
+void DenseMatrix::dotRows(
+    const Vector& vec,
+    const int32_t* rows,
+    int64_t count,
+    real* out) const
+{
+  assert(vec.size() == n_);
+  kernels::gemv(data_, rows, count, n_, vec.data(), out);
+}
+
+void DenseMatrix::addVectorToRows(
+    const Vector& vec,
+    const int32_t* rows,
+    const real* alpha,
+    int64_t count,
+    Vector& grad)
+{
+  assert(vec.size() == n_);
+  assert(grad.size() == n_);
+  kernels::updateRows(alpha, vec.data(), data_, rows, count, n_, grad.data());
+}
+
+// The header ends with the number of padding bytes that follow it, so that
+// streams which cannot tell their position still read back what they wrote.
 void DenseMatrix::save(std::ostream& out) const
 {
   out.write((char*)&m_, sizeof(int64_t));
   out.write((char*)&n_, sizeof(int64_t));
-  out.write((char*)data_.data(), m_ * n_ * sizeof(real));
+  int64_t offset = out.tellp();
+  uint8_t padding = 0;
+  if (offset >= 0) {
+    offset += sizeof(uint8_t);
+    padding = (DENSE_DATA_ALIGNMENT - offset % DENSE_DATA_ALIGNMENT) %
+        DENSE_DATA_ALIGNMENT;
+  }
+  out.write((char*)&padding, sizeof(uint8_t));
+  const char zeros[DENSE_DATA_ALIGNMENT] = {};
+  out.write(zeros, padding);
+  out.write((char*)data_, m_ * n_ * sizeof(real));
 }
 
-void DenseMatrix::load(std::istream& in)
+void DenseMatrix::loadHeader(std::istream& in)
 {
   in.read((char*)&m_, sizeof(int64_t));
   in.read((char*)&n_, sizeof(int64_t));
-  data_ = std::vector<real>(m_ * n_);
-  in.read((char*)data_.data(), m_ * n_ * sizeof(real));
+  if (fileVersion_ >= DENSE_ALIGNED_VERSION) {
+    uint8_t padding = 0;
+    in.read((char*)&padding, sizeof(uint8_t));
+    in.ignore(padding);
+  }
+}
+
+void DenseMatrix::load(std::istream& in)
+{
+  loadHeader(in);
+  storage_ = std::vector<real>(m_ * n_);
+  data_ = storage_.data();
+  mapping_.reset();
+  in.read((char*)data_, m_ * n_ * sizeof(real));
+}
+
+void DenseMatrix::load(
+    std::istream& in,
+    std::shared_ptr<utils::MappedFile> mapping)
+{
+  if (!mapping) {
+    load(in);
+    return;
+  }
+  loadHeader(in);
+  int64_t offset = in.tellg();
+  int64_t bytes = m_ * n_ * sizeof(real);
+  bool inPlace = offset >= 0 && offset + bytes <= mapping->size() &&
+      reinterpret_cast<uintptr_t>(mapping->data() + offset) % alignof(real) ==
+          0;
+  if (!inPlace && fileVersion_ >= DENSE_ALIGNED_VERSION) {
+    throw std::invalid_argument("Invalid model file: truncated matrix");
+  }
+  // Older files do not pad the header, so the matrix, which follows the
+  // variable-length dictionary, is only aligned by chance.
+  if (!inPlace) {
+    storage_ = std::vector<real>(m_ * n_);
+    data_ = storage_.data();
+    mapping_.reset();
+    in.read((char*)data_, bytes);
+    return;
+  }
+  storage_ = std::vector<real>();
+  data_ = reinterpret_cast<real*>(mapping->data() + offset);
+  mapping_ = mapping;
+  in.seekg(offset + bytes);
 }
 
 void DenseMatrix::dump(std::ostream& out) const
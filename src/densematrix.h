@@ -11,6 +11,7 @@
 #include <assert.h>
 #include <cstdint>
 #include <istream>
+#include <memory>
 #include <ostream>
 #include <stdexcept>
 #include <vector>
@@ -24,28 +25,37 @@ class Vector;
 
 class DenseMatrix : public Matrix {
  protected:
-  std::vector<real> data_;
+  // data_ points either into storage_ or, for a matrix loaded as a view of
+  // a model file, into mapping_.
+  real* data_;
+  std::vector<real> storage_;
+  std::shared_ptr<utils::MappedFile> mapping_;
+  // Version of the model file being loaded, which tells its layout.
+  int32_t fileVersion_;
   void uniformThread(real, int, int32_t);
+  void loadHeader(std::istream&);
 
  public:
   DenseMatrix();
+  // For loading a matrix from a model file of the given version.
+  explicit DenseMatrix(int32_t fileVersion);
   explicit DenseMatrix(int64_t, int64_t);
   explicit DenseMatrix(int64_t m, int64_t n, real* dataPtr);
-  DenseMatrix(const DenseMatrix&) = default;
+  DenseMatrix(const DenseMatrix&);
   DenseMatrix(DenseMatrix&&) noexcept;
   DenseMatrix& operator=(const DenseMatrix&) = delete;
   DenseMatrix& operator=(DenseMatrix&&) = delete;
   virtual ~DenseMatrix() noexcept override = default;
 
   inline real* data() {
-    return data_.data();
+    return data_;
   }
   inline const real* data() const {
-    return data_.data();
+    return data_;
   }
 
   inline const real& at(int64_t i, int64_t j) const {
-    assert(i * n_ + j < data_.size());
+    assert(i * n_ + j < m_ * n_);
     return data_[i * n_ + j];
   };
   inline real& at(int64_t i, int64_t j) {
@@ -71,8 +81,20 @@ class DenseMatrix : public Matrix {
   void addVectorToRow(const Vector&, int64_t, real) override;
   void addRowToVector(Vector& x, int32_t i) const override;
   void addRowToVector(Vector& x, int32_t i, real a) const override;
+  void dotRows(const Vector& vec, Vector& out) const override;
+  void addVectorToRows(const Vector& vec, const Vector& alpha, Vector& grad)
+      override;
+  void dotRows(const Vector& vec, const int32_t* rows, int64_t count, real* out)
+      const override;
+  void addVectorToRows(
+      const Vector& vec,
+      const int32_t* rows,
+      const real* alpha,
+      int64_t count,
+      Vector& grad) override;
   void save(std::ostream&) const override;
   void load(std::istream&) override;
+  void load(std::istream&, std::shared_ptr<utils::MappedFile>) override;
   void dump(std::ostream&) const override;
 
   class EncounteredNaNError : public std::runtime_error {
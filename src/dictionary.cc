@@ -8,17 +8,21 @@
 
 #include "dictionary.h"
 #include "strutils.h"
+#include "utils.h"
 
 #include <assert.h>
 
 #include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <numeric>
 #include <stdexcept>
+#include <thread>
 
-#include <codecvt>
 #include <sstream>
 
 
@@ -29,18 +33,58 @@ const std::string Dictionary::SW  = "</w>";
 const std::string Dictionary::BOW = "<";
 const std::string Dictionary::EOW = ">";
 
+constexpr size_t CACHE_BLOCK_SIZE = 1 << 20;
+
+// word2int_ has a power-of-two size and grows past this load.
+constexpr double MAX_TABLE_LOAD = 0.7;
+constexpr size_t MIN_TABLE_SIZE = 64;
+
+void writeTokenCache(std::ostream& out, std::vector<int32_t>& ids)
+{
+  out.write((char*)ids.data(), ids.size() * sizeof(int32_t));
+  ids.clear();
+}
+
+// Renumbers the ids written so far after threshold() sorted and pruned the
+// words; pruned words become CACHE_OOV.
+void remapTokenCache(std::fstream& cache, const std::vector<int32_t>& remap)
+{
+  cache.flush();
+  cache.seekg(0, std::ios::end);
+  const int64_t n = int64_t(cache.tellg()) / sizeof(int32_t);
+  std::vector<int32_t> ids(CACHE_BLOCK_SIZE);
+  for (int64_t i = 0; i < n; i += CACHE_BLOCK_SIZE)
+  {
+    const int64_t m = std::min(n - i, int64_t(CACHE_BLOCK_SIZE));
+    cache.seekg(i * sizeof(int32_t));
+    cache.read((char*)ids.data(), m * sizeof(int32_t));
+    for (int64_t j = 0; j < m; j++)
+    {
+      if (ids[j] >= 0) {
+        ids[j] = remap[ids[j]] >= 0 ? remap[ids[j]] : Dictionary::CACHE_OOV;
+      }
+    }
+    cache.seekp(i * sizeof(int32_t));
+    cache.write((char*)ids.data(), m * sizeof(int32_t));
+  }
+  cache.seekp(0, std::ios::end);
+}
+
 Dictionary::Dictionary(std::shared_ptr<Args> args)
     : args_(args),
-      word2int_((args->vocabSz > 0 ? args->vocabSz : MAX_VOCAB_SIZE), -1),
+      wordOffsets_(1, 0),
       size_(0),
       nwords_(0),
       nlabels_(0),
       ntokens_(0),
       pruneidx_size_(-1)
-{}
+{
+  initTable(args->vocabSz);
+}
 
 Dictionary::Dictionary(std::shared_ptr<Args> args, std::istream& in)
     : args_(args),
+      wordOffsets_(1, 0),
       size_(0),
       nwords_(0),
       nlabels_(0),
@@ -52,13 +96,15 @@ Dictionary::Dictionary(std::shared_ptr<Args> args, std::istream& in)
 
 Dictionary::Dictionary(std::shared_ptr<Args> args, const int32_t vocab_size)
    : args_(args),
-   word2int_(vocab_size, -1),
+   wordOffsets_(1, 0),
    size_(0),
    nwords_(0),
    nlabels_(0),
    ntokens_(0),
    pruneidx_size_(-1)
-{}
+{
+   initTable(vocab_size);
+}
 
 
 int32_t Dictionary::find_id(const std::string& w) const
@@ -69,68 +115,113 @@ int32_t Dictionary::find_id(const std::string& w) const
 
 int32_t Dictionary::find(const std::string& w, uint32_t h) const
 {
-  int32_t word2intsize = word2int_.size();
-  int32_t id = h % word2intsize;
+  return find(w.data(), w.size(), h);
+}
+
+int32_t Dictionary::find(const char* w, size_t size, uint32_t h) const
+{
+  const uint32_t mask = word2int_.size() - 1;
+  uint32_t id = h & mask;
 
-  while (word2int_[id] != -1 && words_[word2int_[id]].word != w)
+  while (word2int_[id].id != -1)
   {
-      id = (id + 1) % word2intsize;
+    if (word2int_[id].hash == h) {
+      const WordView word = getWord(word2int_[id].id);
+      if (word.size() == size && std::memcmp(word.data(), w, size) == 0) {
+        break;
+      }
+    }
+    id = (id + 1) & mask;
   }
   return id;
 }
 
+// Empties word2int_, sized to hold n words without growing.
+void Dictionary::initTable(int64_t n)
+{
+  size_t size = MIN_TABLE_SIZE;
+  while (size * MAX_TABLE_LOAD < n) {
+    size <<= 1;
+  }
+  word2int_.assign(size, WordSlot{-1, 0});
+}
+
+// Stores id in the free slot returned by find(). Once size_ words make the
+// table too full, it doubles; rehashing uses the stored hashes only.
+void Dictionary::insert(int32_t slot, uint32_t h, int32_t id)
+{
+  word2int_[slot].id = id;
+  word2int_[slot].hash = h;
+  if (size_ <= MAX_TABLE_LOAD * word2int_.size()) {
+    return;
+  }
+  std::vector<WordSlot> slots(word2int_.size() * 2, WordSlot{-1, 0});
+  const uint32_t mask = slots.size() - 1;
+  for (const auto& s : word2int_)
+  {
+    if (s.id != -1) {
+      uint32_t i = s.hash & mask;
+      while (slots[i].id != -1) {
+        i = (i + 1) & mask;
+      }
+      slots[i] = s;
+    }
+  }
+  word2int_.swap(slots);
+}
+
 size_t Dictionary::size() const
 {
-   return words_.size();
+   return size_;
 }
 
-const entry& Dictionary::operator[](size_t index) const
+// Appends a word to the arena; the caller updates word2int_ and size_.
+void Dictionary::pushWord(
+    const char* w,
+    size_t size,
+    int64_t count,
+    entry_type type)
 {
-   return words_[index];
+  wordArena_.append(w, size);
+  wordArena_.push_back('\0');
+  wordOffsets_.push_back(wordArena_.size());
+  counts_.push_back(count);
+  types_.push_back(type);
 }
 
 bool Dictionary::find(const std::string& w) const
 {
-   int32_t word2intsize = word2int_.size();
-   int32_t id = hash(w) % word2intsize;
-
-   while (word2int_[id] != -1 && words_[word2int_[id]].word != w)
-   {
-      id = (id + 1) % word2intsize;
-   }
-   return (word2int_[id] > 0) && (words_[word2int_[id]].word == w);
+   return word2int_[find_id(w)].id > 0;
 }
 
-void Dictionary::add(const std::string& w)
+int32_t Dictionary::add(const std::string& w)
 {
-  int32_t h = find_id(w);
+  const uint32_t h = hash(w);
+  const int32_t slot = find(w, h);
+  int32_t id = word2int_[slot].id;
   ntokens_++;
-  if (word2int_[h] == -1) {
-    entry e;
-    e.word = w;
-    e.count = 1;
-    e.type = getType(w);
-    words_.push_back(e);
-    word2int_[h] = size_++;
+  if (id == -1) {
+    pushWord(w.data(), w.size(), 1, getType(w));
+    id = size_++;
+    insert(slot, h, id);
   } else {
-    words_[word2int_[h]].count++;
+    counts_[id]++;
   }
+  return id;
 }
 
 void Dictionary::addStopword()
 {
-   int32_t h = find_id(Dictionary::SW);
+   const uint32_t h = hash(Dictionary::SW);
+   const int32_t slot = find(Dictionary::SW, h);
+   const int32_t id = word2int_[slot].id;
    ntokens_++;
-   if (word2int_[h] == -1) {
-      entry e;
-      e.word = Dictionary::SW;
-      e.count = 1;
-      e.type = entry_type::stopword;
-      words_.push_back(e);
-      word2int_[h] = size_++;
+   if (id == -1) {
+      pushWord(SW.data(), SW.size(), 1, entry_type::stopword);
+      insert(slot, h, size_++);
    }
    else {
-      words_[word2int_[h]].count++;
+      counts_[id]++;
    }
 }
 
@@ -146,17 +237,20 @@ int64_t Dictionary::ntokens() const {
   return ntokens_;
 }
 
-const std::vector<int32_t>& Dictionary::getSubwords(int32_t i) const {
+Span<int32_t> Dictionary::getSubwords(int32_t i) const {
   assert(i >= 0);
   assert(i < nwords_);
-  return words_[i].subwords;
+  const int64_t begin = subwordOffsets_[i];
+  return Span<int32_t>(
+      subwordIds_.data() + begin, subwordOffsets_[i + 1] - begin);
 }
 
 const std::vector<int32_t> Dictionary::getSubwords(const std::string& word) const
 {
   int32_t i = getId(word);
   if (i >= 0) {
-    return getSubwords(i);
+    const Span<int32_t> ngrams = getSubwords(i);
+    return std::vector<int32_t>(ngrams.begin(), ngrams.end());
   }
   std::vector<int32_t> ngrams;
   if (word != EOS || word != SW) {
@@ -175,7 +269,7 @@ void Dictionary::getSubwords(
   substrings.clear();
   if (i >= 0) {
     ngrams.push_back(i);
-    substrings.push_back(words_[i].word);
+    substrings.push_back(getWord(i));
   }
   if (word != EOS || word != SW) {
     computeSubwords(BOW + word + EOW, ngrams, &substrings);
@@ -194,28 +288,30 @@ bool Dictionary::discard(int32_t id, real rand) const
 
 int32_t Dictionary::getId(const std::string& w, uint32_t h) const {
   int32_t id = find(w, h);
-  return word2int_[id];
+  return word2int_[id].id;
 }
 
 int32_t Dictionary::getId(const std::string& w) const {
   int32_t h = find_id(w);
-  return word2int_[h];
+  return word2int_[h].id;
 }
 
 entry_type Dictionary::getType(int32_t id) const {
   assert(id >= 0);
   assert(id < size_);
-  return words_[id].type;
+  return types_[id];
 }
 
 entry_type Dictionary::getType(const std::string& w) const {
   return (w.find(args_->label) == 0) ? entry_type::label : entry_type::word;
 }
 
-std::string Dictionary::getWord(int32_t id) const {
+WordView Dictionary::getWord(int32_t id) const {
   assert(id >= 0);
   assert(id < size_);
-  return words_[id].word;
+  const int64_t begin = wordOffsets_[id];
+  return WordView(
+      wordArena_.data() + begin, wordOffsets_[id + 1] - begin - 1);
 }
 
 // The correct implementation of fnv should be:
@@ -227,9 +323,14 @@ std::string Dictionary::getWord(int32_t id) const {
 // using signed char, we fixed the hash function to make models
 // compatible whatever compiler is used.
 uint32_t Dictionary::hash(const std::string& str) const
+{
+  return hash(str.data(), str.size());
+}
+
+uint32_t Dictionary::hash(const char* str, size_t size) const
 {
   uint32_t h = 2166136261;
-  for (size_t i = 0; i < str.size(); i++) {
+  for (size_t i = 0; i < size; i++) {
     h = h ^ uint32_t(uint8_t(str[i]));
     h = h * 16777619;
   }
@@ -268,99 +369,318 @@ void Dictionary::computeSubwords(
 
 void Dictionary::initNgrams()
 {
+  subwordOffsets_.assign(1, 0);
+  subwordOffsets_.reserve(size_ + 1);
+  subwordIds_.clear();
+  std::string word;
   for (size_t i = 0; i < size_; i++)
   {
-    std::string word = BOW + words_[i].word + EOW;
-    words_[i].subwords.clear();
-    words_[i].subwords.push_back(i);
-    if (words_[i].word != EOS || words_[i].word != SW) {
-      computeSubwords(word, words_[i].subwords);
+    const WordView w = getWord(i);
+    word.assign(BOW).append(w.data(), w.size()).append(EOW);
+    subwordIds_.push_back(i);
+    if (w != EOS || w != SW) {
+      computeSubwords(word, subwordIds_);
     }
+    subwordOffsets_.push_back(subwordIds_.size());
   }
+  subwordIds_.shrink_to_fit();
 }
 
-bool Dictionary::readWord(std::wistream& in, std::string& word) const
+bool Dictionary::readWord(Tokenizer& tokenizer, std::string& word) const
 {
-   static int unget_ch = 0;
-   int c = 0;
+   return tokenizer.readWord(word, !args_->stopwords.empty());
+}
 
-   std::wstreambuf& sb = *in.rdbuf();
-   word.clear();
+void Dictionary::readFromFile(
+    std::istream& in,
+    std::shared_ptr<Dictionary> stopwords,
+    const std::string& cacheFile)
+{
+   Tokenizer tokenizer(in);
+   std::string word;
+   int64_t minThreshold = 1;
 
-   if (unget_ch > 0)
+   // Every token read is also written to cacheFile, so that training can
+   // replay the corpus without tokenizing it again.
+   std::fstream cache;
+   std::vector<int32_t> ids;
+   std::vector<int32_t> remap;
+   if (!cacheFile.empty())
    {
-      unget_ch = 0;
-      word = "";// < / s>";
-      return true;
+      cache.open(cacheFile,
+         std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+      if (!cache.is_open()) {
+         throw std::invalid_argument(
+            cacheFile + " cannot be opened for caching tokens!");
+      }
+      ids.reserve(CACHE_BLOCK_SIZE);
    }
-   unget_ch = 0;
-   while ((c = sb.sbumpc()) != 0xFFFF)
+
+   while (readWord(tokenizer, word))
    {
-      c = (args_->stopwords.empty()) ? translateChar(c) : transformChar(c);
+      bool bf = stopwords && stopwords->find(word);
+      int32_t id = CACHE_EOS;
 
-      if (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' ||
-          c == '\f' || c == '\0')
+      if (bf)
       {
-         ltrim("#@", word);
-         const size_t prevsz = word.size();
-         rtrim("?!.,:;-", word);
-         if (prevsz != word.size())
-         {
-            c = '\n';
+         addStopword();
+         id = CACHE_STOPWORD;
+      }
+      else if (!bf && !word.empty())
+      {
+         id = add(word);
+      }
+      if (cache.is_open())
+      {
+         ids.push_back(id);
+         if (ids.size() == CACHE_BLOCK_SIZE) {
+            writeTokenCache(cache, ids);
          }
-         trim("'/)(\"", word);
+      }
+      if ((ntokens_ % 1000000 == 0) && (ntokens_ > 1000000) && (args_->verbose > 1)) {
+         std::cerr << "\rRead " << ntokens_ / 1000000 << "M words" << std::flush;
+      }
+      if (size_ > 0.75 * MAX_VOCAB_SIZE) {
+         minThreshold++;
+         threshold(minThreshold, minThreshold, &remap);
+         if (cache.is_open()) {
+            writeTokenCache(cache, ids);
+            remapTokenCache(cache, remap);
+         }
+      }
+   }
+   threshold(args_->minCount, args_->minCountLabel, &remap);
+   if (cache.is_open())
+   {
+      writeTokenCache(cache, ids);
+      remapTokenCache(cache, remap);
+      cache.close();
+   }
+   finishReading();
+}
+
+// Counts the words of the lines in [start, end) of filename. Token ids are
+// local to counts and go to cacheFile, if given.
+void Dictionary::countRange(
+    const std::string& filename,
+    int64_t start,
+    int64_t end,
+    std::shared_ptr<Dictionary> stopwords,
+    LocalCounts& counts,
+    const std::string& cacheFile) const
+{
+   std::ifstream ifs(cstr_to_wstr(filename), std::ifstream::binary);
+   utils::seek(ifs, start);
+   Tokenizer tokenizer(ifs, end - start);
+   std::string word;
+
+   std::ofstream cache;
+   std::vector<int32_t> ids;
+   if (!cacheFile.empty())
+   {
+      cache.open(cacheFile, std::ios::out | std::ios::trunc | std::ios::binary);
+      if (!cache.is_open()) {
+         throw std::invalid_argument(
+            cacheFile + " cannot be opened for caching tokens!");
+      }
+      ids.reserve(CACHE_BLOCK_SIZE);
+   }
 
-         if (word.empty())
+   while (readWord(tokenizer, word))
+   {
+      int32_t id = CACHE_EOS;
+      if (!word.empty())
+      {
+         entry_type type = entry_type::word;
+         if (stopwords && stopwords->find(word))
          {
-            if (c == '\n') {
-               word = "";// < / s>";
-               return true;
-            }
-            continue;
+            word = Dictionary::SW;
+            type = entry_type::stopword;
          }
-         else {
-            if (c == '\n') { unget_ch = c; }
-            return true;
+         else
+         {
+            type = getType(word);
          }
+         counts.ntokens++;
+         auto it = counts.word2int.find(word);
+         if (it == counts.word2int.end())
+         {
+            entry e;
+            e.word = word;
+            e.count = 1;
+            e.type = type;
+            it = counts.word2int.emplace(word, counts.words.size()).first;
+            counts.words.push_back(std::move(e));
+         }
+         else
+         {
+            counts.words[it->second].count++;
+         }
+         id = (type == entry_type::stopword) ? CACHE_STOPWORD : it->second;
       }
-
-      if (c > 0)
+      if (cache.is_open())
       {
-         word.push_back(c);
+         ids.push_back(id);
+         if (ids.size() == CACHE_BLOCK_SIZE) {
+            writeTokenCache(cache, ids);
+         }
       }
-      else return true;
    }
-   // trigger eofbit
-   in.get();
-   return !word.empty();
+   if (cache.is_open())
+   {
+      writeTokenCache(cache, ids);
+      cache.close();
+   }
 }
 
-void Dictionary::readFromFile(std::wistream& wis, std::shared_ptr<Dictionary> stopwords)
+// Adds the counts of a range to the dictionary. Merging the ranges in file
+// order inserts the words in order of first occurrence, as add() does.
+void Dictionary::mergeCounts(
+    const LocalCounts& counts,
+    std::vector<int32_t>& local2global)
 {
-   std::string word;
-   int64_t minThreshold = 1;
-
-   while (readWord(wis, word))
+   local2global.resize(counts.words.size());
+   for (size_t i = 0; i < counts.words.size(); i++)
    {
-      bool bf = stopwords && stopwords->find(word);
-
-      if (bf)
+      const entry& e = counts.words[i];
+      const uint32_t h = hash(e.word);
+      const int32_t slot = find(e.word, h);
+      int32_t id = word2int_[slot].id;
+      if (id == -1)
       {
-         addStopword();
+         pushWord(e.word.data(), e.word.size(), e.count, e.type);
+         id = size_++;
+         insert(slot, h, id);
       }
-      else if (!bf && !word.empty())
+      else
       {
-         add(word);
+         counts_[id] += e.count;
       }
-      if ((ntokens_ % 1000000 == 0) && (ntokens_ > 1000000) && (args_->verbose > 1)) {
-         std::cerr << "\rRead " << ntokens_ / 1000000 << "M words" << std::flush;
+      local2global[i] = id;
+   }
+   ntokens_ += counts.ntokens;
+}
+
+// Reads filename with one thread per byte range (split at line starts) when
+// args_->thread > 1. The dictionary and the token cache are the same as
+// those of the serial reader, unless the vocabulary grows past
+// 0.75 * MAX_VOCAB_SIZE: rare words are then pruned after the merge rather
+// than while reading.
+void Dictionary::readFromFile(
+    const std::string& filename,
+    std::shared_ptr<Dictionary> stopwords,
+    const std::string& cacheFile)
+{
+   std::ifstream ifs(cstr_to_wstr(filename), std::ifstream::binary);
+   if (!ifs.is_open()) {
+      throw std::invalid_argument(filename + " cannot be opened for reading!");
+   }
+   const int32_t nthreads = std::max(args_->thread, 1);
+   if (nthreads == 1)
+   {
+      ifs.close();
+      std::ifstream in(cstr_to_wstr(filename));
+      readFromFile(in, stopwords, cacheFile);
+      return;
+   }
+
+   const int64_t size = utils::size(ifs);
+   std::vector<int64_t> offsets(nthreads + 1, size);
+   offsets[0] = 0;
+   for (int32_t i = 1; i < nthreads; i++) {
+      offsets[i] = utils::nextLine(ifs, i * size / nthreads);
+   }
+   ifs.close();
+
+   std::vector<LocalCounts> counts(nthreads);
+   std::vector<std::string> cacheFiles(nthreads);
+   std::vector<std::exception_ptr> errors(nthreads);
+   std::vector<std::thread> threads;
+   for (int32_t i = 0; i < nthreads; i++)
+   {
+      if (!cacheFile.empty()) {
+         cacheFiles[i] = cacheFile + "." + std::to_string(i);
       }
-      if (size_ > 0.75 * MAX_VOCAB_SIZE) {
-         minThreshold++;
-         threshold(minThreshold, minThreshold);
+      threads.push_back(std::thread([&, i]() {
+         try {
+            countRange(filename, offsets[i], offsets[i + 1], stopwords,
+                       counts[i], cacheFiles[i]);
+         } catch (...) {
+            errors[i] = std::current_exception();
+         }
+      }));
+   }
+   for (auto& thread : threads) {
+      thread.join();
+   }
+   for (auto& error : errors)
+   {
+      if (error) {
+         for (auto& file : cacheFiles) {
+            if (!file.empty()) {
+               std::remove(file.c_str());
+            }
+         }
+         std::rethrow_exception(error);
+      }
+   }
+
+   std::vector<std::vector<int32_t>> local2global(nthreads);
+   for (int32_t i = 0; i < nthreads; i++)
+   {
+      mergeCounts(counts[i], local2global[i]);
+      counts[i] = LocalCounts();
+   }
+
+   std::vector<int32_t> remap;
+   int64_t minThreshold = 1;
+   while (size_ > 0.75 * MAX_VOCAB_SIZE)
+   {
+      minThreshold++;
+      threshold(minThreshold, minThreshold, &remap);
+      for (auto& ids : local2global) {
+         for (auto& id : ids) {
+            id = id >= 0 ? remap[id] : -1;
+         }
       }
    }
-   threshold(args_->minCount, args_->minCountLabel);
+   threshold(args_->minCount, args_->minCountLabel, &remap);
+
+   if (!cacheFile.empty())
+   {
+      std::ofstream cache(
+         cacheFile, std::ios::out | std::ios::trunc | std::ios::binary);
+      if (!cache.is_open()) {
+         throw std::invalid_argument(
+            cacheFile + " cannot be opened for caching tokens!");
+      }
+      std::vector<int32_t> ids(CACHE_BLOCK_SIZE);
+      for (int32_t i = 0; i < nthreads; i++)
+      {
+         std::ifstream part(cacheFiles[i], std::ios::in | std::ios::binary);
+         while (part.read((char*)ids.data(), ids.size() * sizeof(int32_t)) ||
+                part.gcount() > 0)
+         {
+            ids.resize(part.gcount() / sizeof(int32_t));
+            for (auto& id : ids)
+            {
+               if (id >= 0) {
+                  const int32_t g = local2global[i][id];
+                  id = (g >= 0 && remap[g] >= 0) ? remap[g] : CACHE_OOV;
+               }
+            }
+            writeTokenCache(cache, ids);
+            ids.resize(CACHE_BLOCK_SIZE);
+         }
+         part.close();
+         std::remove(cacheFiles[i].c_str());
+      }
+   }
+   finishReading();
+}
+
+void Dictionary::finishReading()
+{
    initTableDiscard();
    initNgrams();
    if (args_->verbose > 0) {
@@ -375,47 +695,71 @@ void Dictionary::readFromFile(std::wistream& wis, std::shared_ptr<Dictionary> st
    }
 }
 
-void Dictionary::threshold(int64_t t, int64_t tl)
+void Dictionary::threshold(int64_t t, int64_t tl, std::vector<int32_t>* remap)
 {
-  sort(words_.begin(), words_.end(), [](const entry& e1, const entry& e2) {
-    if (e1.type != e2.type) {
-      return e1.type < e2.type;
+  // Sorting indices performs the same comparisons as sorting the entries,
+  // so the order is unchanged, but it also tells where each word went.
+  std::vector<int32_t> order(size_);
+  std::iota(order.begin(), order.end(), 0);
+  sort(order.begin(), order.end(), [this](int32_t i1, int32_t i2) {
+    if (types_[i1] != types_[i2]) {
+      return types_[i1] < types_[i2];
     }
-    return e1.count > e2.count;
+    return counts_[i1] > counts_[i2];
   });
-  words_.erase(
-      remove_if(
-          words_.begin(),
-          words_.end(),
-          [&](const entry& e) {
-            return (e.type == entry_type::word && e.count < t) ||
-                (e.type == entry_type::label && e.count < tl) ||
-                (e.type == entry_type::stopword && e.count < t);
-          }),
-      words_.end());
-  words_.shrink_to_fit();
+  if (remap) {
+    remap->assign(size_, -1);
+  }
+
+  std::string arena;
+  std::vector<int64_t> offsets(1, 0);
+  std::vector<int64_t> counts;
+  std::vector<entry_type> types;
+  arena.swap(wordArena_);
+  offsets.swap(wordOffsets_);
+  counts.swap(counts_);
+  types.swap(types_);
+
   size_ = 0;
   nwords_ = 0;
   nlabels_ = 0;
-  std::fill(word2int_.begin(), word2int_.end(), -1);
-  for (auto it = words_.begin(); it != words_.end(); ++it)
+  for (auto i : order)
   {
-    int32_t h = find_id(it->word);
-    word2int_[h] = size_++;
-    if (it->type == entry_type::word || it->type == entry_type::stopword) {
+    const entry_type type = types[i];
+    if ((type == entry_type::word && counts[i] < t) ||
+        (type == entry_type::label && counts[i] < tl) ||
+        (type == entry_type::stopword && counts[i] < t)) {
+      continue;
+    }
+    if (remap) {
+      (*remap)[i] = size_;
+    }
+    pushWord(
+        arena.data() + offsets[i], offsets[i + 1] - offsets[i] - 1,
+        counts[i], type);
+    size_++;
+    if (type == entry_type::word || type == entry_type::stopword) {
       nwords_++;
     }
-    if (it->type == entry_type::label) {
+    if (type == entry_type::label) {
       nlabels_++;
     }
   }
+  wordArena_.shrink_to_fit();
+  initTable(size_);
+  for (int32_t i = 0; i < size_; i++)
+  {
+    const WordView w = getWord(i);
+    const uint32_t h = hash(w.data(), w.size());
+    insert(find(w.data(), w.size(), h), h, i);
+  }
 }
 
 void Dictionary::initTableDiscard()
 {
   pdiscard_.resize(size_);
   for (size_t i = 0; i < size_; i++) {
-    real f = real(words_[i].count) / real(ntokens_);
+    real f = real(counts_[i]) / real(ntokens_);
     pdiscard_[i] = std::sqrt(args_->t / f) + args_->t / f;
   }
 }
@@ -423,9 +767,9 @@ void Dictionary::initTableDiscard()
 std::vector<int64_t> Dictionary::getCounts(entry_type type) const
 {
   std::vector<int64_t> counts;
-  for (auto& w : words_) {
-    if (w.type == type) {
-      counts.push_back(w.count);
+  for (int32_t i = 0; i < size_; i++) {
+    if (types_[i] == type) {
+      counts.push_back(counts_[i]);
     }
   }
   return counts;
@@ -462,31 +806,30 @@ void Dictionary::addSubwords(
       line.push_back(wid);
     }
     else { // in vocab w/ subwords
-      const std::vector<int32_t>& ngrams = getSubwords(wid);
+      const Span<int32_t> ngrams = getSubwords(wid);
       line.insert(line.end(), ngrams.cbegin(), ngrams.cend());
     }
   }
 }
 
-void Dictionary::reset(std::wistream& in) const
+void Dictionary::reset(Tokenizer& tokenizer) const
 {
-  if (in.eof()) {
-    in.clear();
-    in.seekg(std::streampos(0));
+  if (tokenizer.exhausted()) {
+    tokenizer.rewind();
   }
 }
 
-int32_t Dictionary::getLine(std::wistream& in, std::vector<int32_t>& words, std::shared_ptr<Dictionary> stopwords) const
+int32_t Dictionary::getLine(Tokenizer& tokenizer, std::vector<int32_t>& words, std::shared_ptr<Dictionary> stopwords) const
 {
    std::string token;
    int32_t ntokens = 0;
 
-   reset(in);
+   reset(tokenizer);
    words.clear();
 
    std::vector<int32_t> line;
 
-   while (readWord(in, token))
+   while (readWord(tokenizer, token))
    {
       if (token.empty())
       {
@@ -501,7 +844,7 @@ int32_t Dictionary::getLine(std::wistream& in, std::vector<int32_t>& words, std:
       ntokens++;
 
       int32_t h = find_id(token);
-      int32_t wid = word2int_[h];
+      int32_t wid = word2int_[h].id;
       if (wid < 0) {
          continue;
       }
@@ -523,7 +866,7 @@ int32_t Dictionary::getLine(std::wistream& in, std::vector<int32_t>& words, std:
    if (!line.empty()) {
       printf(">>");
       for (auto wid : line) {
-         const std::string& str = words_[wid].word;
+         const WordView str = getWord(wid);
          printf(" %s[%d]", str.c_str(), wid);
       }
       printf(" <%d>\n", ntokens);
@@ -532,7 +875,7 @@ int32_t Dictionary::getLine(std::wistream& in, std::vector<int32_t>& words, std:
 }
 
 int32_t Dictionary::getLine(
-    std::wistream& in,
+    Tokenizer& tokenizer,
     std::vector<int32_t>& words,
     std::minstd_rand& rng) const
 {
@@ -540,19 +883,19 @@ int32_t Dictionary::getLine(
   std::string token;
   int32_t ntokens = 0;
 
-  reset(in);
+  reset(tokenizer);
   words.clear();
 
   std::vector<int32_t> line;
 
-  while (readWord(in, token))
+  while (readWord(tokenizer, token))
   {
      if (token.empty())
      {
         break;
      }
     int32_t h = find_id(token);
-    int32_t wid = word2int_[h];
+    int32_t wid = word2int_[h].id;
     if (wid < 0) {
       continue;
     }
@@ -574,7 +917,7 @@ int32_t Dictionary::getLine(
   if (!line.empty()) {
      printf(">>");
      for (auto wid: line) {
-        const std::string& str = words_[wid].word;
+        const WordView str = getWord(wid);
         printf(" %s", str.c_str());
      }
      printf("\n");
@@ -583,7 +926,7 @@ int32_t Dictionary::getLine(
 }
 
 int32_t Dictionary::getLine(
-    std::wistream& in,
+    Tokenizer& tokenizer,
     std::vector<int32_t>& words,
     std::vector<int32_t>& labels) const
 {
@@ -591,10 +934,10 @@ int32_t Dictionary::getLine(
   std::string token;
   int32_t ntokens = 0;
 
-  reset(in);
+  reset(tokenizer);
   words.clear();
   labels.clear();
-  while (readWord(in, token))
+  while (readWord(tokenizer, token))
   {
      if (token.empty())
      {
@@ -621,6 +964,75 @@ int32_t Dictionary::getLine(
   return ntokens;
 }
 
+int32_t Dictionary::getLine(
+    TokenCursor& cursor,
+    std::vector<int32_t>& words,
+    std::minstd_rand& rng) const
+{
+  std::uniform_real_distribution<> uniform(0, 1);
+  const int32_t eos = getId(EOS);
+  int32_t ntokens = 0;
+
+  if (cursor.pos >= cursor.size) {
+    cursor.pos = 0;
+  }
+  words.clear();
+  while (cursor.pos < cursor.size)
+  {
+    int32_t wid = cursor.ids[cursor.pos++];
+    if (wid == CACHE_EOS) {
+      break;
+    }
+    if (wid < 0) {
+      continue;
+    }
+    ntokens++;
+    if (getType(wid) == entry_type::word && !discard(wid, uniform(rng)))
+    {
+      words.push_back(wid);
+    }
+    if (ntokens > MAX_LINE_SIZE || wid == eos) {
+      break;
+    }
+  }
+  return ntokens;
+}
+
+int32_t Dictionary::getLine(
+    TokenCursor& cursor,
+    std::vector<int32_t>& words) const
+{
+  const int32_t eos = getId(EOS);
+  int32_t ntokens = 0;
+
+  if (cursor.pos >= cursor.size) {
+    cursor.pos = 0;
+  }
+  words.clear();
+  while (cursor.pos < cursor.size)
+  {
+    int32_t wid = cursor.ids[cursor.pos++];
+    if (wid == CACHE_EOS) {
+      break;
+    }
+    if (wid == CACHE_STOPWORD) {
+      continue;
+    }
+    ntokens++;
+    if (wid < 0) {
+      continue;
+    }
+    if (ntokens > MAX_LINE_SIZE || wid == eos) {
+      break;
+    }
+    if (getType(wid) == entry_type::word)
+    {
+      words.push_back(wid);
+    }
+  }
+  return ntokens;
+}
+
 void Dictionary::pushHash(std::vector<int32_t>& hashes, int32_t id) const
 {
   if (pruneidx_size_ == 0 || id < 0) {
@@ -643,7 +1055,7 @@ std::string Dictionary::getLabel(int32_t lid) const
   if (lid < 0 || lid >= nlabels_) {
     throw std::invalid_argument("Label id is out of range [0, " + std::to_string(nlabels_) + "]");
   }
-  return words_[lid + nwords_].word;
+  return getWord(lid + nwords_);
 }
 
 void Dictionary::save(std::ostream& out) const
@@ -655,11 +1067,11 @@ void Dictionary::save(std::ostream& out) const
   out.write((char*)&pruneidx_size_, sizeof(int64_t));
   for (int32_t i = 0; i < size_; i++)
   {
-    entry e = words_[i];
-    out.write(e.word.data(), e.word.size() * sizeof(char));
-    out.put(0);
-    out.write((char*)&(e.count), sizeof(int64_t));
-    out.write((char*)&(e.type), sizeof(entry_type));
+    // the arena keeps the '\0' that ends each word in the file
+    const int64_t begin = wordOffsets_[i];
+    out.write(wordArena_.data() + begin, wordOffsets_[i + 1] - begin);
+    out.write((char*)&(counts_[i]), sizeof(int64_t));
+    out.write((char*)&(types_[i]), sizeof(entry_type));
   }
   for (const auto pair : pruneidx_)
   {
@@ -670,7 +1082,10 @@ void Dictionary::save(std::ostream& out) const
 
 void Dictionary::load(std::istream& in)
 {
-  words_.clear();
+  wordArena_.clear();
+  wordOffsets_.assign(1, 0);
+  counts_.clear();
+  types_.clear();
   in.read((char*)&size_, sizeof(int32_t));
   in.read((char*)&nwords_, sizeof(int32_t));
   in.read((char*)&nlabels_, sizeof(int32_t));
@@ -679,14 +1094,18 @@ void Dictionary::load(std::istream& in)
   for (int32_t i = 0; i < size_; i++)
   {
     char c;
-    entry e;
+    int64_t count;
+    entry_type type;
     while ((c = in.get()) != 0)
     {
-      e.word.push_back(c);
+      wordArena_.push_back(c);
     }
-    in.read((char*)&e.count, sizeof(int64_t));
-    in.read((char*)&e.type, sizeof(entry_type));
-    words_.push_back(e);
+    wordArena_.push_back('\0');
+    wordOffsets_.push_back(wordArena_.size());
+    in.read((char*)&count, sizeof(int64_t));
+    in.read((char*)&type, sizeof(entry_type));
+    counts_.push_back(count);
+    types_.push_back(type);
   }
   pruneidx_.clear();
   for (int32_t i = 0; i < pruneidx_size_; i++)
@@ -700,11 +1119,12 @@ void Dictionary::load(std::istream& in)
   initTableDiscard();
   initNgrams();
 
-  int32_t word2intsize = std::ceil(size_ / 0.7);
-  word2int_.assign(word2intsize, -1);
+  initTable(size_);
   for (int32_t i = 0; i < size_; i++)
   {
-    word2int_[find_id(words_[i].word)] = i;
+    const WordView w = getWord(i);
+    const uint32_t h = hash(w.data(), w.size());
+    insert(find(w.data(), w.size(), h), h, i);
   }
 }
 
@@ -740,39 +1160,52 @@ void Dictionary::prune(std::vector<int32_t>& idx)
   }
   pruneidx_size_ = pruneidx_.size();
 
-  std::fill(word2int_.begin(), word2int_.end(), -1);
+  std::string arena;
+  std::vector<int64_t> offsets(1, 0);
+  std::vector<int64_t> counts;
+  std::vector<entry_type> types;
+  arena.swap(wordArena_);
+  offsets.swap(wordOffsets_);
+  counts.swap(counts_);
+  types.swap(types_);
+  initTable(size_);
 
   int32_t j = 0;
-  for (int32_t i = 0; i < words_.size(); i++)
+  for (int32_t i = 0; i < counts.size(); i++)
   {
-    if (getType(i) == entry_type::label ||
+    if (types[i] == entry_type::label ||
         (j < words.size() && words[j] == i))
     {
-      words_[j] = words_[i];
-      word2int_[find_id(words_[j].word)] = j;
+      pushWord(
+          arena.data() + offsets[i], offsets[i + 1] - offsets[i] - 1,
+          counts[i], types[i]);
+      const WordView w = getWord(j);
+      const uint32_t h = hash(w.data(), w.size());
+      insert(find(w.data(), w.size(), h), h, j);
       j++;
     }
   }
   nwords_ = words.size();
   size_ = nwords_ + nlabels_;
-  words_.erase(words_.begin() + size_, words_.end());
   initNgrams();
 }
 
 void Dictionary::dump(std::ostream& out) const
 {
   out << "-----------------" << std::endl;
-  out << "words :" << words_.size() << std::endl;
-  for (auto it : words_)
+  out << "words :" << size_ << std::endl;
+  for (int32_t i = 0; i < size_; i++)
   {
     std::string entryType = "word";
-    if (it.type == entry_type::label) {
+    if (types_[i] == entry_type::label) {
       entryType = "label";
     }
-    else if (it.type == entry_type::stopword) {
+    else if (types_[i] == entry_type::stopword) {
        entryType = "stopwrd";
     }
-    out << it.word << " :" << it.count << " " << entryType << std::endl;
+    const WordView w = getWord(i);
+    out.write(w.data(), w.size());
+    out << " :" << counts_[i] << " " << entryType << std::endl;
   }
 }
 
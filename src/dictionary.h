@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <cstring>
 #include <istream>
 #include <memory>
 #include <ostream>
@@ -18,6 +19,8 @@
 
 #include "args.h"
 #include "real.h"
+#include "span.h"
+#include "tokenizer.h"
 
 namespace fasttext {
 
@@ -28,7 +31,35 @@ struct entry {
   std::string word;
   int64_t count;
   entry_type type;
-  std::vector<int32_t> subwords;
+};
+
+// Read-only view of a word stored in a Dictionary. Words are kept
+// NUL-terminated, so c_str() is valid, and the view converts to a string
+// where a copy is needed.
+class WordView : public Span<char> {
+ public:
+  WordView(const char* data, size_t size) : Span<char>(data, size) {}
+
+  inline const char* c_str() const {
+    return data_;
+  }
+  inline operator std::string() const {
+    return std::string(data_, size_);
+  }
+  inline bool operator==(const std::string& w) const {
+    return w.size() == size_ && std::memcmp(w.data(), data_, size_) == 0;
+  }
+  inline bool operator!=(const std::string& w) const {
+    return !(*this == w);
+  }
+};
+
+// Position in a token cache written by Dictionary::readFromFile: one int32
+// per token, holding its word id or one of the Dictionary::CACHE_* markers.
+struct TokenCursor {
+  const int32_t* ids;
+  int64_t size;
+  int64_t pos;
 };
 
 class Dictionary
@@ -37,17 +68,56 @@ class Dictionary
   static const int32_t MAX_VOCAB_SIZE = 30000000;
   static const int32_t MAX_LINE_SIZE = 1024;
 
+  // Slot of the open-addressing table from words to ids. The hash of the
+  // word is kept next to its id, so most probes are rejected without
+  // comparing strings.
+  struct WordSlot {
+    int32_t id;
+    uint32_t hash;
+  };
+
   int32_t find_id(const std::string&) const;
   int32_t find(const std::string&, uint32_t h) const;
+  int32_t find(const char*, size_t, uint32_t h) const;
+  uint32_t hash(const char*, size_t) const;
+  void initTable(int64_t);
+  void insert(int32_t, uint32_t, int32_t);
   void initTableDiscard();
   void initNgrams();
-  void reset(std::wistream&) const;
+  void reset(Tokenizer&) const;
   void pushHash(std::vector<int32_t>&, int32_t) const;
   void addSubwords(std::vector<int32_t>&, const std::string&, int32_t) const;
 
+  // Words counted by one thread of the parallel vocabulary pass, in order of
+  // first occurrence.
+  struct LocalCounts {
+    std::vector<entry> words;
+    std::unordered_map<std::string, int32_t> word2int;
+    int64_t ntokens = 0;
+  };
+  void countRange(
+      const std::string& filename,
+      int64_t start,
+      int64_t end,
+      std::shared_ptr<Dictionary> stopwords,
+      LocalCounts& counts,
+      const std::string& cacheFile) const;
+  void mergeCounts(const LocalCounts&, std::vector<int32_t>& local2global);
+  void finishReading();
+  void pushWord(const char*, size_t, int64_t, entry_type);
+
   std::shared_ptr<Args> args_;
-  std::vector<int32_t> word2int_;
-  std::vector<entry> words_;
+  std::vector<WordSlot> word2int_;
+
+  // Word i is wordArena_[wordOffsets_[i], wordOffsets_[i + 1] - 1), each
+  // word being followed by '\0'. Its subword ids are
+  // subwordIds_[subwordOffsets_[i], subwordOffsets_[i + 1]).
+  std::string wordArena_;
+  std::vector<int64_t> wordOffsets_;
+  std::vector<int64_t> counts_;
+  std::vector<entry_type> types_;
+  std::vector<int64_t> subwordOffsets_;
+  std::vector<int32_t> subwordIds_;
 
   std::vector<real> pdiscard_;
   int32_t size_;
@@ -68,6 +138,10 @@ class Dictionary
   static const std::string BOW;
   static const std::string EOW;
 
+  static const int32_t CACHE_EOS = -1;
+  static const int32_t CACHE_OOV = -2;
+  static const int32_t CACHE_STOPWORD = -3;
+
   explicit Dictionary(std::shared_ptr<Args>);
   explicit Dictionary(std::shared_ptr<Args>, std::istream&);
   explicit Dictionary(std::shared_ptr<Args> args, const int32_t);
@@ -80,8 +154,8 @@ class Dictionary
   entry_type getType(int32_t) const;
   entry_type getType(const std::string&) const;
   bool discard(int32_t, real) const;
-  std::string getWord(int32_t) const;
-  const std::vector<int32_t>& getSubwords(int32_t) const;
+  WordView getWord(int32_t) const;
+  Span<int32_t> getSubwords(int32_t) const;
   const std::vector<int32_t> getSubwords(const std::string&) const;
   void getSubwords(
       const std::string&,
@@ -92,21 +166,31 @@ class Dictionary
       std::vector<int32_t>&,
       std::vector<std::string>* substrings = nullptr) const;
   uint32_t hash(const std::string& str) const;
-  void add(const std::string&);
+  int32_t add(const std::string&);
   void addStopword();
-  bool readWord(std::wistream& in, std::string& word) const;
-  void readFromFile(std::wistream&, std::shared_ptr<Dictionary>);
+  bool readWord(Tokenizer& tokenizer, std::string& word) const;
+  void readFromFile(
+      std::istream&,
+      std::shared_ptr<Dictionary>,
+      const std::string& cacheFile = std::string());
+  void readFromFile(
+      const std::string& filename,
+      std::shared_ptr<Dictionary>,
+      const std::string& cacheFile = std::string());
   std::string getLabel(int32_t) const;
   void save(std::ostream&) const;
   void load(std::istream&);
   std::vector<int64_t> getCounts(entry_type) const;
-  int32_t getLine(std::wistream& in, std::vector<int32_t>& words, std::shared_ptr<Dictionary> stopwords)
+  int32_t getLine(Tokenizer& tokenizer, std::vector<int32_t>& words, std::shared_ptr<Dictionary> stopwords)
      const;
-  int32_t getLine(std::wistream&, std::vector<int32_t>&, std::vector<int32_t>&)
+  int32_t getLine(Tokenizer&, std::vector<int32_t>&, std::vector<int32_t>&)
+      const;
+  int32_t getLine(Tokenizer&, std::vector<int32_t>&, std::minstd_rand&)
       const;
-  int32_t getLine(std::wistream&, std::vector<int32_t>&, std::minstd_rand&)
+  int32_t getLine(TokenCursor&, std::vector<int32_t>&) const;
+  int32_t getLine(TokenCursor&, std::vector<int32_t>&, std::minstd_rand&)
       const;
-  void threshold(int64_t, int64_t);
+  void threshold(int64_t, int64_t, std::vector<int32_t>* remap = nullptr);
   void prune(std::vector<int32_t>&);
   bool isPruned() {
     return pruneidx_size_ >= 0;
@@ -115,7 +199,6 @@ class Dictionary
   void init();
   bool find(const std::string& w) const;
   size_t size() const;
-  const entry& operator[](size_t index) const;
 };
 
 } // namespace fasttext
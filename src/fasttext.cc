@@ -7,13 +7,21 @@
  */
 
 #include "fasttext.h"
+#include "int8matrix.h"
+#include "kernels.h"
 #include "loss.h"
 #include "quantmatrix.h"
 #include "strutils.h"
 
 #include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <numeric>
 #include <sstream>
 #include <stdexcept>
@@ -21,13 +29,53 @@
 #include <thread>
 #include <vector>
 
-#include <codecvt>
-#include <sstream>
-
 namespace fasttext {
 
-constexpr int32_t FASTTEXT_VERSION = 12; /* Version 1b */
+constexpr int32_t FASTTEXT_VERSION = 13; /* Version 1c */
 constexpr int32_t FASTTEXT_FILEFORMAT_MAGIC_INT32 = 793712314;
+// Lines predicted together by test.
+constexpr size_t PREDICT_BATCH_SIZE = 256;
+// Bytes of whole lines handed to a predict worker at a time.
+constexpr size_t PREDICT_CHUNK_SIZE = 1 << 20;
+// Queries searched together by the batch getNN, and words scored against
+// them at a time.
+constexpr int64_t NN_QUERY_BLOCK = 64;
+constexpr int64_t NN_WORD_BLOCK = 4096;
+// Kinds of matrices, written before each of them in model files. Files
+// before version 13 only have the first two, as a bool telling whether the
+// matrix is product quantized.
+constexpr uint8_t DENSE_MATRIX = 0;
+constexpr uint8_t PQ_MATRIX = 1;
+constexpr uint8_t INT8_MATRIX = 2;
+
+namespace {
+
+uint8_t matrixKind(const Matrix& matrix)
+{
+  if (dynamic_cast<const QuantMatrix*>(&matrix)) {
+    return PQ_MATRIX;
+  }
+  if (dynamic_cast<const Int8Matrix*>(&matrix)) {
+    return INT8_MATRIX;
+  }
+  return DENSE_MATRIX;
+}
+
+std::shared_ptr<Matrix> newMatrix(uint8_t kind, int32_t version)
+{
+  switch (kind) {
+    case DENSE_MATRIX:
+      return std::make_shared<DenseMatrix>(version);
+    case PQ_MATRIX:
+      return std::make_shared<QuantMatrix>(version);
+    case INT8_MATRIX:
+      return std::make_shared<Int8Matrix>();
+    default:
+      throw std::invalid_argument("Invalid model file: unknown matrix kind");
+  }
+}
+
+} // namespace
 
 bool comparePairs(
     const std::pair<real, std::string>& l,
@@ -53,6 +101,7 @@ std::shared_ptr<Loss> FastText::createLoss(std::shared_ptr<Matrix>& output)
 
 FastText::FastText()
    : quant_(false)
+   , version(FASTTEXT_VERSION)
    , wordVectors_(nullptr)
    , trainException_(nullptr)
 {}
@@ -89,6 +138,7 @@ void FastText::setMatrices(
 
   input_ = std::dynamic_pointer_cast<Matrix>(inputMatrix);
   output_ = std::dynamic_pointer_cast<Matrix>(outputMatrix);
+  nnIndex_.reset();
   wordVectors_.reset();
   args_->dim = input_->size(1);
 
@@ -226,37 +276,65 @@ void FastText::signModel(std::ostream& out)
 
 void FastText::saveModel(const std::string& filename)
 {
-  std::ofstream ofs(filename, std::ofstream::binary);
-  if (!ofs.is_open()) {
-    throw std::invalid_argument(filename + " cannot be opened for saving!");
-  }
   if (!input_ || !output_) {
     throw std::runtime_error("Model never trained");
   }
+  // The model is written next to filename and renamed over it: filename may
+  // be the file this model is mapped from (see loadModel), which must not be
+  // truncated while in use.
+  const std::string tmpname = filename + ".tmp";
+  std::ofstream ofs(tmpname, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for saving!");
+  }
   signModel(ofs);
   args_->save(ofs);
   dict_->save(ofs);
 
-  ofs.write((char*)&(quant_), sizeof(bool));
+  uint8_t kind = matrixKind(*input_);
+  ofs.write((char*)&kind, sizeof(uint8_t));
   input_->save(ofs);
 
-  ofs.write((char*)&(args_->qout), sizeof(bool));
+  kind = matrixKind(*output_);
+  ofs.write((char*)&kind, sizeof(uint8_t));
   output_->save(ofs);
 
   ofs.close();
+  if (!ofs || !utils::replaceFile(tmpname, filename)) {
+    std::remove(tmpname.c_str());
+    throw std::invalid_argument(filename + " cannot be saved!");
+  }
 }
 
+// Models are loaded from a private, copy-on-write mapping of the file: the
+// matrices are used in place where their layout allows it, so startup does
+// not read them, and processes serving the same model share its pages.
+// Files that cannot be mapped, such as pipes, are read as a stream.
 void FastText::loadModel(const std::string& filename)
 {
-  std::ifstream ifs(filename, std::ifstream::binary);
-  if (!ifs.is_open()) {
-    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  std::shared_ptr<utils::MappedFile> mapping;
+  try {
+    mapping = std::make_shared<utils::MappedFile>(filename, true);
+  } catch (const std::invalid_argument&) {
+  }
+  if (!mapping || mapping->size() == 0) {
+    std::ifstream ifs(filename, std::ifstream::binary);
+    if (!ifs.is_open()) {
+      throw std::invalid_argument(filename + " cannot be opened for loading!");
+    }
+    if (!checkModel(ifs)) {
+      throw std::invalid_argument(filename + " has wrong file format!");
+    }
+    loadModel(ifs);
+    ifs.close();
+    return;
   }
-  if (!checkModel(ifs)) {
+  utils::MemoryBuffer buffer(mapping->data(), mapping->size());
+  std::istream in(&buffer);
+  if (!checkModel(in)) {
     throw std::invalid_argument(filename + " has wrong file format!");
   }
-  loadModel(ifs);
-  ifs.close();
+  loadModel(in, mapping);
 }
 
 std::vector<int64_t> FastText::getTargetCounts() const
@@ -276,10 +354,17 @@ void FastText::buildModel()
 }
 
 void FastText::loadModel(std::istream& in)
+{
+  loadModel(in, nullptr);
+}
+
+void FastText::loadModel(
+    std::istream& in,
+    std::shared_ptr<utils::MappedFile> mapping)
 {
   args_ = std::make_shared<Args>();
-  input_ = std::make_shared<DenseMatrix>();
-  output_ = std::make_shared<DenseMatrix>();
+  nnIndex_.reset();
+  wordVectors_.reset();
   args_->load(in);
   if (version == 11 && args_->model == model_name::sup) {
     // backward compatibility: old supervised models do not use char ngrams.
@@ -287,26 +372,23 @@ void FastText::loadModel(std::istream& in)
   }
   dict_ = std::make_shared<Dictionary>(args_, in);
 
-  bool quant_input;
-  in.read((char*)&quant_input, sizeof(bool));
-  if (quant_input) {
-    quant_ = true;
-    input_ = std::make_shared<QuantMatrix>();
-  }
-  input_->load(in);
+  uint8_t kind;
+  in.read((char*)&kind, sizeof(uint8_t));
+  quant_ = kind != DENSE_MATRIX;
+  input_ = newMatrix(kind, version);
+  input_->load(in, mapping);
 
-  if (!quant_input && dict_->isPruned()) {
+  if (!quant_ && dict_->isPruned()) {
     throw std::invalid_argument(
         "Invalid model file.\n"
         "Please download the updated model from www.fasttext.cc.\n"
         "See issue #332 on Github for more information.\n");
   }
 
-  in.read((char*)&args_->qout, sizeof(bool));
-  if (quant_ && args_->qout) {
-    output_ = std::make_shared<QuantMatrix>();
-  }
-  output_->load(in);
+  in.read((char*)&kind, sizeof(uint8_t));
+  args_->qout = kind != DENSE_MATRIX;
+  output_ = newMatrix(kind, version);
+  output_->load(in, mapping);
 
   buildModel();
 }
@@ -369,6 +451,9 @@ void FastText::quantize(const Args& qargs, const TrainCallback& callback)
   if (args_->model != model_name::sup) {
     throw std::invalid_argument("For now we only support quantization of supervised models");
   }
+  if (qargs.qbits != 4 && qargs.qbits != 8) {
+    throw std::invalid_argument("-qbits must be 4 or 8");
+  }
   args_->input = qargs.input;
   args_->qout = qargs.qout;
   args_->output = qargs.output;
@@ -403,12 +488,27 @@ void FastText::quantize(const Args& qargs, const TrainCallback& callback)
       startThreads(callback);
     }
   }
-  input_ = std::make_shared<QuantMatrix>(
-      std::move(*(input.get())), qargs.dsub, qargs.qnorm);
-
-  if (args_->qout) {
-    output_ = std::make_shared<QuantMatrix>(
-        std::move(*(output.get())), 2, qargs.qnorm);
+  if (qargs.qint8) {
+    input_ = std::make_shared<Int8Matrix>(*input);
+    if (args_->qout) {
+      output_ = std::make_shared<Int8Matrix>(*output);
+    }
+  } else {
+    input_ = std::make_shared<QuantMatrix>(
+        std::move(*(input.get())),
+        qargs.dsub,
+        qargs.qnorm,
+        qargs.thread,
+        qargs.qbits);
+
+    if (args_->qout) {
+      output_ = std::make_shared<QuantMatrix>(
+          std::move(*(output.get())),
+          2,
+          qargs.qnorm,
+          qargs.thread,
+          qargs.qbits);
+    }
   }
   quant_ = true;
   auto loss = createLoss(output_);
@@ -441,7 +541,7 @@ void FastText::cbow(Model::State& state, real lr, const std::vector<int32_t>& li
    {
       printf("cbow::>>");
       for (auto wid : line) {
-         const std::string& str = dict_->getWord(wid);
+         const WordView str = dict_->getWord(wid);
          printf(" %s", str.c_str());
       }
       printf("\n");
@@ -467,7 +567,7 @@ void FastText::cbow(Model::State& state, real lr, const std::vector<int32_t>& li
          {
             //printf("%s -> [%s]\n", dict_->getWord(line[w]).c_str(), dict_->getWord(line[wc]).c_str());
             
-            const std::vector<int32_t>& ngrams = dict_->getSubwords(line[wc]);
+            const Span<int32_t> ngrams = dict_->getSubwords(line[wc]);
 
             bow.insert(bow.end(), ngrams.cbegin(), ngrams.cend());
          }
@@ -490,28 +590,104 @@ void FastText::cbow(Model::State& state, real lr, const std::vector<int32_t>& li
    }
 }
 
+// cbow with the same windows, where the hidden vector of a window comes from
+// prefix sums of the input rows of the line, computed once, instead of the
+// sum of all its rows. The gradients of all positions are likewise summed
+// per word, through prefix sums of their differences, and added to the
+// input rows once at the end of the line. Positions thus see the input rows
+// as they were at the start of the line.
+void FastText::cbowWindowSum(
+    Model::State& state,
+    real lr,
+    const std::vector<int32_t>& line)
+{
+  lr = 0.05;
+  const int32_t n = line.size();
+  if (n < 2) {
+    return;
+  }
+  const int64_t dim = args_->dim;
+  // sums[w] is the sum of the rows of words 0 to w - 1, counts[w] their
+  // number, and diffs the differences of the gradient sums of the words
+  std::vector<real> sums((n + 1) * dim, 0.0);
+  std::vector<int64_t> counts(n + 1, 0);
+  std::vector<real> diffs((n + 1) * dim, 0.0);
+  Vector row(dim);
+  for (int32_t w = 0; w < n; w++) {
+    const Span<int32_t> ngrams = dict_->getSubwords(line[w]);
+    row.zero();
+    for (int32_t id : ngrams) {
+      row.addRow(*input_, id);
+    }
+    real* sum = sums.data() + (w + 1) * dim;
+    std::copy(sum - dim, sum, sum);
+    kernels::add(row.data(), sum, dim);
+    counts[w + 1] = counts[w] + ngrams.size();
+  }
+
+  std::uniform_int_distribution<> uniform(1, args_->ws);
+  Vector& hidden = state.hidden;
+  for (int32_t w = 0; w < n; w++) {
+    int32_t boundary = stopwords_ ? args_->ws : uniform(state.rng);
+    int32_t begin = std::max(w - boundary, 0);
+    int32_t end = std::min(w + boundary + 1, n);
+    int64_t count = counts[end] - counts[begin] - (counts[w + 1] - counts[w]);
+    if (count == 0) {
+      continue;
+    }
+    // rows of [begin, end) minus those of w
+    const real* s = sums.data();
+    std::copy(s + end * dim, s + (end + 1) * dim, hidden.data());
+    kernels::axpy(-1.0, s + begin * dim, hidden.data(), dim);
+    kernels::axpy(-1.0, s + (w + 1) * dim, hidden.data(), dim);
+    kernels::add(s + w * dim, hidden.data(), dim);
+    hidden.mul(1.0 / count);
+
+    model_->updateOutput(line, Span<int32_t>(&w, 1), lr, state);
+
+    real* d = diffs.data();
+    kernels::add(state.grad.data(), d + begin * dim, dim);
+    kernels::axpy(-1.0, state.grad.data(), d + end * dim, dim);
+    kernels::axpy(-1.0, state.grad.data(), d + w * dim, dim);
+    kernels::add(state.grad.data(), d + (w + 1) * dim, dim);
+  }
+
+  Vector& grad = state.grad;
+  grad.zero();
+  for (int32_t w = 0; w < n; w++) {
+    kernels::add(diffs.data() + w * dim, grad.data(), dim);
+    for (int32_t id : dict_->getSubwords(line[w])) {
+      input_->addVectorToRow(grad, id, 1.0);
+    }
+  }
+}
+
 void FastText::skipgram(
     Model::State& state,
     real lr,
     const std::vector<int32_t>& line)
 {
   std::uniform_int_distribution<> uniform(1, args_->ws);
+  std::vector<int32_t> contexts;
   for (int32_t w = 0; w < line.size(); w++)
   {
     int32_t boundary = uniform(state.rng);
-    const std::vector<int32_t>& ngrams = dict_->getSubwords(line[w]);
+    const Span<int32_t> ngrams = dict_->getSubwords(line[w]);
+    contexts.clear();
     for (int32_t c = -boundary; c <= boundary; c++)
     {
       if (c != 0 && w + c >= 0 && w + c < line.size())
       {
-        model_->update(ngrams, line, w + c, lr, state);
+        contexts.push_back(w + c);
       }
     }
+    // one hidden vector and one input update for all the context words
+    model_->update(ngrams, line, contexts, lr, state);
   }
 }
 
 std::tuple<int64_t, double, double>
-FastText::test(std::wistream& in, int32_t k, real threshold)
+FastText::test(std::istream& in, int32_t k, real threshold)
 {
   Meter meter(false);
   test(in, k, threshold, meter);
@@ -520,25 +696,33 @@ FastText::test(std::wistream& in, int32_t k, real threshold)
       meter.nexamples(), meter.precision(), meter.recall());
 }
 
-void FastText::test(std::wistream& in, int32_t k, real threshold, Meter& meter) const
+void FastText::test(std::istream& in, int32_t k, real threshold, Meter& meter) const
 {
-  std::vector<int32_t> line;
-  std::vector<int32_t> labels;
-  Predictions predictions;
-  Model::State state(args_->dim, dict_->nlabels(), 0);
+  std::vector<std::vector<int32_t>> lines(PREDICT_BATCH_SIZE);
+  std::vector<std::vector<int32_t>> labels(PREDICT_BATCH_SIZE);
+  std::vector<Predictions> predictions;
   in.clear();
   in.seekg(0, std::ios_base::beg);
 
-  while (in.peek() != EOF)
+  Tokenizer tokenizer(in);
+  while (!tokenizer.eof())
   {
-    line.clear();
-    labels.clear();
-    dict_->getLine(in, line, labels);
-
-    if (!labels.empty() && !line.empty()) {
-      predictions.clear();
-      predict(k, line, predictions, threshold);
-      meter.log(labels, predictions);
+    for (size_t i = 0; i < PREDICT_BATCH_SIZE; i++) {
+      lines[i].clear();
+      labels[i].clear();
+      if (!tokenizer.eof()) {
+        dict_->getLine(tokenizer, lines[i], labels[i]);
+      }
+      if (labels[i].empty()) {
+        // not evaluated: leave it out of the batch
+        lines[i].clear();
+      }
+    }
+    predict(k, lines, predictions, threshold);
+    for (size_t i = 0; i < PREDICT_BATCH_SIZE; i++) {
+      if (!lines[i].empty()) {
+        meter.log(labels[i], predictions[i]);
+      }
     }
   }
 }
@@ -552,15 +736,46 @@ void FastText::predict(
   if (words.empty()) {
     return;
   }
-  Model::State state(args_->dim, dict_->nlabels(), 0);
+  Model::State state = createState();
+  predict(k, words, predictions, threshold, state);
+}
+
+void FastText::predict(
+    int32_t k,
+    const std::vector<int32_t>& words,
+    Predictions& predictions,
+    real threshold,
+    Model::State& state) const
+{
   if (args_->model != model_name::sup) {
     throw std::invalid_argument("Model needs to be supervised for prediction!");
   }
+  if (words.empty()) {
+    return;
+  }
   model_->predict(words, k, threshold, predictions, state);
 }
 
+Model::State FastText::createState(int32_t seed) const
+{
+  return Model::State(args_->dim, output_->size(0), seed);
+}
+
+void FastText::predict(
+    int32_t k,
+    const std::vector<std::vector<int32_t>>& lines,
+    std::vector<Predictions>& predictions,
+    real threshold) const
+{
+  if (args_->model != model_name::sup) {
+    throw std::invalid_argument("Model needs to be supervised for prediction!");
+  }
+  Model::State state(args_->dim, dict_->nlabels(), 0);
+  model_->predict(lines, k, threshold, predictions, state);
+}
+
 bool FastText::predictNext(
-   std::wistream& in,
+   Tokenizer& tokenizer,
    std::vector<std::pair<real, std::string>>& predictions,
    int32_t k,
    real threshold) const
@@ -570,12 +785,12 @@ bool FastText::predictNext(
    }
 
    predictions.clear();
-   if (in.peek() == EOF) {
+   if (tokenizer.eof()) {
       return false;
    }
 
    std::vector<int32_t> words;
-   bool result = (dict_->getLine(in, words, stopwords_) > 0);
+   bool result = (dict_->getLine(tokenizer, words, stopwords_) > 0);
 
    std::set <int32_t> banSet;
    for (auto id : words) {
@@ -617,18 +832,18 @@ bool FastText::predictNext(
 }
 
 bool FastText::predictLine(
-    std::wistream& in,
+    Tokenizer& tokenizer,
     std::vector<std::pair<real, std::string>>& predictions,
     int32_t k,
     real threshold) const
 {
   predictions.clear();
-  if (in.peek() == EOF) {
+  if (tokenizer.eof()) {
     return false;
   }
 
   std::vector<int32_t> words, labels;
-  dict_->getLine(in, words, labels);
+  dict_->getLine(tokenizer, words, labels);
   Predictions linePredictions;
   predict(k, words, linePredictions, threshold);
   for (const auto& p : linePredictions)
@@ -640,6 +855,177 @@ bool FastText::predictLine(
   return true;
 }
 
+void FastText::predict(
+    std::istream& in,
+    std::ostream& out,
+    int32_t k,
+    real threshold,
+    bool printProb,
+    int32_t threads) const
+{
+  if (args_->model != model_name::sup) {
+    throw std::invalid_argument("Model needs to be supervised for prediction!");
+  }
+  if (k < 1) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  threads = std::max(threads, 1);
+  // this thread reads chunks of whole lines, the workers turn each chunk
+  // into its output text and the writer prints the texts in chunk order;
+  // the reader waits while too many chunks are not yet printed. The first
+  // exception of a worker or the writer stops them all, and is rethrown here.
+  const int64_t maxPending = 2 * threads + 2;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::pair<int64_t, std::string>> chunks;
+  std::map<int64_t, std::string> texts;
+  int64_t nread = 0;
+  int64_t nwritten = 0;
+  bool eof = false;
+  std::exception_ptr error;
+
+  auto fail = [&]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error) {
+      error = std::current_exception();
+    }
+    eof = true;
+    changed.notify_all();
+  };
+
+  auto worker = [&]() {
+    try {
+      Model::State state(args_->dim, dict_->nlabels(), 0);
+      std::vector<std::vector<int32_t>> lines;
+      std::vector<int32_t> labels;
+      std::vector<Predictions> predictions;
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true) {
+        changed.wait(lock, [&]() { return !chunks.empty() || eof; });
+        if (chunks.empty() || error) {
+          return;
+        }
+        std::pair<int64_t, std::string> chunk = std::move(chunks.front());
+        chunks.pop_front();
+        lock.unlock();
+
+        utils::MemoryBuffer buffer(chunk.second.data(), chunk.second.size());
+        std::istream input(&buffer);
+        Tokenizer tokenizer(input);
+        std::ostringstream text;
+        while (!tokenizer.eof()) {
+          lines.resize(PREDICT_BATCH_SIZE);
+          size_t n = 0;
+          while (n < lines.size() && !tokenizer.eof()) {
+            dict_->getLine(tokenizer, lines[n++], labels);
+          }
+          lines.resize(n);
+          model_->predict(lines, k, threshold, predictions, state);
+          for (const auto& linePredictions : predictions) {
+            bool first = true;
+            for (const auto& p : linePredictions) {
+              if (!first) {
+                text << " ";
+              }
+              first = false;
+              text << dict_->getLabel(p.second);
+              if (printProb) {
+                text << " " << std::exp(p.first);
+              }
+            }
+            text << "\n";
+          }
+        }
+
+        lock.lock();
+        texts[chunk.first] = text.str();
+        changed.notify_all();
+      }
+    } catch (...) {
+      fail();
+    }
+  };
+
+  auto writer = [&]() {
+    try {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true) {
+        changed.wait(lock, [&]() {
+          return texts.count(nwritten) > 0 || (eof && nwritten == nread) ||
+              error;
+        });
+        auto it = texts.find(nwritten);
+        if (it == texts.end() || error) {
+          return;
+        }
+        std::string text = std::move(it->second);
+        texts.erase(it);
+        lock.unlock();
+        out << text;
+        lock.lock();
+        nwritten++;
+        changed.notify_all();
+      }
+    } catch (...) {
+      fail();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (int32_t i = 0; i < threads; i++) {
+    pool.emplace_back(worker);
+  }
+  pool.emplace_back(writer);
+
+  try {
+    std::string chunk, rest;
+    bool last = false;
+    while (!last) {
+      chunk.swap(rest);
+      size_t size = chunk.size();
+      chunk.resize(size + PREDICT_CHUNK_SIZE);
+      in.read(&chunk[size], PREDICT_CHUNK_SIZE);
+      chunk.resize(size + in.gcount());
+      last = !in;
+      if (!last) {
+        // lines may not span chunks: keep the last partial line for the next
+        size_t end = chunk.rfind('\n');
+        if (end == std::string::npos) {
+          rest.swap(chunk);
+          continue;
+        }
+        rest.assign(chunk, end + 1, std::string::npos);
+        chunk.resize(end + 1);
+      }
+      if (!chunk.empty()) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(
+            lock, [&]() { return nread - nwritten < maxPending || error; });
+        if (error) {
+          break;
+        }
+        chunks.emplace_back(nread++, std::move(chunk));
+        changed.notify_all();
+      }
+      chunk.clear();
+    }
+  } catch (...) {
+    fail();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    eof = true;
+    changed.notify_all();
+  }
+  for (auto& thread : pool) {
+    thread.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  out.flush();
+}
+
 real FastText::getSimilarity(const std::string src1, const std::string src2)
 {
    lazyComputeWordVectors();   // calculate DenseMtrix
@@ -664,13 +1050,13 @@ real FastText::getSimilarity(const std::string src1, const std::string src2)
    return similarity;
 }
 
-void FastText::getSentenceVector(std::wistream& in, fasttext::Vector& svec)
+void FastText::getSentenceVector(Tokenizer& tokenizer, fasttext::Vector& svec)
 {
   svec.zero();
   if (args_->model == model_name::sup)
   {
     std::vector<int32_t> line, labels;
-    dict_->getLine(in, line, labels);
+    dict_->getLine(tokenizer, line, labels);
     for (int32_t i = 0; i < line.size(); i++)
     {
       addInputVector(svec, line[i]);
@@ -682,21 +1068,15 @@ void FastText::getSentenceVector(std::wistream& in, fasttext::Vector& svec)
   else
   {
     Vector vec(args_->dim);
-    std::wstring sentence;
-    std::getline(in, sentence);
-    std::wistringstream iss(sentence);
-    std::wstring wword;
+    std::string sentence;
+    tokenizer.readLine(sentence);
+    std::istringstream iss(sentence);
+    std::string word;
     int32_t count = 0;
-    while (iss >> wword)
+    while (iss >> word)
     {
-       if (args_->stopwords.empty())
-       {
-          getWordVector(vec, translate_wstr(wword));
-       }
-       else
-       {
-          getWordVector(vec, transform_wstr(wword));
-       }
+      getWordVector(
+          vec, Tokenizer::normalize(word, !args_->stopwords.empty()));
       real norm = vec.norm();
       if (norm > 0) {
         vec.mul(1.0 / norm);
@@ -744,6 +1124,18 @@ void FastText::precomputeWordVectors(DenseMatrix& wordVectors) const
   }
 }
 
+// The vectors themselves are not hashed: their norms are sums whose rounding
+// depends on the kernels picked for the CPU.
+uint64_t FastText::wordVectorsChecksum() const
+{
+  utils::HashBuffer hash;
+  std::ostream out(&hash);
+  args_->save(out);
+  dict_->save(out);
+  input_->save(out);
+  return hash.digest();
+}
+
 void FastText::lazyComputeWordVectors()
 {
   if (!wordVectors_) {
@@ -755,7 +1147,8 @@ void FastText::lazyComputeWordVectors()
 
 std::vector<std::pair<real, std::string>> FastText::getNN(
     const std::string& word,
-    int32_t k)
+    int32_t k,
+    int32_t ef)
 {
   lazyComputeWordVectors();   // calculate DenseMtrix
 
@@ -764,51 +1157,168 @@ std::vector<std::pair<real, std::string>> FastText::getNN(
 
   assert(wordVectors_);
 
-  return getNN(*wordVectors_, query, k, {word});
+  return getNN(*wordVectors_, query, k, {word}, ef);
 }
 
 std::vector<std::pair<real, std::string>> FastText::getNN(
     const DenseMatrix& wordVectors,
     const Vector& query,
     int32_t k,
-    const std::set<std::string>& banSet)
+    const std::set<std::string>& banSet,
+    int32_t ef)
 {
-  std::vector<std::pair<real, std::string>> heap;
+  if (k <= 0) {
+    return {};
+  }
+  // words are compared by id: only the results are turned into strings
+  std::vector<int32_t> banned;
+  for (const auto& word : banSet) {
+    int32_t id = dict_->getId(word);
+    if (id >= 0 && id < dict_->nwords()) {
+      banned.push_back(id);
+    }
+  }
 
   real queryNorm = query.norm();
   if (std::abs(queryNorm) < 1e-8) {
     queryNorm = 1;
   }
 
-  for (int32_t i = 0; i < dict_->nwords(); i++)
+  std::vector<std::pair<real, int32_t>> heap;
+  if (ef > 0 && nnIndex_)
   {
-    std::string word = dict_->getWord(i);
-    if (banSet.find(word) == banSet.end())
+    int32_t wanted = k + banned.size();
+    for (const auto& candidate :
+         nnIndex_->search(query, wanted, std::max(ef, wanted)))
+    {
+      if (heap.size() < k && !utils::contains(banned, candidate.second)) {
+        heap.push_back(candidate);
+      }
+    }
+  }
+  else
+  {
+    auto byScore = std::greater<std::pair<real, int32_t>>();
+    for (int32_t i = 0; i < dict_->nwords(); i++)
     {
       real dp = wordVectors.dotRow(query, i);
-      real similarity = dp / queryNorm;
-
-      if (heap.size() == k && similarity < heap.front().first) {
+      if (heap.size() == k && dp < heap.front().first) {
         continue;
       }
-      heap.push_back(std::make_pair(similarity, word));
-      std::push_heap(heap.begin(), heap.end(), comparePairs);
+      if (utils::contains(banned, i)) {
+        continue;
+      }
+      heap.push_back(std::make_pair(dp, i));
+      std::push_heap(heap.begin(), heap.end(), byScore);
       if (heap.size() > k) {
-        std::pop_heap(heap.begin(), heap.end(), comparePairs);
+        std::pop_heap(heap.begin(), heap.end(), byScore);
         heap.pop_back();
       }
     }
+    std::sort_heap(heap.begin(), heap.end(), byScore);
   }
-  std::sort_heap(heap.begin(), heap.end(), comparePairs);
 
-  return heap;
+  std::vector<std::pair<real, std::string>> result;
+  result.reserve(heap.size());
+  for (const auto& neighbor : heap) {
+    result.emplace_back(
+        neighbor.first / queryNorm, dict_->getWord(neighbor.second));
+  }
+  return result;
+}
+
+void FastText::getNN(
+    const std::vector<std::string>& words,
+    int32_t k,
+    std::vector<Predictions>& neighbors,
+    int32_t threads)
+{
+  lazyComputeWordVectors();
+  assert(wordVectors_);
+
+  const int64_t dim = args_->dim;
+  const int64_t nwords = dict_->nwords();
+  const int64_t nqueries = words.size();
+  DenseMatrix queries(nqueries, dim);
+  std::vector<real> norms(nqueries);
+  std::vector<int32_t> ids(nqueries);
+  Vector vec(dim);
+  queries.zero();
+  for (int64_t i = 0; i < nqueries; i++) {
+    getWordVector(vec, words[i]);
+    queries.addVectorToRow(vec, i, 1.0);
+    norms[i] = vec.norm();
+    if (std::abs(norms[i]) < 1e-8) {
+      norms[i] = 1;
+    }
+    ids[i] = dict_->getId(words[i]);
+  }
+
+  neighbors.assign(nqueries, Predictions());
+  if (k <= 0) {
+    return;
+  }
+  // each thread takes blocks of queries and streams all the word vectors
+  // through them, keeping one heap of word ids per query
+  std::atomic<int64_t> next(0);
+  auto worker = [&]() {
+    std::vector<real> scores(NN_QUERY_BLOCK * NN_WORD_BLOCK);
+    auto byScore = std::greater<std::pair<real, int32_t>>();
+    for (int64_t q0 = next.fetch_add(NN_QUERY_BLOCK); q0 < nqueries;
+         q0 = next.fetch_add(NN_QUERY_BLOCK)) {
+      const int64_t q1 = std::min(q0 + NN_QUERY_BLOCK, nqueries);
+      for (int64_t w0 = 0; w0 < nwords; w0 += NN_WORD_BLOCK) {
+        const int64_t w1 = std::min(w0 + NN_WORD_BLOCK, nwords);
+        kernels::gemm(
+            wordVectors_->data() + w0 * dim,
+            w1 - w0,
+            queries.data() + q0 * dim,
+            q1 - q0,
+            dim,
+            scores.data());
+        for (int64_t q = q0; q < q1; q++) {
+          Predictions& heap = neighbors[q];
+          const real* score = scores.data() + (q - q0) * (w1 - w0);
+          for (int32_t w = w0; w < w1; w++) {
+            real dp = score[w - w0];
+            if ((heap.size() == k && dp < heap.front().first) || w == ids[q]) {
+              continue;
+            }
+            heap.push_back(std::make_pair(dp, w));
+            std::push_heap(heap.begin(), heap.end(), byScore);
+            if (heap.size() > k) {
+              std::pop_heap(heap.begin(), heap.end(), byScore);
+              heap.pop_back();
+            }
+          }
+        }
+      }
+      for (int64_t q = q0; q < q1; q++) {
+        std::sort_heap(neighbors[q].begin(), neighbors[q].end(), byScore);
+        for (auto& neighbor : neighbors[q]) {
+          neighbor.first /= norms[q];
+        }
+      }
+    }
+  };
+
+  const int64_t blocks = (nqueries + NN_QUERY_BLOCK - 1) / NN_QUERY_BLOCK;
+  std::vector<std::thread> pool;
+  for (int64_t t = 1; t < std::min<int64_t>(threads, blocks); t++) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : pool) {
+    thread.join();
+  }
 }
 
 std::vector<std::pair<real, std::string>> FastText::getAnalogies(
     int32_t k,
     const std::string& wordA,
     const std::string& wordB,
-    const std::string& wordC)
+    const std::string& wordC,
+    int32_t ef)
 {
   Vector query = Vector(args_->dim);
   query.zero();
@@ -823,7 +1333,48 @@ std::vector<std::pair<real, std::string>> FastText::getAnalogies(
 
   lazyComputeWordVectors();
   assert(wordVectors_);
-  return getNN(*wordVectors_, query, k, {wordA, wordB, wordC});
+  return getNN(*wordVectors_, query, k, {wordA, wordB, wordC}, ef);
+}
+
+void FastText::buildNNIndex(int32_t M, int32_t efConstruction)
+{
+  lazyComputeWordVectors();
+  nnIndex_.reset(new HnswIndex(*wordVectors_, wordVectorsChecksum()));
+  nnIndex_->build(M, efConstruction, args_->thread, args_->seed);
+}
+
+void FastText::saveNNIndex(const std::string& filename) const
+{
+  if (!nnIndex_) {
+    throw std::runtime_error("No nearest neighbour index to save");
+  }
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for saving!");
+  }
+  nnIndex_->save(ofs);
+  ofs.close();
+  if (!ofs) {
+    throw std::invalid_argument(filename + " cannot be saved!");
+  }
+}
+
+void FastText::loadNNIndex(const std::string& filename)
+{
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  }
+  lazyComputeWordVectors();
+  std::unique_ptr<HnswIndex> index(
+      new HnswIndex(*wordVectors_, wordVectorsChecksum()));
+  index->load(ifs);
+  nnIndex_ = std::move(index);
+}
+
+bool FastText::hasNNIndex() const
+{
+  return bool(nnIndex_);
 }
 
 bool FastText::keepTraining(const int64_t ntokens) const
@@ -833,11 +1384,31 @@ bool FastText::keepTraining(const int64_t ntokens) const
 
 void FastText::trainThread(int32_t threadId, const TrainCallback& callback)
 {
-   if (threadId != 0) return;
-
-   std::wifstream wifs(cstr_to_wstr(args_->input));
-   wifs.imbue(std::locale(std::locale::empty(), new std::codecvt_utf8<wchar_t>));
-   //utils::seek(ifs, threadId * utils::size(ifs) / args_->thread);
+   std::ifstream ifs;
+   TokenCursor cursor = {nullptr, 0, 0};
+   if (tokenCache_)
+   {
+      cursor.ids = (const int32_t*)tokenCache_->data();
+      cursor.size = tokenCache_->size() / sizeof(int32_t);
+      cursor.pos = threadId * cursor.size / args_->thread;
+      while (cursor.pos > 0 && cursor.pos < cursor.size &&
+             cursor.ids[cursor.pos - 1] != Dictionary::CACHE_EOS)
+      {
+         cursor.pos++;
+      }
+   }
+   else
+   {
+      int64_t offset = 0;
+      if (threadId > 0)
+      {
+         std::ifstream bin(cstr_to_wstr(args_->input), std::ifstream::binary);
+         offset = utils::nextLine(bin, threadId * utils::size(bin) / args_->thread);
+      }
+      ifs.open(cstr_to_wstr(args_->input));
+      utils::seek(ifs, offset);
+   }
+   Tokenizer tokenizer(ifs);
 
    Model::State state(args_->dim, output_->size(0), threadId + args_->seed);
    real progress = 0;
@@ -851,7 +1422,7 @@ void FastText::trainThread(int32_t threadId, const TrainCallback& callback)
       while (keepTraining(ntokens))
       {
          real t_progress = real(tokenCount_) / (args_->epoch * ntokens);
-         if (int32_t(100.f * progress) != int32_t(100.f * t_progress))
+         if (threadId == 0 && int32_t(100.f * progress) != int32_t(100.f * t_progress))
          {
             printf("...progress=%d\n", int32_t(100.f * t_progress));
          }
@@ -869,24 +1440,37 @@ void FastText::trainThread(int32_t threadId, const TrainCallback& callback)
          real lr = args_->lr * (1.0 - progress);
          if (args_->model == model_name::sup)
          {
-            localTokenCount += dict_->getLine(wifs, line, labels);
+            localTokenCount += dict_->getLine(tokenizer, line, labels);
             supervised(state, lr, line, labels);
          }
          else if (args_->model == model_name::cbow)
          {
             if (stopwords_)
             {
-               localTokenCount += dict_->getLine(wifs, line, stopwords_);
+               localTokenCount += tokenCache_
+                  ? dict_->getLine(cursor, line)
+                  : dict_->getLine(tokenizer, line, stopwords_);
             }
             else
             {
-               localTokenCount += dict_->getLine(wifs, line, state.rng);
+               localTokenCount += tokenCache_
+                  ? dict_->getLine(cursor, line, state.rng)
+                  : dict_->getLine(tokenizer, line, state.rng);
+            }
+            if (args_->cbowWindowSum)
+            {
+               cbowWindowSum(state, lr, line);
+            }
+            else
+            {
+               cbow(state, lr, line);
             }
-            cbow(state, lr, line);
          }
          else if (args_->model == model_name::sg)
          {
-            localTokenCount += dict_->getLine(wifs, line, state.rng);
+            localTokenCount += tokenCache_
+               ? dict_->getLine(cursor, line, state.rng)
+               : dict_->getLine(tokenizer, line, state.rng);
             skipgram(state, lr, line);
          }
          if (localTokenCount > args_->lrUpdateRate)
@@ -906,7 +1490,7 @@ void FastText::trainThread(int32_t threadId, const TrainCallback& callback)
   }
   if (threadId == 0)
     loss_ = state.getLoss();
-  wifs.close();
+  ifs.close();
 }
 
 std::shared_ptr<Matrix> FastText::getInputMatrixFromFile(
@@ -986,12 +1570,11 @@ void FastText::readStopwords(const Args& args)
       s_arg->minCount = 1;
       stopwords_ = std::make_shared<Dictionary>(s_arg);
 
-      std::wifstream wsw(cstr_to_wstr(args_->stopwords));
+      std::ifstream wsw(cstr_to_wstr(args_->stopwords));
       if (!wsw.is_open()) {
          throw std::invalid_argument(
             args_->stopwords + " cannot be opened for reading!");
       }
-      wsw.imbue(std::locale(std::locale::empty(), new std::codecvt_utf8<wchar_t>));
       stopwords_->readFromFile(wsw, nullptr);
       wsw.close();
    }
@@ -1007,14 +1590,18 @@ void FastText::train(const Args& args, const TrainCallback& callback)
   }
   readStopwords(args);
 
-  std::wifstream wis(cstr_to_wstr(args_->input));
-  if (!wis.is_open()) {
+  std::ifstream ifs(cstr_to_wstr(args_->input));
+  if (!ifs.is_open()) {
     throw std::invalid_argument(
         args_->input + " cannot be opened for training!");
   }
-  wis.imbue(std::locale(std::locale::empty(), new std::codecvt_utf8<wchar_t>));
-  dict_->readFromFile(wis, stopwords_);
-  wis.close();
+  ifs.close();
+  std::string cacheFile;
+  if (args_->cacheTokens && args_->model != model_name::sup) {
+    // supervised lines also need the text of out-of-vocabulary tokens
+    cacheFile = args_->output + ".ids";
+  }
+  dict_->readFromFile(args_->input, stopwords_, cacheFile);
 
   if (!args_->pretrainedVectors.empty()) {
     input_ = getInputMatrixFromFile(args_->pretrainedVectors);
@@ -1027,7 +1614,21 @@ void FastText::train(const Args& args, const TrainCallback& callback)
   auto loss = createLoss(output_);
   bool normalizeGradient = (args_->model == model_name::sup);
   model_ = std::make_shared<Model>(input_, output_, loss, normalizeGradient);
-  startThreads(callback);
+  if (cacheFile.empty()) {
+    startThreads(callback);
+    return;
+  }
+  tokenCache_.reset(new utils::MappedFile(cacheFile));
+  try {
+    startThreads(callback);
+  }
+  catch (...) {
+    tokenCache_.reset();
+    std::remove(cacheFile.c_str());
+    throw;
+  }
+  tokenCache_.reset();
+  std::remove(cacheFile.c_str());
 }
 
 void FastText::abort()
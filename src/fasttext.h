@@ -22,10 +22,12 @@
 #include "args.h"
 #include "densematrix.h"
 #include "dictionary.h"
+#include "hnsw.h"
 #include "matrix.h"
 #include "meter.h"
 #include "model.h"
 #include "real.h"
+#include "tokenizer.h"
 #include "utils.h"
 #include "vector.h"
 
@@ -50,10 +52,13 @@ class FastText
   bool quant_;
   int32_t version;
   std::unique_ptr<DenseMatrix> wordVectors_;
+  std::unique_ptr<HnswIndex> nnIndex_;
+  std::unique_ptr<utils::MappedFile> tokenCache_;
   std::exception_ptr trainException_;
 
   void signModel(std::ostream&);
   bool checkModel(std::istream&);
+  void loadModel(std::istream&, std::shared_ptr<utils::MappedFile>);
   void startThreads(const TrainCallback& callback = {});
   void addInputVector(Vector&, int32_t) const;
   void trainThread(int32_t, const TrainCallback& callback);
@@ -61,8 +66,8 @@ class FastText
       const DenseMatrix& wordVectors,
       const Vector& queryVec,
       int32_t k,
-      const std::set<std::string>& banSet);
-  void lazyComputeWordVectors();
+      const std::set<std::string>& banSet,
+      int32_t ef);
   void printInfo(real, real, std::ostream&);
   std::shared_ptr<Matrix> getInputMatrixFromFile(const std::string&) const;
   std::shared_ptr<Matrix> createRandomMatrix() const;
@@ -75,6 +80,10 @@ class FastText
       const std::vector<int32_t>& line,
       const std::vector<int32_t>& labels);
   void cbow(Model::State& state, real lr, const std::vector<int32_t>& line);
+  void cbowWindowSum(
+      Model::State& state,
+      real lr,
+      const std::vector<int32_t>& line);
   void skipgram(Model::State& state, real lr, const std::vector<int32_t>& line);
   std::vector<int32_t> selectEmbeddings(int32_t cutoff) const;
 
@@ -87,6 +96,14 @@ class FastText
 
   void precomputeWordVectors(DenseMatrix& wordVectors) const;
 
+  // Hash of what the word vectors are computed from, which tells whether a
+  // saved nearest neighbour index is still valid for this model.
+  uint64_t wordVectorsChecksum() const;
+
+  // Computes the word vectors of getNN and getAnalogies if needed. These
+  // are then safe to call from several threads.
+  void lazyComputeWordVectors();
+
   int32_t getWordsAmount() const;
 
   int32_t getWordId(const std::string& word) const;
@@ -126,16 +143,16 @@ class FastText
 
   void loadModel(const std::string& filename);
 
-  void getSentenceVector(std::wistream& in, Vector& vec);
+  void getSentenceVector(Tokenizer& tokenizer, Vector& vec);
 
   real getSimilarity(const std::string src1, const std::string src2);
 
   void quantize(const Args& qargs, const TrainCallback& callback = {});
 
   std::tuple<int64_t, double, double>
-  test(std::wistream& in, int32_t k, real threshold = 0.0);
+  test(std::istream& in, int32_t k, real threshold = 0.0);
 
-  void test(std::wistream& in, int32_t k, real threshold, Meter& meter) const;
+  void test(std::istream& in, int32_t k, real threshold, Meter& meter) const;
 
   void predict(
       int32_t k,
@@ -143,14 +160,44 @@ class FastText
       Predictions& predictions,
       real threshold = 0.0) const;
 
+  // Same, with the caller's scratch state, which a thread can reuse across
+  // calls; see createState.
+  void predict(
+      int32_t k,
+      const std::vector<int32_t>& words,
+      Predictions& predictions,
+      real threshold,
+      Model::State& state) const;
+
+  Model::State createState(int32_t seed = 0) const;
+
+  // predictions[i] gets the predictions for lines[i]; empty lines get none.
+  void predict(
+      int32_t k,
+      const std::vector<std::vector<int32_t>>& lines,
+      std::vector<Predictions>& predictions,
+      real threshold = 0.0) const;
+
+  // Writes the predictions of every line of in to out, one line each: the
+  // labels, each followed by its probability if printProb. Chunks of lines
+  // are predicted in parallel by `threads` workers and written in input
+  // order.
+  void predict(
+      std::istream& in,
+      std::ostream& out,
+      int32_t k,
+      real threshold,
+      bool printProb,
+      int32_t threads) const;
+
   bool predictLine(
-      std::wistream& in,
+      Tokenizer& tokenizer,
       std::vector<std::pair<real, std::string>>& predictions,
       int32_t k,
       real threshold) const;
 
   bool predictNext(
-     std::wistream& in,
+     Tokenizer& tokenizer,
      std::vector<std::pair<real, std::string>>& predictions,
      int32_t k,
      real threshold) const;
@@ -158,15 +205,39 @@ class FastText
   std::vector<std::pair<std::string, Vector>> getNgramVectors(
       const std::string& word) const;
 
+  // With ef > 0 and an index built or loaded, the neighbours are searched
+  // in the index, with ef candidates (see HnswIndex::search); otherwise all
+  // the words are scanned.
   std::vector<std::pair<real, std::string>> getNN(
       const std::string& word,
-      int32_t k);
+      int32_t k,
+      int32_t ef = 0);
+
+  // Exact neighbours of many words: neighbors[i] gets the k words nearest
+  // to words[i] as in getNN, as (similarity, word id) pairs, best first.
+  // The queries are split between threads.
+  void getNN(
+      const std::vector<std::string>& words,
+      int32_t k,
+      std::vector<Predictions>& neighbors,
+      int32_t threads);
 
   std::vector<std::pair<real, std::string>> getAnalogies(
       int32_t k,
       const std::string& wordA,
       const std::string& wordB,
-      const std::string& wordC);
+      const std::string& wordC,
+      int32_t ef = 0);
+
+  void buildNNIndex(
+      int32_t M = HnswIndex::DEFAULT_M,
+      int32_t efConstruction = HnswIndex::DEFAULT_EF_CONSTRUCTION);
+
+  void saveNNIndex(const std::string& filename) const;
+
+  void loadNNIndex(const std::string& filename);
+
+  bool hasNNIndex() const;
 
   void readStopwords(const Args& args);
 
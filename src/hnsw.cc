@@ -0,0 +1,431 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "hnsw.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+#include "densematrix.h"
+#include "kernels.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace fasttext {
+
+constexpr int32_t HNSW_MAGIC_INT32 = 0x77736e68;
+constexpr int32_t HNSW_VERSION = 2;
+constexpr int32_t HNSW_MAX_LEVEL = 16;
+constexpr int32_t HNSW_MAX_M = 1 << 16;
+constexpr int32_t HNSW_LOCK_COUNT = 4096;
+
+namespace {
+
+// Visited rows of one insertion: a row is visited when its mark equals the
+// current tag, so the marks are cleared by moving to the next tag.
+struct MarkSet {
+  std::vector<uint32_t>& marks;
+  uint32_t tag;
+
+  bool insert(int32_t i) {
+    if (marks[i] == tag) {
+      return false;
+    }
+    marks[i] = tag;
+    return true;
+  }
+};
+
+// Visited rows of one query, which touches a few thousand of them at most.
+struct HashSet {
+  std::unordered_set<int32_t> set;
+
+  bool insert(int32_t i) {
+    return set.insert(i).second;
+  }
+};
+
+} // namespace
+
+HnswIndex::HnswIndex(const DenseMatrix& vectors, uint64_t checksum)
+    : data_(vectors.data()),
+      n_(vectors.rows()),
+      dim_(vectors.cols()),
+      checksum_(checksum),
+      M_(0),
+      efConstruction_(0),
+      entry_(-1),
+      maxLevel_(-1) {}
+
+void HnswIndex::allocateLinks() {
+  links0_.assign(n_ * (2 * M_ + 1), 0);
+  upperStart_.resize(n_);
+  int64_t size = 0;
+  for (int64_t i = 0; i < n_; i++) {
+    upperStart_[i] = size;
+    size += int64_t(levels_[i]) * (M_ + 1);
+  }
+  upperLinks_.assign(size, 0);
+}
+
+void HnswIndex::build(
+    int32_t M,
+    int32_t efConstruction,
+    int32_t threads,
+    int32_t seed) {
+  if (M < 2 || M > HNSW_MAX_M || efConstruction < 1) {
+    throw std::invalid_argument(
+        "HNSW needs 2 <= M <= " + std::to_string(HNSW_MAX_M) +
+        " and efConstruction >= 1");
+  }
+  M_ = M;
+  efConstruction_ = efConstruction;
+  entry_ = -1;
+  maxLevel_ = -1;
+  if (n_ == 0) {
+    levels_.clear();
+    allocateLinks();
+    return;
+  }
+
+  // levels follow an exponential distribution with mean 1 / ln(M), so that
+  // each layer holds about 1/M of the rows of the layer below
+  const double levelMult = 1.0 / std::log(double(M_));
+  utils::FastRandom rng(seed);
+  levels_.resize(n_);
+  for (int64_t i = 0; i < n_; i++) {
+    double u = ((rng() >> 11) + 1) * (1.0 / 9007199254740992.0);
+    int32_t level = int32_t(-std::log(u) * levelMult);
+    levels_[i] = int8_t(std::min(level, HNSW_MAX_LEVEL));
+  }
+  allocateLinks();
+
+  entry_ = 0;
+  maxLevel_ = levels_[0];
+  locks_.reset(new std::mutex[HNSW_LOCK_COUNT]);
+  std::atomic<int64_t> next(1);
+  auto worker = [this, &next]() {
+    std::vector<uint32_t> marks(n_, 0);
+    uint32_t tag = 0;
+    for (int64_t i = next++; i < n_; i = next++) {
+      insert(int32_t(i), marks, tag);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (int32_t t = 1; t < threads; t++) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : pool) {
+    thread.join();
+  }
+  locks_.reset();
+}
+
+void HnswIndex::readLinks(
+    int32_t node,
+    int32_t layer,
+    std::vector<int32_t>& out) const {
+  std::unique_lock<std::mutex> lock;
+  if (locks_) {
+    lock = std::unique_lock<std::mutex>(locks_[node % HNSW_LOCK_COUNT]);
+  }
+  const int32_t* l = links(node, layer);
+  out.assign(l + 1, l + 1 + l[0]);
+}
+
+int32_t HnswIndex::greedyClosest(
+    const real* query,
+    int32_t entry,
+    int32_t fromLayer,
+    int32_t toLayer) const {
+  int32_t best = entry;
+  real bestSimilarity = kernels::dot(query, row(best), dim_);
+  std::vector<int32_t> neighbors;
+  for (int32_t layer = fromLayer; layer > toLayer; layer--) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      readLinks(best, layer, neighbors);
+      for (int32_t e : neighbors) {
+        real similarity = kernels::dot(query, row(e), dim_);
+        if (similarity > bestSimilarity) {
+          bestSimilarity = similarity;
+          best = e;
+          changed = true;
+        }
+      }
+    }
+  }
+  return best;
+}
+
+template <typename Visited>
+std::vector<std::pair<real, int32_t>> HnswIndex::searchLayer(
+    const real* query,
+    int32_t entry,
+    int32_t ef,
+    int32_t layer,
+    Visited& visited) const {
+  typedef std::pair<real, int32_t> Item;
+  // candidates to expand, best on top, and the ef best rows found so far,
+  // worst on top
+  std::priority_queue<Item> candidates;
+  std::priority_queue<Item, std::vector<Item>, std::greater<Item>> nearest;
+
+  visited.insert(entry);
+  real similarity = kernels::dot(query, row(entry), dim_);
+  candidates.emplace(similarity, entry);
+  nearest.emplace(similarity, entry);
+
+  std::vector<int32_t> neighbors;
+  while (!candidates.empty()) {
+    Item c = candidates.top();
+    if (c.first < nearest.top().first && nearest.size() >= size_t(ef)) {
+      break;
+    }
+    candidates.pop();
+    readLinks(c.second, layer, neighbors);
+    for (int32_t e : neighbors) {
+      if (!visited.insert(e)) {
+        continue;
+      }
+      similarity = kernels::dot(query, row(e), dim_);
+      if (nearest.size() < size_t(ef) || similarity > nearest.top().first) {
+        candidates.emplace(similarity, e);
+        nearest.emplace(similarity, e);
+        if (nearest.size() > size_t(ef)) {
+          nearest.pop();
+        }
+      }
+    }
+  }
+
+  std::vector<Item> result(nearest.size());
+  for (size_t i = result.size(); i > 0; i--) {
+    result[i - 1] = nearest.top();
+    nearest.pop();
+  }
+  return result;
+}
+
+void HnswIndex::selectNeighbors(
+    std::vector<std::pair<real, int32_t>>& candidates,
+    int32_t m) const {
+  if (candidates.size() <= size_t(m)) {
+    return;
+  }
+  // keep a candidate only if it is closer to the base row than to every
+  // neighbour kept before it, which spreads the links over directions
+  std::vector<std::pair<real, int32_t>> selected;
+  for (const auto& c : candidates) {
+    if (selected.size() == size_t(m)) {
+      break;
+    }
+    bool keep = true;
+    for (const auto& s : selected) {
+      if (kernels::dot(row(c.second), row(s.second), dim_) > c.first) {
+        keep = false;
+        break;
+      }
+    }
+    if (keep) {
+      selected.push_back(c);
+    }
+  }
+  candidates.swap(selected);
+}
+
+void HnswIndex::connect(
+    int32_t node,
+    int32_t neighbor,
+    real similarity,
+    int32_t layer) {
+  std::lock_guard<std::mutex> lock(locks_[node % HNSW_LOCK_COUNT]);
+  int32_t* l = links(node, layer);
+  if (l[0] < maxLinks(layer)) {
+    l[1 + l[0]++] = neighbor;
+    return;
+  }
+  std::vector<std::pair<real, int32_t>> candidates;
+  candidates.reserve(l[0] + 1);
+  candidates.emplace_back(similarity, neighbor);
+  for (int32_t i = 1; i <= l[0]; i++) {
+    candidates.emplace_back(kernels::dot(row(node), row(l[i]), dim_), l[i]);
+  }
+  std::sort(
+      candidates.begin(),
+      candidates.end(),
+      std::greater<std::pair<real, int32_t>>());
+  selectNeighbors(candidates, maxLinks(layer));
+  l[0] = candidates.size();
+  for (size_t i = 0; i < candidates.size(); i++) {
+    l[1 + i] = candidates[i].second;
+  }
+}
+
+void HnswIndex::insert(
+    int32_t node,
+    std::vector<uint32_t>& marks,
+    uint32_t& tag) {
+  // a row that tops the graph holds the entry lock until it is linked, so
+  // that nobody enters the graph through it before then
+  std::unique_lock<std::mutex> top(entryLock_);
+  const int32_t level = levels_[node];
+  const int32_t maxLevel = maxLevel_;
+  int32_t entry = entry_;
+  if (level <= maxLevel) {
+    top.unlock();
+  }
+
+  const real* x = row(node);
+  entry = greedyClosest(x, entry, maxLevel, level);
+  for (int32_t layer = std::min(level, maxLevel); layer >= 0; layer--) {
+    if (++tag == 0) {
+      std::fill(marks.begin(), marks.end(), 0);
+      tag = 1;
+    }
+    MarkSet visited{marks, tag};
+    visited.insert(node);
+    std::vector<std::pair<real, int32_t>> candidates =
+        searchLayer(x, entry, efConstruction_, layer, visited);
+    entry = candidates[0].second;
+    selectNeighbors(candidates, M_);
+    {
+      std::lock_guard<std::mutex> lock(locks_[node % HNSW_LOCK_COUNT]);
+      int32_t* l = links(node, layer);
+      l[0] = candidates.size();
+      for (size_t i = 0; i < candidates.size(); i++) {
+        l[1 + i] = candidates[i].second;
+      }
+    }
+    for (const auto& c : candidates) {
+      connect(c.second, node, c.first, layer);
+    }
+  }
+
+  if (level > maxLevel) {
+    entry_ = node;
+    maxLevel_ = level;
+  }
+}
+
+std::vector<std::pair<real, int32_t>>
+HnswIndex::search(const Vector& query, int32_t k, int32_t ef) const {
+  if (entry_ < 0 || k <= 0) {
+    return {};
+  }
+  const real* q = query.data();
+  int32_t entry = greedyClosest(q, entry_, maxLevel_, 0);
+  HashSet visited;
+  std::vector<std::pair<real, int32_t>> result =
+      searchLayer(q, entry, std::max(ef, k), 0, visited);
+  if (result.size() > size_t(k)) {
+    result.resize(k);
+  }
+  return result;
+}
+
+void HnswIndex::save(std::ostream& out) const {
+  out.write((char*)&HNSW_MAGIC_INT32, sizeof(int32_t));
+  out.write((char*)&HNSW_VERSION, sizeof(int32_t));
+  out.write((char*)&n_, sizeof(int64_t));
+  out.write((char*)&dim_, sizeof(int64_t));
+  out.write((char*)&checksum_, sizeof(uint64_t));
+  out.write((char*)&M_, sizeof(int32_t));
+  out.write((char*)&efConstruction_, sizeof(int32_t));
+  out.write((char*)&entry_, sizeof(int32_t));
+  out.write((char*)&maxLevel_, sizeof(int32_t));
+  out.write((char*)levels_.data(), levels_.size() * sizeof(int8_t));
+  out.write((char*)links0_.data(), links0_.size() * sizeof(int32_t));
+  out.write((char*)upperLinks_.data(), upperLinks_.size() * sizeof(int32_t));
+}
+
+// Every link is followed without checks while searching, so a corrupted
+// file must not get past load.
+bool HnswIndex::validLinks() const {
+  for (int64_t node = 0; node < n_; node++) {
+    for (int32_t layer = 0; layer <= levels_[node]; layer++) {
+      const int32_t* l = links(node, layer);
+      if (l[0] < 0 || l[0] > maxLinks(layer)) {
+        return false;
+      }
+      for (int32_t i = 1; i <= l[0]; i++) {
+        if (l[i] < 0 || l[i] >= n_ || levels_[l[i]] < layer) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+void HnswIndex::load(std::istream& in) {
+  int32_t magic, version;
+  int64_t n, dim;
+  uint64_t checksum;
+  in.read((char*)&magic, sizeof(int32_t));
+  in.read((char*)&version, sizeof(int32_t));
+  if (!in || magic != HNSW_MAGIC_INT32 || version != HNSW_VERSION) {
+    throw std::invalid_argument("Not an HNSW index or unsupported version");
+  }
+  in.read((char*)&n, sizeof(int64_t));
+  in.read((char*)&dim, sizeof(int64_t));
+  in.read((char*)&checksum, sizeof(uint64_t));
+  if (n != n_ || dim != dim_) {
+    throw std::invalid_argument(
+        "HNSW index was built for other word vectors (" + std::to_string(n) +
+        " x " + std::to_string(dim) + ")");
+  }
+  if (checksum != checksum_) {
+    throw std::invalid_argument(
+        "HNSW index was built for another model, or before it changed");
+  }
+  in.read((char*)&M_, sizeof(int32_t));
+  in.read((char*)&efConstruction_, sizeof(int32_t));
+  in.read((char*)&entry_, sizeof(int32_t));
+  in.read((char*)&maxLevel_, sizeof(int32_t));
+  const bool empty = n_ == 0;
+  if (!in || M_ < 2 || M_ > HNSW_MAX_M ||
+      (empty ? entry_ != -1 || maxLevel_ != -1
+             : entry_ < 0 || entry_ >= n_ || maxLevel_ < 0 ||
+               maxLevel_ > HNSW_MAX_LEVEL)) {
+    throw std::invalid_argument("Corrupted HNSW index");
+  }
+  levels_.resize(n_);
+  in.read((char*)levels_.data(), levels_.size() * sizeof(int8_t));
+  if (!in) {
+    throw std::invalid_argument("Truncated HNSW index");
+  }
+  for (int64_t i = 0; i < n_; i++) {
+    if (levels_[i] < 0 || levels_[i] > maxLevel_) {
+      throw std::invalid_argument("Corrupted HNSW index");
+    }
+  }
+  if (!empty && levels_[entry_] != maxLevel_) {
+    throw std::invalid_argument("Corrupted HNSW index");
+  }
+  allocateLinks();
+  in.read((char*)links0_.data(), links0_.size() * sizeof(int32_t));
+  in.read((char*)upperLinks_.data(), upperLinks_.size() * sizeof(int32_t));
+  if (!in) {
+    throw std::invalid_argument("Truncated HNSW index");
+  }
+  if (!validLinks()) {
+    throw std::invalid_argument("Corrupted HNSW index");
+  }
+}
+
+} // namespace fasttext
@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "real.h"
+
+namespace fasttext {
+
+class DenseMatrix;
+class Vector;
+
+// Hierarchical navigable small world graph over the rows of a matrix, for
+// approximate maximum inner product search (Malkov & Yashunin, 2016). The
+// index keeps a reference to the matrix, which must outlive it and stay
+// unchanged; it stores only the graph.
+class HnswIndex {
+ public:
+  static constexpr int32_t DEFAULT_M = 16;
+  static constexpr int32_t DEFAULT_EF_CONSTRUCTION = 200;
+
+  // checksum identifies what the vectors were computed from. It is saved
+  // with the index, and load rejects an index saved with another one.
+  explicit HnswIndex(const DenseMatrix& vectors, uint64_t checksum = 0);
+
+  // Links every row to up to M neighbours per layer (2M on the bottom
+  // layer), found with candidate lists of efConstruction rows. Rows are
+  // inserted by `threads` threads.
+  void build(int32_t M, int32_t efConstruction, int32_t threads, int32_t seed);
+
+  // Returns up to k (dot product, row) pairs, best first. ef is the length
+  // of the candidate list kept while searching the bottom layer: a larger ef
+  // is slower and misses fewer of the true k nearest rows.
+  std::vector<std::pair<real, int32_t>>
+  search(const Vector& query, int32_t k, int32_t ef) const;
+
+  void save(std::ostream& out) const;
+  // Throws std::invalid_argument when the stream does not hold a valid index
+  // over a matrix of the same shape and checksum.
+  void load(std::istream& in);
+
+ private:
+  template <typename Visited>
+  std::vector<std::pair<real, int32_t>> searchLayer(
+      const real* query,
+      int32_t entry,
+      int32_t ef,
+      int32_t layer,
+      Visited& visited) const;
+  int32_t greedyClosest(
+      const real* query,
+      int32_t entry,
+      int32_t fromLayer,
+      int32_t toLayer) const;
+  void readLinks(int32_t node, int32_t layer, std::vector<int32_t>& out)
+      const;
+  void selectNeighbors(
+      std::vector<std::pair<real, int32_t>>& candidates,
+      int32_t m) const;
+  void insert(int32_t node, std::vector<uint32_t>& marks, uint32_t& tag);
+  void connect(int32_t node, int32_t neighbor, real similarity, int32_t layer);
+  void allocateLinks();
+  bool validLinks() const;
+
+  inline const real* row(int32_t i) const {
+    return data_ + int64_t(i) * dim_;
+  }
+  inline int32_t maxLinks(int32_t layer) const {
+    return layer == 0 ? 2 * M_ : M_;
+  }
+  // Links of a node on a layer: the count followed by maxLinks(layer) slots.
+  inline int32_t* links(int32_t node, int32_t layer) {
+    return layer == 0
+        ? &links0_[int64_t(node) * (2 * M_ + 1)]
+        : &upperLinks_[upperStart_[node] + int64_t(layer - 1) * (M_ + 1)];
+  }
+  inline const int32_t* links(int32_t node, int32_t layer) const {
+    return const_cast<HnswIndex*>(this)->links(node, layer);
+  }
+
+  const real* data_;
+  int64_t n_;
+  int64_t dim_;
+  uint64_t checksum_;
+  int32_t M_;
+  int32_t efConstruction_;
+  int32_t entry_;
+  int32_t maxLevel_;
+  std::vector<int8_t> levels_;
+  std::vector<int32_t> links0_;
+  std::vector<int64_t> upperStart_;
+  std::vector<int32_t> upperLinks_;
+  // Striped locks over the nodes, only held while building.
+  std::unique_ptr<std::mutex[]> locks_;
+  std::mutex entryLock_;
+};
+
+} // namespace fasttext
@@ -0,0 +1,170 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "int8matrix.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "kernels.h"
+#include "utils.h"
+
+namespace fasttext {
+
+namespace {
+
+// values[j] = round(x[j] / scale), for the scale that maps the largest
+// magnitude of x to 127; returns the scale, 0 if x is 0.
+real quantizeValues(const real* x, int64_t n, int8_t* values)
+{
+  real largest = 0.0;
+  for (int64_t j = 0; j < n; j++) {
+    largest = std::max(largest, std::abs(x[j]));
+  }
+  if (largest == 0.0) {
+    std::fill(values, values + n, 0);
+    return 0.0;
+  }
+  real scale = largest / 127;
+  for (int64_t j = 0; j < n; j++) {
+    values[j] = (int8_t)std::lround(x[j] / scale);
+  }
+  return scale;
+}
+
+} // namespace
+
+Int8Matrix::Int8Matrix() : Matrix(), values_(nullptr) {}
+
+Int8Matrix::Int8Matrix(const DenseMatrix& mat)
+    : Matrix(mat.size(0), mat.size(1)),
+      valuesStorage_(mat.size(0) * mat.size(1)),
+      scales_(mat.size(0))
+{
+  for (int64_t i = 0; i < m_; i++) {
+    scales_[i] = quantizeValues(
+        mat.data() + i * n_, n_, valuesStorage_.data() + i * n_);
+  }
+  values_ = valuesStorage_.data();
+}
+
+real Int8Matrix::quantizeVector(
+    const Vector& vec,
+    std::vector<int8_t>& values) const
+{
+  assert(vec.size() == n_);
+  values.resize(n_);
+  return quantizeValues(vec.data(), n_, values.data());
+}
+
+real Int8Matrix::dotRow(const Vector& vec, int64_t i) const
+{
+  assert(i >= 0);
+  assert(i < m_);
+  assert(vec.size() == n_);
+  return scales_[i] * kernels::dotInt8(row(i), vec.data(), n_);
+}
+
+void Int8Matrix::dotRows(const Vector& vec, Vector& out) const
+{
+  assert(out.size() == m_);
+  std::vector<int8_t> values;
+  real scale = quantizeVector(vec, values);
+  std::vector<int32_t> dots(m_);
+  kernels::gemvInt8(values_, nullptr, m_, n_, values.data(), dots.data());
+  for (int64_t i = 0; i < m_; i++) {
+    out[i] = scales_[i] * scale * dots[i];
+  }
+}
+
+void Int8Matrix::dotRows(
+    const Vector& vec,
+    const int32_t* rows,
+    int64_t count,
+    real* out) const
+{
+  std::vector<int8_t> values;
+  real scale = quantizeVector(vec, values);
+  std::vector<int32_t> dots(count);
+  kernels::gemvInt8(values_, rows, count, n_, values.data(), dots.data());
+  for (int64_t k = 0; k < count; k++) {
+    out[k] = scales_[rows[k]] * scale * dots[k];
+  }
+}
+
+void Int8Matrix::addVectorToRow(const Vector&, int64_t, real)
+{
+  throw std::runtime_error("Operation not permitted on quantized matrices.");
+}
+
+void Int8Matrix::addRowToVector(Vector& x, int32_t i) const
+{
+  assert(x.size() == n_);
+  kernels::axpyInt8(scales_[i], row(i), x.data(), n_);
+}
+
+void Int8Matrix::addRowToVector(Vector& x, int32_t i, real a) const
+{
+  assert(x.size() == n_);
+  kernels::axpyInt8(a * scales_[i], row(i), x.data(), n_);
+}
+
+void Int8Matrix::save(std::ostream& out) const
+{
+  out.write((char*)&m_, sizeof(int64_t));
+  out.write((char*)&n_, sizeof(int64_t));
+  out.write((char*)scales_.data(), m_ * sizeof(real));
+  out.write((char*)values_, m_ * n_ * sizeof(int8_t));
+}
+
+void Int8Matrix::load(std::istream& in)
+{
+  load(in, nullptr);
+}
+
+// Values are bytes, so unlike DenseMatrix they can always be used in place.
+void Int8Matrix::load(
+    std::istream& in,
+    std::shared_ptr<utils::MappedFile> mapping)
+{
+  in.read((char*)&m_, sizeof(int64_t));
+  in.read((char*)&n_, sizeof(int64_t));
+  scales_ = std::vector<real>(m_);
+  in.read((char*)scales_.data(), m_ * sizeof(real));
+  mapping_ = mapping;
+  if (mapping_) {
+    int64_t offset = in.tellg();
+    if (offset >= 0 && offset + m_ * n_ <= mapping_->size()) {
+      valuesStorage_ = std::vector<int8_t>();
+      values_ = (const int8_t*)mapping_->data() + offset;
+      in.seekg(offset + m_ * n_);
+      return;
+    }
+  }
+  valuesStorage_ = std::vector<int8_t>(m_ * n_);
+  values_ = valuesStorage_.data();
+  in.read((char*)valuesStorage_.data(), m_ * n_ * sizeof(int8_t));
+}
+
+void Int8Matrix::dump(std::ostream& out) const
+{
+  out << m_ << " " << n_ << std::endl;
+  for (int64_t i = 0; i < m_; i++) {
+    for (int64_t j = 0; j < n_; j++) {
+      if (j > 0) {
+        out << " ";
+      }
+      out << scales_[i] * row(i)[j];
+    }
+    out << std::endl;
+  }
+}
+
+} // namespace fasttext
@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "densematrix.h"
+#include "matrix.h"
+#include "real.h"
+#include "vector.h"
+
+namespace fasttext {
+
+// Rows of int8 values times a scale per row, for inference: a quarter of
+// the memory of a DenseMatrix, with an error per value of at most 1/254 of
+// the largest magnitude in its row. dotRows also rounds vec to int8, to
+// score the rows with integer products.
+class Int8Matrix : public Matrix {
+ protected:
+  // values_ points either into valuesStorage_ or, for a matrix loaded as a
+  // view of a model file, into mapping_.
+  const int8_t* values_;
+  std::vector<int8_t> valuesStorage_;
+  std::vector<real> scales_;
+  std::shared_ptr<utils::MappedFile> mapping_;
+
+  inline const int8_t* row(int64_t i) const {
+    return values_ + i * n_;
+  }
+  real quantizeVector(const Vector& vec, std::vector<int8_t>& values) const;
+
+ public:
+  Int8Matrix();
+  explicit Int8Matrix(const DenseMatrix&);
+  Int8Matrix(const Int8Matrix&) = delete;
+  Int8Matrix(Int8Matrix&&) = delete;
+  Int8Matrix& operator=(const Int8Matrix&) = delete;
+  Int8Matrix& operator=(Int8Matrix&&) = delete;
+  virtual ~Int8Matrix() noexcept override = default;
+
+  real dotRow(const Vector&, int64_t) const override;
+  void dotRows(const Vector& vec, Vector& out) const override;
+  void dotRows(
+      const Vector& vec,
+      const int32_t* rows,
+      int64_t count,
+      real* out) const override;
+  void addVectorToRow(const Vector&, int64_t, real) override;
+  void addRowToVector(Vector& x, int32_t i) const override;
+  void addRowToVector(Vector& x, int32_t i, real a) const override;
+  void save(std::ostream&) const override;
+  void load(std::istream&) override;
+  void load(std::istream&, std::shared_ptr<utils::MappedFile>) override;
+  void dump(std::ostream&) const override;
+};
+
+} // namespace fasttext
@@ -0,0 +1,1813 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FASTTEXT_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// SSE is part of x86-64. The wider versions are compiled for their
+// instruction set function by function, whatever the flags of the build.
+#if defined(__GNUC__) || defined(__clang__)
+#define FASTTEXT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define FASTTEXT_TARGET(isa)
+#endif
+
+namespace fasttext {
+
+namespace kernels {
+
+namespace {
+
+enum Level { SCALAR = 0, SSE = 1, AVX2 = 2, AVX512 = 3 };
+
+const char* const LEVEL_NAMES[] = {"scalar", "sse", "avx2", "avx512"};
+
+// Constants of the exp and log approximations of the vector versions, from
+// Cephes: a range reduction to [-ln(2) / 2, ln(2) / 2] for exp and to
+// [sqrt(1/2) - 1, sqrt(2) - 1] for log, then a polynomial, for a relative
+// error of a few 1e-7. exp saturates outside of [EXP_MIN, EXP_MAX].
+constexpr float EXP_MIN = -87.0f;
+constexpr float EXP_MAX = 88.0f;
+constexpr float LOG2E = 1.44269504088896341f;
+constexpr float LN2_HI = 0.693359375f;
+constexpr float LN2_LO = -2.12194440e-4f;
+constexpr float SQRT_HALF = 0.707106781186547524f;
+const float EXP_P[] = {1.9875691500e-4f,
+                       1.3981999507e-3f,
+                       8.3334519073e-3f,
+                       4.1665795894e-2f,
+                       1.6666665459e-1f,
+                       5.0000001201e-1f};
+const float LOG_P[] = {7.0376836292e-2f,
+                       -1.1514610310e-1f,
+                       1.1676998740e-1f,
+                       -1.2420140846e-1f,
+                       1.4249322787e-1f,
+                       -1.6668057665e-1f,
+                       2.0000714765e-1f,
+                       -2.4999993993e-1f,
+                       3.3333331174e-1f};
+
+// Row i of the matrix a with rows of n values, or row rows[i] if rows is set.
+template <typename T>
+inline T* rowOf(T* a, const int32_t* rows, int64_t i, int64_t n)
+{
+  return a + (rows ? rows[i] : i) * n;
+}
+
+real dotScalar(const real* x, const real* y, int64_t n)
+{
+  real d = 0.0;
+  for (int64_t i = 0; i < n; i++) {
+    d += x[i] * y[i];
+  }
+  return d;
+}
+
+real squaredNormScalar(const real* x, int64_t n)
+{
+  return dotScalar(x, x, n);
+}
+
+void addScalar(const real* x, real* y, int64_t n)
+{
+  for (int64_t i = 0; i < n; i++) {
+    y[i] += x[i];
+  }
+}
+
+void axpyScalar(real a, const real* x, real* y, int64_t n)
+{
+  for (int64_t i = 0; i < n; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+void scaleScalar(real a, real* x, int64_t n)
+{
+  for (int64_t i = 0; i < n; i++) {
+    x[i] *= a;
+  }
+}
+
+// x - x is 0 for finite values and NaN otherwise, so the sum is 0 exactly
+// when every value is finite.
+bool allFiniteScalar(const real* x, int64_t n)
+{
+  real s = 0.0;
+  for (int64_t i = 0; i < n; i++) {
+    s += x[i] - x[i];
+  }
+  return s == 0.0;
+}
+
+void gemvScalar(
+    const real* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* y)
+{
+  for (int64_t i = 0; i < m; i++) {
+    y[i] = dotScalar(rowOf(a, rows, i, n), x, n);
+  }
+}
+
+void updateRowsScalar(
+    const real* alpha,
+    const real* x,
+    real* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    real* g)
+{
+  for (int64_t i = 0; i < m; i++) {
+    real* row = rowOf(a, rows, i, n);
+    for (int64_t j = 0; j < n; j++) {
+      g[j] += alpha[i] * row[j];
+      row[j] += alpha[i] * x[j];
+    }
+  }
+}
+
+// Point of ct nearest to x among the best points of the lanes of a vector
+// version and the points from start on, which the lanes did not cover.
+int64_t nearestFinish(
+    const real* ct,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* distance,
+    int64_t start,
+    int64_t lanes,
+    const real* laneDistances,
+    const int32_t* laneIndices)
+{
+  int64_t best = -1;
+  real bestDistance = 0.0;
+  for (int64_t l = 0; l < lanes; l++) {
+    if (best < 0 || laneDistances[l] < bestDistance ||
+        (laneDistances[l] == bestDistance && laneIndices[l] < best)) {
+      best = laneIndices[l];
+      bestDistance = laneDistances[l];
+    }
+  }
+  for (int64_t r = start; r < m; r++) {
+    real d = 0.0;
+    for (int64_t j = 0; j < n; j++) {
+      real t = x[j] - ct[j * m + r];
+      d += t * t;
+    }
+    if (best < 0 || d < bestDistance) {
+      best = r;
+      bestDistance = d;
+    }
+  }
+  *distance = bestDistance;
+  return best;
+}
+
+int64_t nearestScalar(
+    const real* ct,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* distance)
+{
+  return nearestFinish(ct, m, n, x, distance, 0, 0, nullptr, nullptr);
+}
+
+void scan4Scalar(
+    const uint8_t* codes,
+    int64_t blocks,
+    int64_t nt,
+    const uint8_t* lut,
+    uint16_t* out)
+{
+  for (int64_t b = 0; b < blocks; b++) {
+    uint16_t* sums = out + b * 32;
+    std::fill(sums, sums + 32, 0);
+    for (int64_t t = 0; t < nt; t++) {
+      const uint8_t* code = codes + (b * nt + t) * 16;
+      const uint8_t* table = lut + t * 16;
+      for (int64_t i = 0; i < 16; i++) {
+        sums[i] += table[code[i] & 15];
+        sums[i + 16] += table[code[i] >> 4];
+      }
+    }
+  }
+}
+
+real dotInt8Scalar(const int8_t* a, const real* x, int64_t n)
+{
+  real d = 0.0;
+  for (int64_t i = 0; i < n; i++) {
+    d += a[i] * x[i];
+  }
+  return d;
+}
+
+void axpyInt8Scalar(real alpha, const int8_t* a, real* y, int64_t n)
+{
+  for (int64_t i = 0; i < n; i++) {
+    y[i] += alpha * a[i];
+  }
+}
+
+void gemvInt8Scalar(
+    const int8_t* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    const int8_t* x,
+    int32_t* y)
+{
+  for (int64_t r = 0; r < m; r++) {
+    const int8_t* ar = rowOf(a, rows, r, n);
+    int32_t d = 0;
+    for (int64_t i = 0; i < n; i++) {
+      d += ar[i] * x[i];
+    }
+    y[r] = d;
+  }
+}
+
+real maxValueScalar(const real* x, int64_t n)
+{
+  return *std::max_element(x, x + n);
+}
+
+real expSumScalar(real shift, real* x, int64_t n)
+{
+  real z = 0.0;
+  for (int64_t i = 0; i < n; i++) {
+    x[i] = std::exp(x[i] - shift);
+    z += x[i];
+  }
+  return z;
+}
+
+void logScalar(real offset, real* x, int64_t n)
+{
+  for (int64_t i = 0; i < n; i++) {
+    x[i] = std::log(x[i] + offset);
+  }
+}
+
+void sigmoidScalar(real* x, int64_t n)
+{
+  for (int64_t i = 0; i < n; i++) {
+    x[i] = 1.0 / (1.0 + std::exp(-x[i]));
+  }
+}
+
+#ifdef FASTTEXT_KERNELS_X86
+
+inline float hsum(__m128 v)
+{
+  __m128 h = _mm_movehl_ps(v, v);
+  v = _mm_add_ps(v, h);
+  h = _mm_shuffle_ps(v, v, 1);
+  v = _mm_add_ss(v, h);
+  return _mm_cvtss_f32(v);
+}
+
+real dotSSE(const real* x, const real* y, int64_t n)
+{
+  __m128 s0 = _mm_setzero_ps();
+  __m128 s1 = _mm_setzero_ps();
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+    s1 = _mm_add_ps(
+        s1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(y + i + 4)));
+  }
+  if (i + 4 <= n) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+    i += 4;
+  }
+  real d = hsum(_mm_add_ps(s0, s1));
+  for (; i < n; i++) {
+    d += x[i] * y[i];
+  }
+  return d;
+}
+
+real squaredNormSSE(const real* x, int64_t n)
+{
+  return dotSSE(x, x, n);
+}
+
+void addSSE(const real* x, real* y, int64_t n)
+{
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_loadu_ps(x + i)));
+  }
+  for (; i < n; i++) {
+    y[i] += x[i];
+  }
+}
+
+void axpySSE(real a, const real* x, real* y, int64_t n)
+{
+  const __m128 va = _mm_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(
+        y + i,
+        _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+  }
+  for (; i < n; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+void scaleSSE(real a, real* x, int64_t n)
+{
+  const __m128 va = _mm_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), va));
+  }
+  for (; i < n; i++) {
+    x[i] *= a;
+  }
+}
+
+bool allFiniteSSE(const real* x, int64_t n)
+{
+  __m128 s = _mm_setzero_ps();
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 v = _mm_loadu_ps(x + i);
+    s = _mm_add_ps(s, _mm_sub_ps(v, v));
+  }
+  return _mm_movemask_ps(_mm_cmpneq_ps(s, _mm_setzero_ps())) == 0 &&
+      allFiniteScalar(x + i, n - i);
+}
+
+void gemvSSE(
+    const real* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* y)
+{
+  int64_t i = 0;
+  for (; i + 4 <= m; i += 4) {
+    const real* r0 = rowOf(a, rows, i, n);
+    const real* r1 = rowOf(a, rows, i + 1, n);
+    const real* r2 = rowOf(a, rows, i + 2, n);
+    const real* r3 = rowOf(a, rows, i + 3, n);
+    __m128 s0 = _mm_setzero_ps();
+    __m128 s1 = _mm_setzero_ps();
+    __m128 s2 = _mm_setzero_ps();
+    __m128 s3 = _mm_setzero_ps();
+    int64_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+      __m128 v = _mm_loadu_ps(x + j);
+      s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(r0 + j), v));
+      s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(r1 + j), v));
+      s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(r2 + j), v));
+      s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(r3 + j), v));
+    }
+    real d0 = hsum(s0), d1 = hsum(s1), d2 = hsum(s2), d3 = hsum(s3);
+    for (; j < n; j++) {
+      d0 += r0[j] * x[j];
+      d1 += r1[j] * x[j];
+      d2 += r2[j] * x[j];
+      d3 += r3[j] * x[j];
+    }
+    y[i] = d0;
+    y[i + 1] = d1;
+    y[i + 2] = d2;
+    y[i + 3] = d3;
+  }
+  for (; i < m; i++) {
+    y[i] = dotSSE(rowOf(a, rows, i, n), x, n);
+  }
+}
+
+void updateRowsSSE(
+    const real* alpha,
+    const real* x,
+    real* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    real* g)
+{
+  for (int64_t i = 0; i < m; i++) {
+    real* row = rowOf(a, rows, i, n);
+    const __m128 va = _mm_set1_ps(alpha[i]);
+    int64_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+      __m128 r = _mm_loadu_ps(row + j);
+      _mm_storeu_ps(g + j, _mm_add_ps(_mm_loadu_ps(g + j), _mm_mul_ps(va, r)));
+      _mm_storeu_ps(
+          row + j, _mm_add_ps(r, _mm_mul_ps(va, _mm_loadu_ps(x + j))));
+    }
+    for (; j < n; j++) {
+      g[j] += alpha[i] * row[j];
+      row[j] += alpha[i] * x[j];
+    }
+  }
+}
+
+inline __m128 exp4(__m128 x)
+{
+  x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(EXP_MIN)), _mm_set1_ps(EXP_MAX));
+  __m128i k = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(LOG2E)));
+  __m128 fk = _mm_cvtepi32_ps(k);
+  x = _mm_sub_ps(x, _mm_mul_ps(fk, _mm_set1_ps(LN2_HI)));
+  x = _mm_sub_ps(x, _mm_mul_ps(fk, _mm_set1_ps(LN2_LO)));
+  __m128 p = _mm_set1_ps(EXP_P[0]);
+  for (int i = 1; i < 6; i++) {
+    p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(EXP_P[i]));
+  }
+  p = _mm_add_ps(
+      _mm_mul_ps(_mm_mul_ps(p, x), x), _mm_add_ps(x, _mm_set1_ps(1.0f)));
+  __m128i scale =
+      _mm_slli_epi32(_mm_add_epi32(k, _mm_set1_epi32(127)), 23);
+  return _mm_mul_ps(p, _mm_castsi128_ps(scale));
+}
+
+inline __m128 log4(__m128 x)
+{
+  __m128i e = _mm_sub_epi32(
+      _mm_srli_epi32(_mm_castps_si128(x), 23), _mm_set1_epi32(126));
+  __m128 m = _mm_or_ps(
+      _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x007fffff))),
+      _mm_set1_ps(0.5f));
+  __m128 fe = _mm_cvtepi32_ps(e);
+  // m in [0.5, 1): below sqrt(1/2), use 2m - 1 and e - 1 instead of m - 1
+  __m128 below = _mm_cmplt_ps(m, _mm_set1_ps(SQRT_HALF));
+  fe = _mm_sub_ps(fe, _mm_and_ps(below, _mm_set1_ps(1.0f)));
+  m = _mm_add_ps(_mm_sub_ps(m, _mm_set1_ps(1.0f)), _mm_and_ps(below, m));
+  __m128 z = _mm_mul_ps(m, m);
+  __m128 y = _mm_set1_ps(LOG_P[0]);
+  for (int i = 1; i < 9; i++) {
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(LOG_P[i]));
+  }
+  y = _mm_mul_ps(_mm_mul_ps(y, m), z);
+  y = _mm_add_ps(y, _mm_mul_ps(fe, _mm_set1_ps(LN2_LO)));
+  y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+  return _mm_add_ps(_mm_add_ps(m, y), _mm_mul_ps(fe, _mm_set1_ps(LN2_HI)));
+}
+
+int64_t nearestSSE(
+    const real* ct,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* distance)
+{
+  if (m < 4) {
+    return nearestScalar(ct, m, n, x, distance);
+  }
+  __m128 best = _mm_set1_ps(INFINITY);
+  __m128i bestIndex = _mm_setzero_si128();
+  __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+  const __m128i step = _mm_set1_epi32(4);
+  int64_t r = 0;
+  for (; r + 4 <= m; r += 4) {
+    __m128 d = _mm_setzero_ps();
+    for (int64_t j = 0; j < n; j++) {
+      __m128 t = _mm_sub_ps(_mm_set1_ps(x[j]), _mm_loadu_ps(ct + j * m + r));
+      d = _mm_add_ps(d, _mm_mul_ps(t, t));
+    }
+    __m128 closer = _mm_cmplt_ps(d, best);
+    best = _mm_or_ps(_mm_and_ps(closer, d), _mm_andnot_ps(closer, best));
+    __m128i c = _mm_castps_si128(closer);
+    bestIndex = _mm_or_si128(
+        _mm_and_si128(c, index), _mm_andnot_si128(c, bestIndex));
+    index = _mm_add_epi32(index, step);
+  }
+  alignas(16) real laneDistances[4];
+  alignas(16) int32_t laneIndices[4];
+  _mm_store_ps(laneDistances, best);
+  _mm_store_si128((__m128i*)laneIndices, bestIndex);
+  return nearestFinish(
+      ct, m, n, x, distance, r, 4, laneDistances, laneIndices);
+}
+
+// The 8 int8 values at a, as floats in two vectors.
+inline void loadInt8(const int8_t* a, __m128& low, __m128& high)
+{
+  __m128i v = _mm_loadl_epi64((const __m128i*)a);
+  // sign extension by arithmetic shifts of the bytes put in the high bits
+  v = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+  low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+  high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+}
+
+real dotInt8SSE(const int8_t* a, const real* x, int64_t n)
+{
+  __m128 s0 = _mm_setzero_ps();
+  __m128 s1 = _mm_setzero_ps();
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128 low, high;
+    loadInt8(a + i, low, high);
+    s0 = _mm_add_ps(s0, _mm_mul_ps(low, _mm_loadu_ps(x + i)));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(high, _mm_loadu_ps(x + i + 4)));
+  }
+  return hsum(_mm_add_ps(s0, s1)) + dotInt8Scalar(a + i, x + i, n - i);
+}
+
+void axpyInt8SSE(real alpha, const int8_t* a, real* y, int64_t n)
+{
+  const __m128 va = _mm_set1_ps(alpha);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128 low, high;
+    loadInt8(a + i, low, high);
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, low)));
+    _mm_storeu_ps(
+        y + i + 4, _mm_add_ps(_mm_loadu_ps(y + i + 4), _mm_mul_ps(va, high)));
+  }
+  axpyInt8Scalar(alpha, a + i, y + i, n - i);
+}
+
+void gemvInt8SSE(
+    const int8_t* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    const int8_t* x,
+    int32_t* y)
+{
+  for (int64_t r = 0; r < m; r++) {
+    const int8_t* ar = rowOf(a, rows, r, n);
+    __m128i s = _mm_setzero_si128();
+    int64_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m128i va = _mm_loadu_si128((const __m128i*)(ar + i));
+      __m128i vx = _mm_loadu_si128((const __m128i*)(x + i));
+      s = _mm_add_epi32(
+          s,
+          _mm_madd_epi16(
+              _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8),
+              _mm_srai_epi16(_mm_unpacklo_epi8(vx, vx), 8)));
+      s = _mm_add_epi32(
+          s,
+          _mm_madd_epi16(
+              _mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8),
+              _mm_srai_epi16(_mm_unpackhi_epi8(vx, vx), 8)));
+    }
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t d = _mm_cvtsi128_si32(s);
+    for (; i < n; i++) {
+      d += ar[i] * x[i];
+    }
+    y[r] = d;
+  }
+}
+
+real maxValueSSE(const real* x, int64_t n)
+{
+  if (n < 4) {
+    return maxValueScalar(x, n);
+  }
+  __m128 v = _mm_loadu_ps(x);
+  int64_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    v = _mm_max_ps(v, _mm_loadu_ps(x + i));
+  }
+  v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+  real m = _mm_cvtss_f32(v);
+  for (; i < n; i++) {
+    m = std::max(m, x[i]);
+  }
+  return m;
+}
+
+real expSumSSE(real shift, real* x, int64_t n)
+{
+  const __m128 vs = _mm_set1_ps(shift);
+  __m128 s = _mm_setzero_ps();
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 v = exp4(_mm_sub_ps(_mm_loadu_ps(x + i), vs));
+    _mm_storeu_ps(x + i, v);
+    s = _mm_add_ps(s, v);
+  }
+  return hsum(s) + expSumScalar(shift, x + i, n - i);
+}
+
+void logSSE(real offset, real* x, int64_t n)
+{
+  const __m128 vo = _mm_set1_ps(offset);
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(x + i, log4(_mm_add_ps(_mm_loadu_ps(x + i), vo)));
+  }
+  logScalar(offset, x + i, n - i);
+}
+
+void sigmoidSSE(real* x, int64_t n)
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 e = exp4(_mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(x + i)));
+    _mm_storeu_ps(x + i, _mm_div_ps(one, _mm_add_ps(one, e)));
+  }
+  sigmoidScalar(x + i, n - i);
+}
+
+FASTTEXT_TARGET("avx2,fma")
+real dotAVX2(const real* x, const real* y, int64_t n)
+{
+  __m256 s0 = _mm256_setzero_ps();
+  __m256 s1 = _mm256_setzero_ps();
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), s0);
+    s1 = _mm256_fmadd_ps(
+        _mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), s1);
+  }
+  if (i + 8 <= n) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), s0);
+    i += 8;
+  }
+  s0 = _mm256_add_ps(s0, s1);
+  __m128 s = _mm_add_ps(
+      _mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+  if (i + 4 <= n) {
+    s = _mm_fmadd_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i), s);
+    i += 4;
+  }
+  real d = hsum(s);
+  for (; i < n; i++) {
+    d += x[i] * y[i];
+  }
+  return d;
+}
+
+FASTTEXT_TARGET("avx2,fma")
+real squaredNormAVX2(const real* x, int64_t n)
+{
+  return dotAVX2(x, x, n);
+}
+
+FASTTEXT_TARGET("avx2,fma")
+void addAVX2(const real* x, real* y, int64_t n)
+{
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(
+        y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_loadu_ps(x + i)));
+  }
+  for (; i < n; i++) {
+    y[i] += x[i];
+  }
+}
+
+FASTTEXT_TARGET("avx2,fma")
+void axpyAVX2(real a, const real* x, real* y, int64_t n)
+{
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(
+        y + i,
+        _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+  }
+  for (; i < n; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+FASTTEXT_TARGET("avx2,fma")
+void scaleAVX2(real a, real* x, int64_t n)
+{
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(x + i, _mm256_mul_ps(_mm256_loadu_ps(x + i), va));
+  }
+  for (; i < n; i++) {
+    x[i] *= a;
+  }
+}
+
+FASTTEXT_TARGET("avx2,fma")
+bool allFiniteAVX2(const real* x, int64_t n)
+{
+  __m256 s = _mm256_setzero_ps();
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(x + i);
+    s = _mm256_add_ps(s, _mm256_sub_ps(v, v));
+  }
+  return _mm256_movemask_ps(
+             _mm256_cmp_ps(s, _mm256_setzero_ps(), _CMP_NEQ_UQ)) == 0 &&
+      allFiniteScalar(x + i, n - i);
+}
+
+FASTTEXT_TARGET("avx2,fma")
+inline float hsum256(__m256 v)
+{
+  return hsum(
+      _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+FASTTEXT_TARGET("avx2,fma")
+void gemvAVX2(
+    const real* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* y)
+{
+  int64_t i = 0;
+  for (; i + 4 <= m; i += 4) {
+    const real* r0 = rowOf(a, rows, i, n);
+    const real* r1 = rowOf(a, rows, i + 1, n);
+    const real* r2 = rowOf(a, rows, i + 2, n);
+    const real* r3 = rowOf(a, rows, i + 3, n);
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps();
+    __m256 s3 = _mm256_setzero_ps();
+    int64_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+      __m256 v = _mm256_loadu_ps(x + j);
+      s0 = _mm256_fmadd_ps(_mm256_loadu_ps(r0 + j), v, s0);
+      s1 = _mm256_fmadd_ps(_mm256_loadu_ps(r1 + j), v, s1);
+      s2 = _mm256_fmadd_ps(_mm256_loadu_ps(r2 + j), v, s2);
+      s3 = _mm256_fmadd_ps(_mm256_loadu_ps(r3 + j), v, s3);
+    }
+    real d0 = hsum256(s0), d1 = hsum256(s1), d2 = hsum256(s2),
+         d3 = hsum256(s3);
+    for (; j < n; j++) {
+      d0 += r0[j] * x[j];
+      d1 += r1[j] * x[j];
+      d2 += r2[j] * x[j];
+      d3 += r3[j] * x[j];
+    }
+    y[i] = d0;
+    y[i + 1] = d1;
+    y[i + 2] = d2;
+    y[i + 3] = d3;
+  }
+  for (; i < m; i++) {
+    y[i] = dotAVX2(rowOf(a, rows, i, n), x, n);
+  }
+}
+
+FASTTEXT_TARGET("avx2,fma")
+void updateRowsAVX2(
+    const real* alpha,
+    const real* x,
+    real* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    real* g)
+{
+  for (int64_t i = 0; i < m; i++) {
+    real* row = rowOf(a, rows, i, n);
+    const __m256 va = _mm256_set1_ps(alpha[i]);
+    int64_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+      __m256 r = _mm256_loadu_ps(row + j);
+      _mm256_storeu_ps(g + j, _mm256_fmadd_ps(va, r, _mm256_loadu_ps(g + j)));
+      _mm256_storeu_ps(row + j, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + j), r));
+    }
+    for (; j < n; j++) {
+      g[j] += alpha[i] * row[j];
+      row[j] += alpha[i] * x[j];
+    }
+  }
+}
+
+FASTTEXT_TARGET("avx2,fma")
+inline __m256 exp8(__m256 x)
+{
+  x = _mm256_min_ps(
+      _mm256_max_ps(x, _mm256_set1_ps(EXP_MIN)), _mm256_set1_ps(EXP_MAX));
+  __m256i k = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(LOG2E)));
+  __m256 fk = _mm256_cvtepi32_ps(k);
+  x = _mm256_fnmadd_ps(fk, _mm256_set1_ps(LN2_HI), x);
+  x = _mm256_fnmadd_ps(fk, _mm256_set1_ps(LN2_LO), x);
+  __m256 p = _mm256_set1_ps(EXP_P[0]);
+  for (int i = 1; i < 6; i++) {
+    p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(EXP_P[i]));
+  }
+  p = _mm256_fmadd_ps(
+      _mm256_mul_ps(p, x), x, _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+  __m256i scale =
+      _mm256_slli_epi32(_mm256_add_epi32(k, _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(scale));
+}
+
+FASTTEXT_TARGET("avx2,fma")
+inline __m256 log8(__m256 x)
+{
+  __m256i e = _mm256_sub_epi32(
+      _mm256_srli_epi32(_mm256_castps_si256(x), 23), _mm256_set1_epi32(126));
+  __m256 m = _mm256_or_ps(
+      _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x007fffff))),
+      _mm256_set1_ps(0.5f));
+  __m256 fe = _mm256_cvtepi32_ps(e);
+  __m256 below = _mm256_cmp_ps(m, _mm256_set1_ps(SQRT_HALF), _CMP_LT_OQ);
+  fe = _mm256_sub_ps(fe, _mm256_and_ps(below, _mm256_set1_ps(1.0f)));
+  m = _mm256_add_ps(
+      _mm256_sub_ps(m, _mm256_set1_ps(1.0f)), _mm256_and_ps(below, m));
+  __m256 z = _mm256_mul_ps(m, m);
+  __m256 y = _mm256_set1_ps(LOG_P[0]);
+  for (int i = 1; i < 9; i++) {
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(LOG_P[i]));
+  }
+  y = _mm256_mul_ps(_mm256_mul_ps(y, m), z);
+  y = _mm256_fmadd_ps(fe, _mm256_set1_ps(LN2_LO), y);
+  y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+  return _mm256_fmadd_ps(fe, _mm256_set1_ps(LN2_HI), _mm256_add_ps(m, y));
+}
+
+FASTTEXT_TARGET("avx2,fma")
+int64_t nearestAVX2(
+    const real* ct,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* distance)
+{
+  if (m < 8) {
+    return nearestSSE(ct, m, n, x, distance);
+  }
+  // the tail is read with masked loads, so that every distance is computed
+  // the same way
+  const __m256 inf = _mm256_set1_ps(INFINITY);
+  const __m256i end = _mm256_set1_epi32(int32_t(m));
+  const __m256i step = _mm256_set1_epi32(8);
+  __m256 best = inf;
+  __m256i bestIndex = _mm256_setzero_si256();
+  __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  for (int64_t r = 0; r < m; r += 8) {
+    const __m256i valid = _mm256_cmpgt_epi32(end, index);
+    __m256 d = _mm256_setzero_ps();
+    for (int64_t j = 0; j < n; j++) {
+      __m256 c = r + 8 <= m ? _mm256_loadu_ps(ct + j * m + r)
+                            : _mm256_maskload_ps(ct + j * m + r, valid);
+      __m256 t = _mm256_sub_ps(_mm256_set1_ps(x[j]), c);
+      d = _mm256_fmadd_ps(t, t, d);
+    }
+    d = _mm256_blendv_ps(inf, d, _mm256_castsi256_ps(valid));
+    __m256 closer = _mm256_cmp_ps(d, best, _CMP_LT_OQ);
+    best = _mm256_blendv_ps(best, d, closer);
+    bestIndex = _mm256_blendv_epi8(
+        bestIndex, index, _mm256_castps_si256(closer));
+    index = _mm256_add_epi32(index, step);
+  }
+  alignas(32) real laneDistances[8];
+  alignas(32) int32_t laneIndices[8];
+  _mm256_store_ps(laneDistances, best);
+  _mm256_store_si256((__m256i*)laneIndices, bestIndex);
+  return nearestFinish(
+      ct, m, n, x, distance, m, 8, laneDistances, laneIndices);
+}
+
+// Two tables at a time: the 32 bytes of codes for tables t and t + 1 are
+// looked up in the 32 bytes of the tables, whose 128-bit halves each hold
+// one. The halves of the 16-bit sums are added at the end of a block.
+FASTTEXT_TARGET("avx2,fma")
+void scan4AVX2(
+    const uint8_t* codes,
+    int64_t blocks,
+    int64_t nt,
+    const uint8_t* lut,
+    uint16_t* out)
+{
+  const __m256i low = _mm256_set1_epi8(15);
+  const __m256i zero = _mm256_setzero_si256();
+  for (int64_t b = 0; b < blocks; b++) {
+    __m256i s0 = zero, s1 = zero, s2 = zero, s3 = zero;
+    const uint8_t* code = codes + b * nt * 16;
+    for (int64_t t = 0; t < nt; t += 2) {
+      __m256i c = _mm256_loadu_si256((const __m256i*)(code + t * 16));
+      __m256i table = _mm256_loadu_si256((const __m256i*)(lut + t * 16));
+      __m256i v0 = _mm256_shuffle_epi8(table, _mm256_and_si256(c, low));
+      __m256i v1 = _mm256_shuffle_epi8(
+          table, _mm256_and_si256(_mm256_srli_epi16(c, 4), low));
+      s0 = _mm256_add_epi16(s0, _mm256_unpacklo_epi8(v0, zero));
+      s1 = _mm256_add_epi16(s1, _mm256_unpackhi_epi8(v0, zero));
+      s2 = _mm256_add_epi16(s2, _mm256_unpacklo_epi8(v1, zero));
+      s3 = _mm256_add_epi16(s3, _mm256_unpackhi_epi8(v1, zero));
+    }
+    __m128i* sums = (__m128i*)(out + b * 32);
+    _mm_storeu_si128(
+        sums,
+        _mm_add_epi16(
+            _mm256_castsi256_si128(s0), _mm256_extracti128_si256(s0, 1)));
+    _mm_storeu_si128(
+        sums + 1,
+        _mm_add_epi16(
+            _mm256_castsi256_si128(s1), _mm256_extracti128_si256(s1, 1)));
+    _mm_storeu_si128(
+        sums + 2,
+        _mm_add_epi16(
+            _mm256_castsi256_si128(s2), _mm256_extracti128_si256(s2, 1)));
+    _mm_storeu_si128(
+        sums + 3,
+        _mm_add_epi16(
+            _mm256_castsi256_si128(s3), _mm256_extracti128_si256(s3, 1)));
+  }
+}
+
+FASTTEXT_TARGET("avx2,fma")
+inline __m256 loadInt8x8(const int8_t* a)
+{
+  return _mm256_cvtepi32_ps(
+      _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)a)));
+}
+
+FASTTEXT_TARGET("avx2,fma")
+real dotInt8AVX2(const int8_t* a, const real* x, int64_t n)
+{
+  __m256 s0 = _mm256_setzero_ps();
+  __m256 s1 = _mm256_setzero_ps();
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    s0 = _mm256_fmadd_ps(loadInt8x8(a + i), _mm256_loadu_ps(x + i), s0);
+    s1 = _mm256_fmadd_ps(
+        loadInt8x8(a + i + 8), _mm256_loadu_ps(x + i + 8), s1);
+  }
+  if (i + 8 <= n) {
+    s0 = _mm256_fmadd_ps(loadInt8x8(a + i), _mm256_loadu_ps(x + i), s0);
+    i += 8;
+  }
+  s0 = _mm256_add_ps(s0, s1);
+  return hsum(_mm_add_ps(
+             _mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1))) +
+      dotInt8Scalar(a + i, x + i, n - i);
+}
+
+FASTTEXT_TARGET("avx2,fma")
+void axpyInt8AVX2(real alpha, const int8_t* a, real* y, int64_t n)
+{
+  const __m256 va = _mm256_set1_ps(alpha);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(
+        y + i,
+        _mm256_fmadd_ps(va, loadInt8x8(a + i), _mm256_loadu_ps(y + i)));
+  }
+  axpyInt8Scalar(alpha, a + i, y + i, n - i);
+}
+
+// maddubs multiplies unsigned by signed bytes: |a| by x with the sign of a.
+// With values in [-127, 127], the sums of two products fit 16 bits.
+FASTTEXT_TARGET("avx2,fma")
+void gemvInt8AVX2(
+    const int8_t* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    const int8_t* x,
+    int32_t* y)
+{
+  const __m256i ones = _mm256_set1_epi16(1);
+  for (int64_t r = 0; r < m; r++) {
+    const int8_t* ar = rowOf(a, rows, r, n);
+    __m256i s = _mm256_setzero_si256();
+    int64_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      __m256i va = _mm256_loadu_si256((const __m256i*)(ar + i));
+      __m256i vx = _mm256_loadu_si256((const __m256i*)(x + i));
+      __m256i p = _mm256_maddubs_epi16(
+          _mm256_abs_epi8(va), _mm256_sign_epi8(vx, va));
+      s = _mm256_add_epi32(s, _mm256_madd_epi16(p, ones));
+    }
+    __m128i h = _mm_add_epi32(
+        _mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+    h = _mm_add_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(1, 0, 3, 2)));
+    h = _mm_add_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t d = _mm_cvtsi128_si32(h);
+    for (; i < n; i++) {
+      d += ar[i] * x[i];
+    }
+    y[r] = d;
+  }
+}
+
+FASTTEXT_TARGET("avx2,fma")
+real maxValueAVX2(const real* x, int64_t n)
+{
+  if (n < 8) {
+    return maxValueSSE(x, n);
+  }
+  __m256 v = _mm256_loadu_ps(x);
+  int64_t i = 8;
+  for (; i + 8 <= n; i += 8) {
+    v = _mm256_max_ps(v, _mm256_loadu_ps(x + i));
+  }
+  __m128 h = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  h = _mm_max_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_max_ss(h, _mm_shuffle_ps(h, h, 1));
+  real m = _mm_cvtss_f32(h);
+  for (; i < n; i++) {
+    m = std::max(m, x[i]);
+  }
+  return m;
+}
+
+FASTTEXT_TARGET("avx2,fma")
+real expSumAVX2(real shift, real* x, int64_t n)
+{
+  const __m256 vs = _mm256_set1_ps(shift);
+  __m256 s = _mm256_setzero_ps();
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = exp8(_mm256_sub_ps(_mm256_loadu_ps(x + i), vs));
+    _mm256_storeu_ps(x + i, v);
+    s = _mm256_add_ps(s, v);
+  }
+  return hsum256(s) + expSumScalar(shift, x + i, n - i);
+}
+
+FASTTEXT_TARGET("avx2,fma")
+void logAVX2(real offset, real* x, int64_t n)
+{
+  const __m256 vo = _mm256_set1_ps(offset);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(x + i, log8(_mm256_add_ps(_mm256_loadu_ps(x + i), vo)));
+  }
+  logScalar(offset, x + i, n - i);
+}
+
+FASTTEXT_TARGET("avx2,fma")
+void sigmoidAVX2(real* x, int64_t n)
+{
+  const __m256 one = _mm256_set1_ps(1.0f);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 e = exp8(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(x + i)));
+    _mm256_storeu_ps(x + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+  }
+  sigmoidScalar(x + i, n - i);
+}
+
+// The AVX-512 versions handle the last n % 16 values with masked loads and
+// stores instead of a scalar loop.
+inline __mmask16 tailMask(int64_t left)
+{
+  return (__mmask16)((1u << left) - 1);
+}
+
+FASTTEXT_TARGET("avx512f")
+real dotAVX512(const real* x, const real* y, int64_t n)
+{
+  __m512 s0 = _mm512_setzero_ps();
+  __m512 s1 = _mm512_setzero_ps();
+  int64_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), s0);
+    s1 = _mm512_fmadd_ps(
+        _mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), s1);
+  }
+  if (i + 16 <= n) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), s0);
+    i += 16;
+  }
+  if (i < n) {
+    __mmask16 m = tailMask(n - i);
+    s1 = _mm512_fmadd_ps(
+        _mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i), s1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+FASTTEXT_TARGET("avx512f")
+real squaredNormAVX512(const real* x, int64_t n)
+{
+  return dotAVX512(x, x, n);
+}
+
+FASTTEXT_TARGET("avx512f")
+void addAVX512(const real* x, real* y, int64_t n)
+{
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(
+        y + i, _mm512_add_ps(_mm512_loadu_ps(y + i), _mm512_loadu_ps(x + i)));
+  }
+  if (i < n) {
+    __mmask16 m = tailMask(n - i);
+    _mm512_mask_storeu_ps(
+        y + i,
+        m,
+        _mm512_add_ps(
+            _mm512_maskz_loadu_ps(m, y + i), _mm512_maskz_loadu_ps(m, x + i)));
+  }
+}
+
+FASTTEXT_TARGET("avx512f")
+void axpyAVX512(real a, const real* x, real* y, int64_t n)
+{
+  const __m512 va = _mm512_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(
+        y + i,
+        _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+  }
+  if (i < n) {
+    __mmask16 m = tailMask(n - i);
+    _mm512_mask_storeu_ps(
+        y + i,
+        m,
+        _mm512_fmadd_ps(
+            va,
+            _mm512_maskz_loadu_ps(m, x + i),
+            _mm512_maskz_loadu_ps(m, y + i)));
+  }
+}
+
+FASTTEXT_TARGET("avx512f")
+void scaleAVX512(real a, real* x, int64_t n)
+{
+  const __m512 va = _mm512_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(x + i, _mm512_mul_ps(_mm512_loadu_ps(x + i), va));
+  }
+  if (i < n) {
+    __mmask16 m = tailMask(n - i);
+    _mm512_mask_storeu_ps(
+        x + i, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, x + i), va));
+  }
+}
+
+FASTTEXT_TARGET("avx512f")
+bool allFiniteAVX512(const real* x, int64_t n)
+{
+  __m512 s = _mm512_setzero_ps();
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 v = _mm512_loadu_ps(x + i);
+    s = _mm512_add_ps(s, _mm512_sub_ps(v, v));
+  }
+  if (i < n) {
+    __m512 v = _mm512_maskz_loadu_ps(tailMask(n - i), x + i);
+    s = _mm512_add_ps(s, _mm512_sub_ps(v, v));
+  }
+  return _mm512_cmp_ps_mask(s, _mm512_setzero_ps(), _CMP_NEQ_UQ) == 0;
+}
+
+FASTTEXT_TARGET("avx512f")
+void gemvAVX512(
+    const real* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* y)
+{
+  const __mmask16 tail = tailMask(n % 16);
+  const int64_t body = n - n % 16;
+  int64_t i = 0;
+  for (; i + 4 <= m; i += 4) {
+    const real* r0 = rowOf(a, rows, i, n);
+    const real* r1 = rowOf(a, rows, i + 1, n);
+    const real* r2 = rowOf(a, rows, i + 2, n);
+    const real* r3 = rowOf(a, rows, i + 3, n);
+    __m512 s0 = _mm512_setzero_ps();
+    __m512 s1 = _mm512_setzero_ps();
+    __m512 s2 = _mm512_setzero_ps();
+    __m512 s3 = _mm512_setzero_ps();
+    for (int64_t j = 0; j < body; j += 16) {
+      __m512 v = _mm512_loadu_ps(x + j);
+      s0 = _mm512_fmadd_ps(_mm512_loadu_ps(r0 + j), v, s0);
+      s1 = _mm512_fmadd_ps(_mm512_loadu_ps(r1 + j), v, s1);
+      s2 = _mm512_fmadd_ps(_mm512_loadu_ps(r2 + j), v, s2);
+      s3 = _mm512_fmadd_ps(_mm512_loadu_ps(r3 + j), v, s3);
+    }
+    if (tail) {
+      __m512 v = _mm512_maskz_loadu_ps(tail, x + body);
+      s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail, r0 + body), v, s0);
+      s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail, r1 + body), v, s1);
+      s2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail, r2 + body), v, s2);
+      s3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail, r3 + body), v, s3);
+    }
+    y[i] = _mm512_reduce_add_ps(s0);
+    y[i + 1] = _mm512_reduce_add_ps(s1);
+    y[i + 2] = _mm512_reduce_add_ps(s2);
+    y[i + 3] = _mm512_reduce_add_ps(s3);
+  }
+  for (; i < m; i++) {
+    y[i] = dotAVX512(rowOf(a, rows, i, n), x, n);
+  }
+}
+
+FASTTEXT_TARGET("avx512f")
+void updateRowsAVX512(
+    const real* alpha,
+    const real* x,
+    real* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    real* g)
+{
+  const __mmask16 tail = tailMask(n % 16);
+  const int64_t body = n - n % 16;
+  for (int64_t i = 0; i < m; i++) {
+    real* row = rowOf(a, rows, i, n);
+    const __m512 va = _mm512_set1_ps(alpha[i]);
+    for (int64_t j = 0; j < body; j += 16) {
+      __m512 r = _mm512_loadu_ps(row + j);
+      _mm512_storeu_ps(g + j, _mm512_fmadd_ps(va, r, _mm512_loadu_ps(g + j)));
+      _mm512_storeu_ps(row + j, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + j), r));
+    }
+    if (tail) {
+      __m512 r = _mm512_maskz_loadu_ps(tail, row + body);
+      _mm512_mask_storeu_ps(
+          g + body,
+          tail,
+          _mm512_fmadd_ps(va, r, _mm512_maskz_loadu_ps(tail, g + body)));
+      _mm512_mask_storeu_ps(
+          row + body,
+          tail,
+          _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(tail, x + body), r));
+    }
+  }
+}
+
+FASTTEXT_TARGET("avx512f")
+inline __m512 exp16(__m512 x)
+{
+  x = _mm512_min_ps(
+      _mm512_max_ps(x, _mm512_set1_ps(EXP_MIN)), _mm512_set1_ps(EXP_MAX));
+  __m512 fk = _mm512_roundscale_ps(
+      _mm512_mul_ps(x, _mm512_set1_ps(LOG2E)), _MM_FROUND_TO_NEAREST_INT);
+  x = _mm512_fnmadd_ps(fk, _mm512_set1_ps(LN2_HI), x);
+  x = _mm512_fnmadd_ps(fk, _mm512_set1_ps(LN2_LO), x);
+  __m512 p = _mm512_set1_ps(EXP_P[0]);
+  for (int i = 1; i < 6; i++) {
+    p = _mm512_fmadd_ps(p, x, _mm512_set1_ps(EXP_P[i]));
+  }
+  p = _mm512_fmadd_ps(
+      _mm512_mul_ps(p, x), x, _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+  return _mm512_scalef_ps(p, fk);
+}
+
+// getmant and getexp split x into m in [0.5, 1) and 2^(e + 1).
+FASTTEXT_TARGET("avx512f")
+inline __m512 log16(__m512 x)
+{
+  __m512 m = _mm512_getmant_ps(x, _MM_MANT_NORM_p5_1, _MM_MANT_SIGN_src);
+  __m512 fe = _mm512_add_ps(_mm512_getexp_ps(x), _mm512_set1_ps(1.0f));
+  __mmask16 below = _mm512_cmp_ps_mask(m, _mm512_set1_ps(SQRT_HALF), _CMP_LT_OQ);
+  fe = _mm512_mask_sub_ps(fe, below, fe, _mm512_set1_ps(1.0f));
+  m = _mm512_mask_add_ps(
+      _mm512_sub_ps(m, _mm512_set1_ps(1.0f)),
+      below,
+      _mm512_sub_ps(m, _mm512_set1_ps(1.0f)),
+      m);
+  __m512 z = _mm512_mul_ps(m, m);
+  __m512 y = _mm512_set1_ps(LOG_P[0]);
+  for (int i = 1; i < 9; i++) {
+    y = _mm512_fmadd_ps(y, m, _mm512_set1_ps(LOG_P[i]));
+  }
+  y = _mm512_mul_ps(_mm512_mul_ps(y, m), z);
+  y = _mm512_fmadd_ps(fe, _mm512_set1_ps(LN2_LO), y);
+  y = _mm512_fnmadd_ps(z, _mm512_set1_ps(0.5f), y);
+  return _mm512_fmadd_ps(fe, _mm512_set1_ps(LN2_HI), _mm512_add_ps(m, y));
+}
+
+FASTTEXT_TARGET("avx512f")
+int64_t nearestAVX512(
+    const real* ct,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* distance)
+{
+  if (m < 16) {
+    return nearestSSE(ct, m, n, x, distance);
+  }
+  // the tail is read with masked loads, as in nearestAVX2
+  const __m512i step = _mm512_set1_epi32(16);
+  __m512 best = _mm512_set1_ps(INFINITY);
+  __m512i bestIndex = _mm512_setzero_si512();
+  __m512i index = _mm512_setr_epi32(
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  for (int64_t r = 0; r < m; r += 16) {
+    const __mmask16 valid = r + 16 <= m ? __mmask16(0xFFFF) : tailMask(m - r);
+    __m512 d = _mm512_setzero_ps();
+    for (int64_t j = 0; j < n; j++) {
+      __m512 t = _mm512_sub_ps(
+          _mm512_set1_ps(x[j]), _mm512_maskz_loadu_ps(valid, ct + j * m + r));
+      d = _mm512_fmadd_ps(t, t, d);
+    }
+    __mmask16 closer = _mm512_mask_cmp_ps_mask(valid, d, best, _CMP_LT_OQ);
+    best = _mm512_mask_blend_ps(closer, best, d);
+    bestIndex = _mm512_mask_blend_epi32(closer, bestIndex, index);
+    index = _mm512_add_epi32(index, step);
+  }
+  alignas(64) real laneDistances[16];
+  alignas(64) int32_t laneIndices[16];
+  _mm512_store_ps(laneDistances, best);
+  _mm512_store_si512(laneIndices, bestIndex);
+  return nearestFinish(
+      ct, m, n, x, distance, m, 16, laneDistances, laneIndices);
+}
+
+FASTTEXT_TARGET("avx512f")
+inline __m512 loadInt8x16(const int8_t* a)
+{
+  return _mm512_cvtepi32_ps(
+      _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)a)));
+}
+
+FASTTEXT_TARGET("avx512f")
+real dotInt8AVX512(const int8_t* a, const real* x, int64_t n)
+{
+  __m512 s0 = _mm512_setzero_ps();
+  __m512 s1 = _mm512_setzero_ps();
+  int64_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    s0 = _mm512_fmadd_ps(loadInt8x16(a + i), _mm512_loadu_ps(x + i), s0);
+    s1 = _mm512_fmadd_ps(
+        loadInt8x16(a + i + 16), _mm512_loadu_ps(x + i + 16), s1);
+  }
+  if (i + 16 <= n) {
+    s0 = _mm512_fmadd_ps(loadInt8x16(a + i), _mm512_loadu_ps(x + i), s0);
+    i += 16;
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1)) +
+      dotInt8Scalar(a + i, x + i, n - i);
+}
+
+FASTTEXT_TARGET("avx512f")
+void axpyInt8AVX512(real alpha, const int8_t* a, real* y, int64_t n)
+{
+  const __m512 va = _mm512_set1_ps(alpha);
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(
+        y + i,
+        _mm512_fmadd_ps(va, loadInt8x16(a + i), _mm512_loadu_ps(y + i)));
+  }
+  axpyInt8Scalar(alpha, a + i, y + i, n - i);
+}
+
+// vpdpbusd multiplies unsigned by signed bytes and adds groups of four
+// products to 32-bit sums, as maddubs and madd do in gemvInt8AVX2. The
+// byte instructions around it need AVX512BW.
+FASTTEXT_TARGET("avx512f,avx512bw,avx512vnni")
+void gemvInt8VNNI(
+    const int8_t* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    const int8_t* x,
+    int32_t* y)
+{
+  const __m512i zero = _mm512_setzero_si512();
+  const __mmask64 tail = n % 64 ? (__mmask64(1) << (n % 64)) - 1 : 0;
+  for (int64_t r = 0; r < m; r++) {
+    const int8_t* ar = rowOf(a, rows, r, n);
+    __m512i s = zero;
+    int64_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+      __m512i va = _mm512_loadu_si512(ar + i);
+      __m512i vx = _mm512_loadu_si512(x + i);
+      vx = _mm512_mask_sub_epi8(vx, _mm512_movepi8_mask(va), zero, vx);
+      s = _mm512_dpbusd_epi32(s, _mm512_abs_epi8(va), vx);
+    }
+    if (tail) {
+      __m512i va = _mm512_maskz_loadu_epi8(tail, ar + i);
+      __m512i vx = _mm512_maskz_loadu_epi8(tail, x + i);
+      vx = _mm512_mask_sub_epi8(vx, _mm512_movepi8_mask(va), zero, vx);
+      s = _mm512_dpbusd_epi32(s, _mm512_abs_epi8(va), vx);
+    }
+    y[r] = _mm512_reduce_add_epi32(s);
+  }
+}
+
+FASTTEXT_TARGET("avx512f")
+real maxValueAVX512(const real* x, int64_t n)
+{
+  if (n < 16) {
+    return maxValueSSE(x, n);
+  }
+  __m512 v = _mm512_loadu_ps(x);
+  int64_t i = 16;
+  for (; i + 16 <= n; i += 16) {
+    v = _mm512_max_ps(v, _mm512_loadu_ps(x + i));
+  }
+  if (i < n) {
+    // the tail overlaps values already seen
+    v = _mm512_max_ps(v, _mm512_loadu_ps(x + n - 16));
+  }
+  return _mm512_reduce_max_ps(v);
+}
+
+FASTTEXT_TARGET("avx512f")
+real expSumAVX512(real shift, real* x, int64_t n)
+{
+  const __m512 vs = _mm512_set1_ps(shift);
+  __m512 s = _mm512_setzero_ps();
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 v = exp16(_mm512_sub_ps(_mm512_loadu_ps(x + i), vs));
+    _mm512_storeu_ps(x + i, v);
+    s = _mm512_add_ps(s, v);
+  }
+  if (i < n) {
+    __mmask16 m = tailMask(n - i);
+    __m512 v = exp16(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, x + i), vs));
+    _mm512_mask_storeu_ps(x + i, m, v);
+    s = _mm512_mask_add_ps(s, m, s, v);
+  }
+  return _mm512_reduce_add_ps(s);
+}
+
+FASTTEXT_TARGET("avx512f")
+void logAVX512(real offset, real* x, int64_t n)
+{
+  const __m512 vo = _mm512_set1_ps(offset);
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(x + i, log16(_mm512_add_ps(_mm512_loadu_ps(x + i), vo)));
+  }
+  if (i < n) {
+    __mmask16 m = tailMask(n - i);
+    // masked-out lanes compute log(1)
+    __m512 v = _mm512_mask_loadu_ps(_mm512_set1_ps(1.0f - offset), m, x + i);
+    _mm512_mask_storeu_ps(x + i, m, log16(_mm512_add_ps(v, vo)));
+  }
+}
+
+FASTTEXT_TARGET("avx512f")
+void sigmoidAVX512(real* x, int64_t n)
+{
+  const __m512 one = _mm512_set1_ps(1.0f);
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 e = exp16(_mm512_sub_ps(_mm512_setzero_ps(), _mm512_loadu_ps(x + i)));
+    _mm512_storeu_ps(x + i, _mm512_div_ps(one, _mm512_add_ps(one, e)));
+  }
+  if (i < n) {
+    __mmask16 m = tailMask(n - i);
+    __m512 e = exp16(
+        _mm512_sub_ps(_mm512_setzero_ps(), _mm512_maskz_loadu_ps(m, x + i)));
+    _mm512_mask_storeu_ps(x + i, m, _mm512_div_ps(one, _mm512_add_ps(one, e)));
+  }
+}
+
+#endif // FASTTEXT_KERNELS_X86
+
+Level detect()
+{
+#ifdef FASTTEXT_KERNELS_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 0);
+  int maxLeaf = info[0];
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool fma = (info[2] & (1 << 12)) != 0;
+  if (!osxsave || maxLeaf < 7) {
+    return SSE;
+  }
+  // the OS must save the AVX (and AVX-512) registers on context switches
+  unsigned long long xcr0 = _xgetbv(0);
+  if ((xcr0 & 0x6) != 0x6) {
+    return SSE;
+  }
+  __cpuidex(info, 7, 0);
+  bool avx2 = (info[1] & (1 << 5)) != 0;
+  bool avx512f = (info[1] & (1 << 16)) != 0;
+  if (avx512f && (xcr0 & 0xe6) == 0xe6) {
+    return AVX512;
+  }
+  return avx2 && fma ? AVX2 : SSE;
+#else
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return AVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return AVX2;
+  }
+  return SSE;
+#endif
+#else
+  return SCALAR;
+#endif
+}
+
+// Whether the CPU has AVX512-VNNI, and AVX512BW, which gemvInt8VNNI also
+// needs; asked once the AVX-512 level is detected.
+bool detectVnni()
+{
+#ifdef FASTTEXT_KERNELS_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 30)) != 0 && (info[2] & (1 << 11)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vnni");
+#endif
+#else
+  return false;
+#endif
+}
+
+struct Kernels {
+  real (*dot)(const real*, const real*, int64_t);
+  real (*squaredNorm)(const real*, int64_t);
+  void (*add)(const real*, real*, int64_t);
+  void (*axpy)(real, const real*, real*, int64_t);
+  void (*scale)(real, real*, int64_t);
+  void (*gemv)(
+      const real*, const int32_t*, int64_t, int64_t, const real*, real*);
+  void (*updateRows)(
+      const real*, const real*, real*, const int32_t*, int64_t, int64_t,
+      real*);
+  real (*maxValue)(const real*, int64_t);
+  int64_t (*nearest)(const real*, int64_t, int64_t, const real*, real*);
+  void (*scan4)(
+      const uint8_t*, int64_t, int64_t, const uint8_t*, uint16_t*);
+  real (*dotInt8)(const int8_t*, const real*, int64_t);
+  void (*axpyInt8)(real, const int8_t*, real*, int64_t);
+  void (*gemvInt8)(
+      const int8_t*, const int32_t*, int64_t, int64_t, const int8_t*,
+      int32_t*);
+  real (*expSum)(real, real*, int64_t);
+  void (*log)(real, real*, int64_t);
+  void (*sigmoid)(real*, int64_t);
+  bool (*allFinite)(const real*, int64_t);
+  const char* name;
+};
+
+Kernels select()
+{
+  Level level = detect();
+  const char* requested = std::getenv("FASTTEXT_ISA");
+  if (requested) {
+    for (int l = SCALAR; l < level; l++) {
+      if (std::strcmp(requested, LEVEL_NAMES[l]) == 0) {
+        level = Level(l);
+      }
+    }
+  }
+  switch (level) {
+#ifdef FASTTEXT_KERNELS_X86
+    case AVX512:
+      return {dotAVX512,
+              squaredNormAVX512,
+              addAVX512,
+              axpyAVX512,
+              scaleAVX512,
+              gemvAVX512,
+              updateRowsAVX512,
+              maxValueAVX512,
+              nearestAVX512,
+              scan4AVX2,
+              dotInt8AVX512,
+              axpyInt8AVX512,
+              detectVnni() ? gemvInt8VNNI : gemvInt8AVX2,
+              expSumAVX512,
+              logAVX512,
+              sigmoidAVX512,
+              allFiniteAVX512,
+              LEVEL_NAMES[level]};
+    case AVX2:
+      return {dotAVX2,
+              squaredNormAVX2,
+              addAVX2,
+              axpyAVX2,
+              scaleAVX2,
+              gemvAVX2,
+              updateRowsAVX2,
+              maxValueAVX2,
+              nearestAVX2,
+              scan4AVX2,
+              dotInt8AVX2,
+              axpyInt8AVX2,
+              gemvInt8AVX2,
+              expSumAVX2,
+              logAVX2,
+              sigmoidAVX2,
+              allFiniteAVX2,
+              LEVEL_NAMES[level]};
+    case SSE:
+      return {dotSSE,
+              squaredNormSSE,
+              addSSE,
+              axpySSE,
+              scaleSSE,
+              gemvSSE,
+              updateRowsSSE,
+              maxValueSSE,
+              nearestSSE,
+              scan4Scalar,
+              dotInt8SSE,
+              axpyInt8SSE,
+              gemvInt8SSE,
+              expSumSSE,
+              logSSE,
+              sigmoidSSE,
+              allFiniteSSE,
+              LEVEL_NAMES[level]};
+#endif
+    default:
+      return {dotScalar,
+              squaredNormScalar,
+              addScalar,
+              axpyScalar,
+              scaleScalar,
+              gemvScalar,
+              updateRowsScalar,
+              maxValueScalar,
+              nearestScalar,
+              scan4Scalar,
+              dotInt8Scalar,
+              axpyInt8Scalar,
+              gemvInt8Scalar,
+              expSumScalar,
+              logScalar,
+              sigmoidScalar,
+              allFiniteScalar,
+              LEVEL_NAMES[SCALAR]};
+  }
+}
+
+const Kernels selected = select();
+
+} // namespace
+
+real dot(const real* x, const real* y, int64_t n)
+{
+  return selected.dot(x, y, n);
+}
+
+real squaredNorm(const real* x, int64_t n)
+{
+  return selected.squaredNorm(x, n);
+}
+
+void add(const real* x, real* y, int64_t n)
+{
+  selected.add(x, y, n);
+}
+
+void axpy(real a, const real* x, real* y, int64_t n)
+{
+  selected.axpy(a, x, y, n);
+}
+
+void scale(real a, real* x, int64_t n)
+{
+  selected.scale(a, x, n);
+}
+
+void gemv(
+    const real* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* y)
+{
+  selected.gemv(a, rows, m, n, x, y);
+}
+
+void gemm(
+    const real* a,
+    int64_t m,
+    const real* b,
+    int64_t p,
+    int64_t n,
+    real* c)
+{
+  // 32KB of rows per block
+  const int64_t block = std::max<int64_t>(
+      4, int64_t(32 * 1024 / sizeof(real)) / std::max<int64_t>(n, 1));
+  for (int64_t r = 0; r < m; r += block) {
+    const int64_t rows = std::min(block, m - r);
+    for (int64_t i = 0; i < p; i++) {
+      selected.gemv(a + r * n, nullptr, rows, n, b + i * n, c + i * m + r);
+    }
+  }
+}
+
+void updateRows(
+    const real* alpha,
+    const real* x,
+    real* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    real* g)
+{
+  selected.updateRows(alpha, x, a, rows, m, n, g);
+}
+
+real maxValue(const real* x, int64_t n)
+{
+  return selected.maxValue(x, n);
+}
+
+int64_t nearest(
+    const real* ct,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* distance)
+{
+  return selected.nearest(ct, m, n, x, distance);
+}
+
+void scan4(
+    const uint8_t* codes,
+    int64_t blocks,
+    int64_t nt,
+    const uint8_t* lut,
+    uint16_t* out)
+{
+  selected.scan4(codes, blocks, nt, lut, out);
+}
+
+real dotInt8(const int8_t* a, const real* x, int64_t n)
+{
+  return selected.dotInt8(a, x, n);
+}
+
+void axpyInt8(real alpha, const int8_t* a, real* y, int64_t n)
+{
+  selected.axpyInt8(alpha, a, y, n);
+}
+
+void gemvInt8(
+    const int8_t* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    const int8_t* x,
+    int32_t* y)
+{
+  selected.gemvInt8(a, rows, m, n, x, y);
+}
+
+real expSum(real shift, real* x, int64_t n)
+{
+  return selected.expSum(shift, x, n);
+}
+
+void log(real offset, real* x, int64_t n)
+{
+  selected.log(offset, x, n);
+}
+
+void sigmoid(real* x, int64_t n)
+{
+  selected.sigmoid(x, n);
+}
+
+bool allFinite(const real* x, int64_t n)
+{
+  return selected.allFinite(x, n);
+}
+
+const char* isa()
+{
+  return selected.name;
+}
+
+} // namespace kernels
+
+} // namespace fasttext
@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "real.h"
+
+namespace fasttext {
+
+// Loops over dense rows and vectors used by DenseMatrix and Vector. Each
+// kernel has scalar, SSE, AVX2 and AVX-512 versions; the widest one the CPU
+// supports is picked once at startup, so the same binary runs on any x86-64
+// host. The FASTTEXT_ISA environment variable (scalar, sse, avx2, avx512)
+// can lower the choice, e.g. to compare results across versions.
+namespace kernels {
+
+// Returns sum x[i] * y[i].
+real dot(const real* x, const real* y, int64_t n);
+// Returns sum x[i] * x[i].
+real squaredNorm(const real* x, int64_t n);
+// y[i] += x[i]
+void add(const real* x, real* y, int64_t n);
+// y[i] += a * x[i]
+void axpy(real a, const real* x, real* y, int64_t n);
+// x[i] *= a
+void scale(real a, real* x, int64_t n);
+// y[i] = dot(a_i, x) for m rows a_i of the row-major matrix a with rows of
+// n values: rows 0 to m - 1, or rows[0] to rows[m - 1] if rows is set.
+// Rows are processed in blocks that share each load of x.
+void gemv(
+    const real* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* y);
+// c[i * m + r] = dot(a_r, b_i) for the m rows a_r of a and the p rows b_i
+// of b, all of n values. a is taken in blocks of rows that stay in the L1
+// cache while every row of b is multiplied with them.
+void gemm(
+    const real* a,
+    int64_t m,
+    const real* b,
+    int64_t p,
+    int64_t n,
+    real* c);
+// For m rows a_i of a, chosen as in gemv and in order, g += alpha[i] * a_i
+// and then a_i += alpha[i] * x, reading and writing each row once.
+void updateRows(
+    const real* alpha,
+    const real* x,
+    real* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    real* g);
+// Returns the largest x[i], for n > 0.
+real maxValue(const real* x, int64_t n);
+// Returns the nearest to x, in L2 distance, of the m points of n values
+// stored by coordinate in ct: value j of point r is ct[j * m + r]. The
+// first one wins ties; *distance gets its squared distance. For m > 0.
+int64_t nearest(
+    const real* ct,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    real* distance);
+// Sums table entries for blocks of 32 rows of 4-bit codes, one code per
+// table: out[b * 32 + i] = sum over t of lut[t * 16 + code of row i for
+// table t], for the nt 16-byte tables of lut. The codes of block b for
+// table t are the 16 bytes at codes + (b * nt + t) * 16; byte i holds row i
+// in its low and row i + 16 in its high four bits. nt is even and the sums
+// fit 16 bits. The AVX2 version looks the codes up 64 at a time with byte
+// shuffles; the AVX-512 level uses it too, as AVX-512F has no byte shuffle,
+// and the SSE level uses the scalar loop.
+void scan4(
+    const uint8_t* codes,
+    int64_t blocks,
+    int64_t nt,
+    const uint8_t* lut,
+    uint16_t* out);
+// Kernels of int8 rows, whose values are in [-127, 127].
+// Returns sum a[i] * x[i].
+real dotInt8(const int8_t* a, const real* x, int64_t n);
+// y[i] += alpha * a[i]
+void axpyInt8(real alpha, const int8_t* a, real* y, int64_t n);
+// y[i] = dot(a_i, x) in integers, for m int8 rows a_i of a chosen as in
+// gemv. The AVX-512 version uses VNNI where the CPU has it, and the AVX2
+// one otherwise.
+void gemvInt8(
+    const int8_t* a,
+    const int32_t* rows,
+    int64_t m,
+    int64_t n,
+    const int8_t* x,
+    int32_t* y);
+// expSum, log and sigmoid compute exp and log with polynomials in their
+// SIMD versions, to a relative error of a few 1e-7.
+// x[i] = exp(x[i] - shift); returns the sum of the new x[i].
+real expSum(real shift, real* x, int64_t n);
+// x[i] = log(x[i] + offset), for positive normal x[i] + offset.
+void log(real offset, real* x, int64_t n);
+// x[i] = 1 / (1 + exp(-x[i]))
+void sigmoid(real* x, int64_t n);
+// Whether no x[i] is NaN or infinite.
+bool allFinite(const real* x, int64_t n);
+
+// Name of the selected version.
+const char* isa();
+
+} // namespace kernels
+
+} // namespace fasttext
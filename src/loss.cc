@@ -7,6 +7,7 @@
  */
 
 #include "loss.h"
+#include "kernels.h"
 #include "utils.h"
 
 #include <cmath>
@@ -43,9 +44,11 @@ Loss::Loss(std::shared_ptr<Matrix>& wo)
   }
 }
 
+// NaN arguments take the first branch of log and sigmoid, rather than
+// indexing the tables with garbage; Model::update then reports them.
 real Loss::log(real x) const
 {
-  if (x > 1.0) {
+  if (!(x <= 1.0)) {
     return 0.0;
   }
   int64_t i = int64_t(x * LOG_TABLE_SIZE);
@@ -54,7 +57,7 @@ real Loss::log(real x) const
 
 real Loss::sigmoid(real x) const
 {
-  if (x < -MAX_SIGMOID) {
+  if (!(x >= -MAX_SIGMOID)) {
     return 0.0;
   } else if (x > MAX_SIGMOID) {
     return 1.0;
@@ -76,22 +79,39 @@ void Loss::predict(
   std::sort_heap(heap.begin(), heap.end(), comparePairs);
 }
 
+void Loss::predict(
+    int32_t k,
+    real threshold,
+    const std::vector<Vector>& hiddens,
+    std::vector<Predictions>& heaps,
+    Model::State& state) const
+{
+  assert(heaps.size() == hiddens.size());
+  for (size_t i = 0; i < hiddens.size(); i++) {
+    state.hidden = hiddens[i];
+    predict(k, threshold, heaps[i], state);
+  }
+}
+
 void Loss::findKBest(
     int32_t k,
     real threshold,
     Predictions& heap,
-    const Vector& output) const
+    Vector& output) const
 {
+  // std_log of all the probabilities at once
+  kernels::log(1e-5, output.data(), output.size());
+  const real minScore = std_log(threshold);
   for (int32_t i = 0; i < output.size(); i++)
   {
-    if (output[i] < threshold)
+    if (output[i] < minScore)
     {
       continue;
     }
-    if (heap.size() == k && std_log(output[i]) < heap.front().first) {
+    if (heap.size() == k && output[i] < heap.front().first) {
       continue;
     }
-    heap.push_back(std::make_pair(std_log(output[i]), i));
+    heap.push_back(std::make_pair(output[i], i));
     std::push_heap(heap.begin(), heap.end(), comparePairs);
     if (heap.size() > k) {
       std::pop_heap(heap.begin(), heap.end(), comparePairs);
@@ -128,10 +148,7 @@ void BinaryLogisticLoss::computeOutput(Model::State& state) const
 {
   Vector& output = state.output;
   output.mul(*wo_, state.hidden);
-  int32_t osz = output.size();
-  for (int32_t i = 0; i < osz; i++) {
-    output[i] = sigmoid(output[i]);
-  }
+  kernels::sigmoid(output.data(), output.size());
 }
 
 OneVsAllLoss::OneVsAllLoss(std::shared_ptr<Matrix>& wo)
@@ -161,21 +178,56 @@ NegativeSamplingLoss::NegativeSamplingLoss(
     const std::vector<int64_t>& targetCounts)
     : BinaryLogisticLoss(wo),
       neg_(neg),
-      negatives_(),
-      uniform_()
+      buckets_()
+{
+  buildAliasTable(targetCounts);
+}
+
+// Vose's alias method: targets are drawn with probability proportional to
+// the square root of their counts, in O(1) and from a table of one bucket
+// per target.
+void NegativeSamplingLoss::buildAliasTable(
+    const std::vector<int64_t>& targetCounts)
 {
-  real z = 0.0;
-  for (size_t i = 0; i < targetCounts.size(); i++) {
-    z += pow(targetCounts[i], 0.5);
+  const int64_t n = targetCounts.size();
+  std::vector<double> weights(n);
+  double z = 0.0;
+  for (int64_t i = 0; i < n; i++) {
+    weights[i] = std::pow(targetCounts[i], 0.5);
+    z += weights[i];
+  }
+  std::vector<int32_t> small, large;
+  for (int64_t i = 0; i < n; i++) {
+    // mean weight 1
+    weights[i] *= n / z;
+    if (weights[i] < 1.0) {
+      small.push_back(i);
+    } else {
+      large.push_back(i);
+    }
   }
-  for (size_t i = 0; i < targetCounts.size(); i++) {
-    real c = pow(targetCounts[i], 0.5);
-    for (size_t j = 0; j < c * NegativeSamplingLoss::NEGATIVE_TABLE_SIZE / z;
-         j++) {
-      negatives_.push_back(i);
+  buckets_.resize(n);
+  while (!small.empty() && !large.empty()) {
+    int32_t s = small.back();
+    int32_t l = large.back();
+    small.pop_back();
+    buckets_[s].prob = uint32_t(weights[s] * 4294967296.0);
+    buckets_[s].alias = l;
+    weights[l] -= 1.0 - weights[s];
+    if (weights[l] < 1.0) {
+      large.pop_back();
+      small.push_back(l);
     }
   }
-  uniform_ = std::uniform_int_distribution<size_t>(0, negatives_.size() - 1);
+  // Whatever is left has a weight of 1 up to rounding: the bucket is full.
+  for (int32_t i : small) {
+    buckets_[i].prob = UINT32_MAX;
+    buckets_[i].alias = i;
+  }
+  for (int32_t i : large) {
+    buckets_[i].prob = UINT32_MAX;
+    buckets_[i].alias = i;
+  }
 }
 
 real NegativeSamplingLoss::forward(
@@ -188,33 +240,64 @@ real NegativeSamplingLoss::forward(
   assert(targetIndex >= 0);
   assert(targetIndex < targets.size());
   int32_t target = targets[targetIndex];
-  real loss = binaryLogistic(target, state, true, lr, backprop);
 
-  for (int32_t n = 0; n < neg_; n++)
-  {
-    auto negativeTarget = getNegative(target, state.rng);
-    loss += binaryLogistic(negativeTarget, state, false, lr, backprop);
+  // The target and its negatives are scored together, then updated
+  // together, rather than by neg_ + 1 calls to binaryLogistic. A negative
+  // drawn twice is thus scored twice before its first update.
+  std::vector<int32_t>& rows = state.rows;
+  std::vector<real>& scores = state.scores;
+  rows.resize(neg_ + 1);
+  scores.resize(neg_ + 1);
+  rows[0] = target;
+  getNegatives(target, state.fastRng, rows.data() + 1);
+  wo_->dotRows(state.hidden, rows.data(), neg_ + 1, scores.data());
+
+  real loss = 0.0;
+  for (int32_t k = 0; k <= neg_; k++) {
+    real score = sigmoid(scores[k]);
+    real label = (k == 0) ? 1.0 : 0.0;
+    loss -= (k == 0) ? log(score) : log(1.0 - score);
+    scores[k] = lr * (label - score);
+  }
+  if (backprop) {
+    wo_->addVectorToRows(
+        state.hidden, rows.data(), scores.data(), neg_ + 1, state.grad);
   }
   return loss;
 }
 
 int32_t NegativeSamplingLoss::getNegative(
     int32_t target,
-    std::minstd_rand& rng)
+    utils::FastRandom& rng) const
 {
+  const uint64_t n = buckets_.size();
   int32_t negative;
   do {
-    negative = negatives_[uniform_(rng)];
+    uint64_t r = rng();
+    // high half picks the bucket, low half is the coin
+    const AliasBucket& b = buckets_[((r >> 32) * n) >> 32];
+    negative = uint32_t(r) < b.prob ? int32_t(&b - buckets_.data()) : b.alias;
   } while (target == negative);
   return negative;
 }
 
+void NegativeSamplingLoss::getNegatives(
+    int32_t target,
+    utils::FastRandom& rng,
+    int32_t* negatives) const
+{
+  for (int32_t n = 0; n < neg_; n++) {
+    negatives[n] = getNegative(target, rng);
+  }
+}
+
 HierarchicalSoftmaxLoss::HierarchicalSoftmaxLoss(
     std::shared_ptr<Matrix>& wo,
     const std::vector<int64_t>& targetCounts)
     : BinaryLogisticLoss(wo),
-      paths_(),
-      codes_(),
+      pathOffsets_(),
+      pathNodes_(),
+      pathCodes_(),
       tree_(),
       osz_(targetCounts.size())
 {
@@ -252,17 +335,24 @@ void HierarchicalSoftmaxLoss::buildTree(const std::vector<int64_t>& counts)
     tree_[mini[1]].parent = i;
     tree_[mini[1]].binary = true;
   }
+  pathOffsets_.resize(osz_ + 1);
+  pathOffsets_[0] = 0;
   for (int32_t i = 0; i < osz_; i++) {
-    std::vector<int32_t> path;
-    std::vector<bool> code;
-    int32_t j = i;
-    while (tree_[j].parent != -1) {
-      path.push_back(tree_[j].parent - osz_);
-      code.push_back(tree_[j].binary);
-      j = tree_[j].parent;
+    int64_t length = 0;
+    for (int32_t j = i; tree_[j].parent != -1; j = tree_[j].parent) {
+      length++;
+    }
+    pathOffsets_[i + 1] = pathOffsets_[i] + length;
+  }
+  pathNodes_.resize(pathOffsets_[osz_]);
+  pathCodes_.resize(pathOffsets_[osz_]);
+  for (int32_t i = 0; i < osz_; i++) {
+    int64_t k = pathOffsets_[i];
+    for (int32_t j = i; tree_[j].parent != -1; j = tree_[j].parent) {
+      pathNodes_[k] = tree_[j].parent - osz_;
+      pathCodes_[k] = tree_[j].binary;
+      k++;
     }
-    paths_.push_back(path);
-    codes_.push_back(code);
   }
 }
 
@@ -273,12 +363,28 @@ real HierarchicalSoftmaxLoss::forward(
     real lr,
     bool backprop)
 {
-  real loss = 0.0;
   int32_t target = targets[targetIndex];
-  const std::vector<bool>& binaryCode = codes_[target];
-  const std::vector<int32_t>& pathToRoot = paths_[target];
-  for (int32_t i = 0; i < pathToRoot.size(); i++) {
-    loss += binaryLogistic(pathToRoot[i], state, binaryCode[i], lr, backprop);
+  const int64_t begin = pathOffsets_[target];
+  const int32_t length = pathOffsets_[target + 1] - begin;
+  const int32_t* pathToRoot = pathNodes_.data() + begin;
+  const uint8_t* binaryCode = pathCodes_.data() + begin;
+
+  // All the nodes of the path are scored, then updated, in one batch, as in
+  // NegativeSamplingLoss::forward.
+  std::vector<real>& scores = state.scores;
+  scores.resize(length);
+  wo_->dotRows(state.hidden, pathToRoot, length, scores.data());
+
+  real loss = 0.0;
+  for (int32_t i = 0; i < length; i++) {
+    real score = sigmoid(scores[i]);
+    real label = binaryCode[i] ? 1.0 : 0.0;
+    loss -= binaryCode[i] ? log(score) : log(1.0 - score);
+    scores[i] = lr * (label - score);
+  }
+  if (backprop) {
+    wo_->addVectorToRows(
+        state.hidden, pathToRoot, scores.data(), length, state.grad);
   }
   return loss;
 }
@@ -289,40 +395,103 @@ void HierarchicalSoftmaxLoss::predict(
     Predictions& heap,
     Model::State& state) const
 {
-  dfs(k, threshold, 2 * osz_ - 2, 0.0, heap, state.hidden);
-  std::sort_heap(heap.begin(), heap.end(), comparePairs);
+  search(k, threshold, &state.hidden, 1, &heap);
 }
 
-void HierarchicalSoftmaxLoss::dfs(
+void HierarchicalSoftmaxLoss::predict(
     int32_t k,
     real threshold,
-    int32_t node,
-    real score,
-    Predictions& heap,
-    const Vector& hidden) const
+    const std::vector<Vector>& hiddens,
+    std::vector<Predictions>& heaps,
+    Model::State& /*state*/) const
 {
-  if (score < std_log(threshold)) {
-    return;
-  }
-  if (heap.size() == k && score < heap.front().first) {
-    return;
-  }
+  assert(heaps.size() == hiddens.size());
+  search(k, threshold, hiddens.data(), hiddens.size(), heaps.data());
+}
 
-  if (tree_[node].left == -1 && tree_[node].right == -1) {
-    heap.push_back(std::make_pair(score, node));
-    std::push_heap(heap.begin(), heap.end(), comparePairs);
-    if (heap.size() > k) {
-      std::pop_heap(heap.begin(), heap.end(), comparePairs);
-      heap.pop_back();
+// Best-first search of the k best leaves for each hidden vector. A node's
+// score, the log-probability of reaching it, bounds the scores of all the
+// leaves below it, so nodes scoring under the k-th best leaf found so far
+// are pruned as in a depth-first search. The hidden vectors advance
+// together, round by round; each round expands up to SEARCH_BLOCK of the
+// best nodes of each one with a single Matrix::dotRows call, and the rows of
+// the top of the tree stay in cache from one hidden vector to the next.
+void HierarchicalSoftmaxLoss::search(
+    int32_t k,
+    real threshold,
+    const Vector* hiddens,
+    int64_t count,
+    Predictions* heaps) const
+{
+  const real minScore = std_log(threshold);
+  // max-heaps of the nodes left to expand
+  std::vector<Predictions> frontiers(count);
+  for (int64_t b = 0; b < count; b++) {
+    frontiers[b].push_back(std::make_pair(real(0.0), 2 * osz_ - 2));
+  }
+  std::vector<std::pair<real, int32_t>> expanded;
+  std::vector<int32_t> rows;
+  std::vector<real> scores;
+  bool active = true;
+  while (active) {
+    active = false;
+    for (int64_t b = 0; b < count; b++) {
+      Predictions& frontier = frontiers[b];
+      Predictions& heap = heaps[b];
+      auto pruned = [&](real score) {
+        return score < minScore ||
+            (heap.size() == k && score < heap.front().first);
+      };
+
+      expanded.clear();
+      rows.clear();
+      while (!frontier.empty() && expanded.size() < SEARCH_BLOCK) {
+        std::pop_heap(frontier.begin(), frontier.end());
+        std::pair<real, int32_t> node = frontier.back();
+        frontier.pop_back();
+        if (pruned(node.first)) {
+          // the other nodes score no better
+          frontier.clear();
+          break;
+        }
+        if (node.second < osz_) {
+          heap.push_back(node);
+          std::push_heap(heap.begin(), heap.end(), comparePairs);
+          if (heap.size() > k) {
+            std::pop_heap(heap.begin(), heap.end(), comparePairs);
+            heap.pop_back();
+          }
+        } else {
+          expanded.push_back(node);
+          rows.push_back(node.second - osz_);
+        }
+      }
+      if (expanded.empty()) {
+        continue;
+      }
+      active = true;
+
+      scores.resize(rows.size());
+      wo_->dotRows(hiddens[b], rows.data(), rows.size(), scores.data());
+      for (size_t i = 0; i < expanded.size(); i++) {
+        const Node& node = tree_[expanded[i].second];
+        real f = 1. / (1 + std::exp(-scores[i]));
+        real left = expanded[i].first + std_log(1.0 - f);
+        real right = expanded[i].first + std_log(f);
+        if (!pruned(left)) {
+          frontier.push_back(std::make_pair(left, node.left));
+          std::push_heap(frontier.begin(), frontier.end());
+        }
+        if (!pruned(right)) {
+          frontier.push_back(std::make_pair(right, node.right));
+          std::push_heap(frontier.begin(), frontier.end());
+        }
+      }
     }
-    return;
   }
-
-  real f = wo_->dotRow(hidden, node - osz_);
-  f = 1. / (1 + std::exp(-f));
-
-  dfs(k, threshold, tree_[node].left, score + std_log(1.0 - f), heap, hidden);
-  dfs(k, threshold, tree_[node].right, score + std_log(f), heap, hidden);
+  for (int64_t b = 0; b < count; b++) {
+    std::sort_heap(heaps[b].begin(), heaps[b].end(), comparePairs);
+  }
 }
 
 SoftmaxLoss::SoftmaxLoss(std::shared_ptr<Matrix>& wo)
@@ -333,18 +502,9 @@ void SoftmaxLoss::computeOutput(Model::State& state) const
 {
   Vector& output = state.output;
   output.mul(*wo_, state.hidden);
-  real max = output[0], z = 0.0;
-  int32_t osz = output.size();
-  for (int32_t i = 0; i < osz; i++) {
-    max = std::max(output[i], max);
-  }
-  for (int32_t i = 0; i < osz; i++) {
-    output[i] = exp(output[i] - max);
-    z += output[i];
-  }
-  for (int32_t i = 0; i < osz; i++) {
-    output[i] /= z;
-  }
+  real max = kernels::maxValue(output.data(), output.size());
+  real z = kernels::expSum(max, output.data(), output.size());
+  output.mul(1.0 / z);
 }
 
 real SoftmaxLoss::forward(
@@ -360,16 +520,19 @@ real SoftmaxLoss::forward(
   assert(targetIndex < targets.size());
   int32_t target = targets[targetIndex];
 
+  real loss = -log(state.output[target]);
   if (backprop) {
-    int32_t osz = wo_->size(0);
+    // The probabilities are turned into the update coefficients in place,
+    // so the output matrix is read once more for all the updates.
+    Vector& alpha = state.output;
+    int32_t osz = alpha.size();
     for (int32_t i = 0; i < osz; i++) {
       real label = (i == target) ? 1.0 : 0.0;
-      real alpha = lr * (label - state.output[i]);
-      state.grad.addRow(*wo_, i, alpha);
-      wo_->addVectorToRow(state.hidden, i, alpha);
+      alpha[i] = lr * (label - alpha[i]);
     }
+    wo_->addVectorToRows(state.hidden, alpha, state.grad);
   }
-  return -log(state.output[target]);
+  return loss;
 };
 
 } // namespace fasttext
@@ -22,11 +22,12 @@ namespace fasttext {
 
 class Loss {
  private:
+  // Replaces the probabilities in output by their logarithms.
   void findKBest(
       int32_t k,
       real threshold,
       Predictions& heap,
-      const Vector& output) const;
+      Vector& output) const;
 
  protected:
   std::vector<real> t_sigmoid_;
@@ -53,6 +54,14 @@ class Loss {
       real /*threshold*/,
       Predictions& /*heap*/,
       Model::State& /*state*/) const;
+  // Predictions for a batch of hidden vectors, heaps[i] for hiddens[i]. By
+  // default each one is predicted on its own through state.
+  virtual void predict(
+      int32_t k,
+      real threshold,
+      const std::vector<Vector>& hiddens,
+      std::vector<Predictions>& heaps,
+      Model::State& state) const;
 };
 
 class BinaryLogisticLoss : public Loss {
@@ -84,12 +93,24 @@ class OneVsAllLoss : public BinaryLogisticLoss {
 
 class NegativeSamplingLoss : public BinaryLogisticLoss {
  protected:
-  static const int32_t NEGATIVE_TABLE_SIZE = 10000000;
+  // Bucket of the alias table: a draw falling in bucket i picks i when its
+  // 32 bit coin is below prob, and alias otherwise.
+  struct AliasBucket {
+    uint32_t prob;
+    int32_t alias;
+  };
 
   int neg_;
-  std::vector<int32_t> negatives_;
-  std::uniform_int_distribution<size_t> uniform_;
-  int32_t getNegative(int32_t target, std::minstd_rand& rng);
+  // One bucket per target, read-only once built and thus shared by all the
+  // training threads.
+  std::vector<AliasBucket> buckets_;
+  void buildAliasTable(const std::vector<int64_t>& targetCounts);
+  int32_t getNegative(int32_t target, utils::FastRandom& rng) const;
+  // Draws neg_ negatives for target into negatives[0] to negatives[neg_ - 1].
+  void getNegatives(
+      int32_t target,
+      utils::FastRandom& rng,
+      int32_t* negatives) const;
 
  public:
   explicit NegativeSamplingLoss(
@@ -116,18 +137,24 @@ class HierarchicalSoftmaxLoss : public BinaryLogisticLoss {
     bool binary;
   };
 
-  std::vector<std::vector<int32_t>> paths_;
-  std::vector<std::vector<bool>> codes_;
+  // The path of leaf i from the leaf up to the root, as the output rows of
+  // its inner nodes in pathNodes_ and the side taken at each of them in
+  // pathCodes_, from pathOffsets_[i] to pathOffsets_[i + 1].
+  std::vector<int64_t> pathOffsets_;
+  std::vector<int32_t> pathNodes_;
+  std::vector<uint8_t> pathCodes_;
   std::vector<Node> tree_;
   int32_t osz_;
+  // Inner nodes expanded per hidden vector and round of the search.
+  static const int32_t SEARCH_BLOCK = 4;
+
   void buildTree(const std::vector<int64_t>& counts);
-  void dfs(
+  void search(
       int32_t k,
       real threshold,
-      int32_t node,
-      real score,
-      Predictions& heap,
-      const Vector& hidden) const;
+      const Vector* hiddens,
+      int64_t count,
+      Predictions* heaps) const;
 
  public:
   explicit HierarchicalSoftmaxLoss(
@@ -145,6 +172,12 @@ class HierarchicalSoftmaxLoss : public BinaryLogisticLoss {
       real threshold,
       Predictions& heap,
       Model::State& state) const override;
+  void predict(
+      int32_t k,
+      real threshold,
+      const std::vector<Vector>& hiddens,
+      std::vector<Predictions>& heaps,
+      Model::State& state) const override;
 };
 
 class SoftmaxLoss : public Loss {
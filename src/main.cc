@@ -6,16 +6,17 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <queue>
 #include <stdexcept>
-#include <codecvt>
-#include <locale>
+#include <thread>
 
 #include "args.h"
 #include "autotune.h"
 #include "fasttext.h"
+#include "server.h"
 #include "strutils.h"
 
 using namespace fasttext;
@@ -44,8 +45,13 @@ void printUsage()
       << "  print-ngrams            print ngrams given a trained model and "
          "word\n"
       << "  nn                      query for nearest neighbors\n"
+      << "  nn-index                build the nearest neighbor index of a "
+         "model\n"
+      << "  nn-batch                exact nearest neighbors of a file of "
+         "words\n"
       << "  analogies               query for analogies\n"
       << "  similarity              query similarity of word vs another word\n"
+      << "  serve                   answer queries on a Unix domain socket\n"
       << "  dump                    dump arguments, dictionary, input/output "
          "vectors\n"
       << std::endl;
@@ -70,11 +76,13 @@ void printTestUsage()
 void printPredictUsage()
 {
   std::cerr
-      << "usage: fasttext predict[-prob] <model> <test-data> [<k>] [<th>]\n\n"
+      << "usage: fasttext predict[-prob] <model> <test-data> [<k>] [<th>] "
+         "[<threads>]\n\n"
       << "  <model>      model filename\n"
       << "  <test-data>  test data filename (if -, read from stdin)\n"
       << "  <k>          (optional; 1 by default) predict top k labels\n"
       << "  <th>         (optional; 0.0 by default) probability threshold\n"
+      << "  <threads>    (optional; all cores by default) prediction threads\n"
       << std::endl;
 }
 
@@ -142,17 +150,44 @@ void quantize(const std::vector<std::string>& args)
 
 void printNNUsage()
 {
-  std::cout << "usage: fasttext nn <model> <k>\n\n"
+  std::cout << "usage: fasttext nn <model> <k> <ef>\n\n"
+            << "  <model>      model filename\n"
+            << "  <k>          (optional; 10 by default) predict top k labels\n"
+            << "  <ef>         (optional; 100 by default) candidates searched "
+               "in <model>.hnsw if it exists, 0 to scan all the words\n"
+            << std::endl;
+}
+
+void printNNIndexUsage()
+{
+  std::cout << "usage: fasttext nn-index <model> <M> <efConstruction>\n\n"
+            << "  <model>           model filename, the index is saved to "
+               "<model>.hnsw\n"
+            << "  <M>               (optional; " << HnswIndex::DEFAULT_M
+            << " by default) links per word\n"
+            << "  <efConstruction>  (optional; "
+            << HnswIndex::DEFAULT_EF_CONSTRUCTION
+            << " by default) candidates searched per link\n"
+            << std::endl;
+}
+
+void printNNBatchUsage()
+{
+  std::cout << "usage: fasttext nn-batch <model> <queries> <k> <threads>\n\n"
             << "  <model>      model filename\n"
+            << "  <queries>    file with the query words, use '-' for stdin\n"
             << "  <k>          (optional; 10 by default) predict top k labels\n"
+            << "  <threads>    (optional; all cores by default) threads\n"
             << std::endl;
 }
 
 void printAnalogiesUsage()
 {
-  std::cout << "usage: fasttext analogies <model> <k>\n\n"
+  std::cout << "usage: fasttext analogies <model> <k> <ef>\n\n"
             << "  <model>      model filename\n"
             << "  <k>          (optional; 10 by default) predict top k labels\n"
+            << "  <ef>         (optional; 100 by default) candidates searched "
+               "in <model>.hnsw if it exists, 0 to scan all the words\n"
             << std::endl;
 }
 
@@ -165,6 +200,22 @@ void printSimilarityUsage()
       << std::endl;
 }
 
+void printServeUsage()
+{
+  std::cout << "usage: fasttext serve <model> <socket> <threads>\n\n"
+            << "  <model>      model filename\n"
+            << "  <socket>     path of the Unix domain socket to listen on\n"
+            << "  <threads>    (optional; all cores by default) requests "
+               "answered at once\n\n"
+            << "Each request is a line, answered by a line:\n"
+            << "  predict <k> <th> <text>  labels and probabilities\n"
+            << "  word-vector <word>       word vector\n"
+            << "  sentence-vector <text>   sentence vector\n"
+            << "  nn <k> <word>            nearest neighbors, using "
+               "<model>.hnsw if it exists\n"
+            << std::endl;
+}
+
 void printDumpUsage()
 {
   std::cout << "usage: fasttext dump <model> <option>\n\n"
@@ -194,14 +245,13 @@ void test(const std::vector<std::string>& args)
 
   if (input == "-")
   {
-    fasttext.test(std::wcin, k, threshold, meter);
+    fasttext.test(std::cin, k, threshold, meter);
   } else {
-    std::wifstream ifs(cstr_to_wstr(input));
+    std::ifstream ifs(cstr_to_wstr(input));
     if (!ifs.is_open()) {
       std::cerr << "Test file cannot be opened!" << std::endl;
       exit(EXIT_FAILURE);
     }
-    ifs.imbue(std::locale(std::locale::empty(), new std::codecvt_utf8<wchar_t>));
     fasttext.test(ifs, k, threshold, meter);
   }
 
@@ -235,25 +285,29 @@ void test(const std::vector<std::string>& args)
 
 void predict(const std::vector<std::string>& args)
 {
-  if (args.size() < 4 || args.size() > 6)
+  if (args.size() < 4 || args.size() > 7)
   {
     printPredictUsage();
     exit(EXIT_FAILURE);
   }
   int32_t k = 1;
   real threshold = 0.0;
+  int32_t threads = std::max(1u, std::thread::hardware_concurrency());
   if (args.size() > 4) {
     k = std::stoi(args[4]);
-    if (args.size() == 6) {
-      threshold = std::stof(args[5]);
-    }
+  }
+  if (args.size() > 5) {
+    threshold = std::stof(args[5]);
+  }
+  if (args.size() > 6) {
+    threads = std::stoi(args[6]);
   }
 
   bool printProb = args[1] == "predict-prob";
   FastText fasttext;
   fasttext.loadModel(std::string(args[2]));
 
-  std::wifstream ifs;
+  std::ifstream ifs;
   std::string infile(args[3]);
   bool inputIsStdIn = infile == "-";
   if (!inputIsStdIn) {
@@ -263,11 +317,8 @@ void predict(const std::vector<std::string>& args)
       exit(EXIT_FAILURE);
     }
   }
-  std::wistream& in = inputIsStdIn ? std::wcin : ifs;
-  std::vector<std::pair<real, std::string>> predictions;
-  while (fasttext.predictLine(in, predictions, k, threshold)) {
-    printPredictions(predictions, printProb, false);
-  }
+  std::istream& in = inputIsStdIn ? std::cin : ifs;
+  fasttext.predict(in, std::cout, k, threshold, printProb, threads);
   if (ifs.is_open()) {
     ifs.close();
   }
@@ -301,8 +352,9 @@ void printSentenceVectors(const std::vector<std::string> args)
   FastText fasttext;
   fasttext.loadModel(std::string(args[2]));
   Vector svec(fasttext.getDimension());
-  while (std::wcin.peek() != EOF) {
-    fasttext.getSentenceVector(std::wcin, svec);
+  Tokenizer tokenizer(std::cin);
+  while (!tokenizer.eof()) {
+    fasttext.getSentenceVector(tokenizer, svec);
     // Don't print sentence
     std::cout << svec << std::endl;
   }
@@ -329,45 +381,138 @@ void printNgrams(const std::vector<std::string> args)
   exit(0);
 }
 
+// Loads the nearest neighbor index saved by nn-index next to the model. An
+// index that does not match the model is left out, and queries are answered
+// by exact search.
+void loadNNIndex(FastText& fasttext, const std::string& model)
+{
+  std::string index = model + ".hnsw";
+  if (std::ifstream(index).good()) {
+    try {
+      fasttext.loadNNIndex(index);
+    } catch (const std::invalid_argument& e) {
+      std::cerr << "Ignoring " << index << ": " << e.what()
+                << ". Run nn-index to rebuild it." << std::endl;
+    }
+  }
+}
+
 void nn(const std::vector<std::string> args)
 {
-  int32_t k;
-  if (args.size() == 3) {
-    k = 10;
-  } else if (args.size() == 4) {
-    k = std::stoi(args[3]);
-  } else {
+  int32_t k = 10;
+  int32_t ef = 100;
+  if (args.size() < 3 || args.size() > 5) {
     printNNUsage();
     exit(EXIT_FAILURE);
   }
+  if (args.size() > 3) {
+    k = std::stoi(args[3]);
+  }
+  if (args.size() > 4) {
+    ef = std::stoi(args[4]);
+  }
   FastText fasttext;
   fasttext.loadModel(std::string(args[2]));
+  loadNNIndex(fasttext, args[2]);
   std::string prompt("Query word? ");
   std::cout << prompt;
 
   std::string queryWord;
   while (std::cin >> queryWord) {
-    printPredictions(fasttext.getNN(queryWord, k), true, true);
+    printPredictions(fasttext.getNN(queryWord, k, ef), true, true);
     std::cout << prompt;
   }
   exit(0);
 }
 
+void nnIndex(const std::vector<std::string> args)
+{
+  int32_t M = HnswIndex::DEFAULT_M;
+  int32_t efConstruction = HnswIndex::DEFAULT_EF_CONSTRUCTION;
+  if (args.size() < 3 || args.size() > 5) {
+    printNNIndexUsage();
+    exit(EXIT_FAILURE);
+  }
+  if (args.size() > 3) {
+    M = std::stoi(args[3]);
+  }
+  if (args.size() > 4) {
+    efConstruction = std::stoi(args[4]);
+  }
+  FastText fasttext;
+  fasttext.loadModel(std::string(args[2]));
+  fasttext.buildNNIndex(M, efConstruction);
+  fasttext.saveNNIndex(args[2] + ".hnsw");
+  exit(0);
+}
+
+void nnBatch(const std::vector<std::string> args)
+{
+  int32_t k = 10;
+  int32_t threads = std::max(1u, std::thread::hardware_concurrency());
+  if (args.size() < 4 || args.size() > 6) {
+    printNNBatchUsage();
+    exit(EXIT_FAILURE);
+  }
+  if (args.size() > 4) {
+    k = std::stoi(args[4]);
+  }
+  if (args.size() > 5) {
+    threads = std::stoi(args[5]);
+  }
+  FastText fasttext;
+  fasttext.loadModel(std::string(args[2]));
+
+  std::vector<std::string> words;
+  std::string word;
+  if (args[3] == "-") {
+    while (std::cin >> word) {
+      words.push_back(word);
+    }
+  } else {
+    std::ifstream ifs(cstr_to_wstr(args[3]));
+    if (!ifs.is_open()) {
+      std::cerr << "Queries file cannot be opened!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    while (ifs >> word) {
+      words.push_back(word);
+    }
+  }
+
+  std::vector<Predictions> neighbors;
+  fasttext.getNN(words, k, neighbors, threads);
+  std::shared_ptr<const Dictionary> dict = fasttext.getDictionary();
+  for (size_t i = 0; i < words.size(); i++) {
+    std::cout << words[i];
+    for (const auto& neighbor : neighbors[i]) {
+      WordView neighborWord = dict->getWord(neighbor.second);
+      std::cout << ' ';
+      std::cout.write(neighborWord.data(), neighborWord.size());
+      std::cout << ' ' << neighbor.first;
+    }
+    std::cout << '\n';
+  }
+  std::cout << std::flush;
+  exit(0);
+}
+
 void analogies(const std::vector<std::string> args)
 {
-  int32_t k;
-  if (args.size() == 3)
+  int32_t k = 10;
+  int32_t ef = 100;
+  if (args.size() < 3 || args.size() > 5)
   {
-    k = 10;
+    printAnalogiesUsage();
+    exit(EXIT_FAILURE);
   }
-  else if (args.size() == 4)
+  if (args.size() > 3)
   {
     k = std::stoi(args[3]);
   }
-  else
+  if (args.size() > 4)
   {
-    printAnalogiesUsage();
-    exit(EXIT_FAILURE);
+    ef = std::stoi(args[4]);
   }
 
   if (k <= 0)
@@ -378,6 +523,7 @@ void analogies(const std::vector<std::string> args)
   std::string model(args[2]);
   std::cout << "Loading model " << model << std::endl;
   fasttext.loadModel(model);
+  loadNNIndex(fasttext, model);
 
   std::string prompt("Query triplet (A - B + C)? ");
   std::string wordA, wordB, wordC;
@@ -387,13 +533,30 @@ void analogies(const std::vector<std::string> args)
     std::cin >> wordA;
     std::cin >> wordB;
     std::cin >> wordC;
-    printPredictions(fasttext.getAnalogies(k, wordA, wordB, wordC), true, true);
+    printPredictions(fasttext.getAnalogies(k, wordA, wordB, wordC, ef), true, true);
 
     std::cout << prompt;
   }
   exit(0);
 }
 
+void serve(const std::vector<std::string>& args)
+{
+  if (args.size() < 4 || args.size() > 5) {
+    printServeUsage();
+    exit(EXIT_FAILURE);
+  }
+  int32_t threads = std::max(1u, std::thread::hardware_concurrency());
+  if (args.size() > 4) {
+    threads = std::stoi(args[4]);
+  }
+  auto fasttext = std::make_shared<FastText>();
+  fasttext->loadModel(std::string(args[2]));
+  loadNNIndex(*fasttext, args[2]);
+  Server server(fasttext, threads, 100);
+  server.serve(args[3]);
+}
+
 void predict_next(const std::vector<std::string>& args)
 {
    if (args.size() < 4 || args.size() > 6)
@@ -415,7 +578,7 @@ void predict_next(const std::vector<std::string>& args)
    FastText fasttext;
    fasttext.loadModel(std::string(args[2]));
 
-   std::wifstream ifs;
+   std::ifstream ifs;
    std::string infile(args[3]);
    bool inputIsStdIn = infile == "-";
    if (!inputIsStdIn) {
@@ -426,11 +589,12 @@ void predict_next(const std::vector<std::string>& args)
       }
    }
    std::vector<std::pair<real, std::string>> predictions;
-   std::wistream& in = inputIsStdIn ? std::wcin : ifs;
+   std::istream& in = inputIsStdIn ? std::cin : ifs;
+   Tokenizer tokenizer(in);
 
    while (in.good())
    {
-      fasttext.predictNext(in, predictions, k, threshold);
+      fasttext.predictNext(tokenizer, predictions, k, threshold);
    }
 
    if (ifs.is_open()) {
@@ -597,6 +761,14 @@ int main(int argc, char** argv)
   {
     nn(args);
   }
+  else if (command == "nn-index")
+  {
+    nnIndex(args);
+  }
+  else if (command == "nn-batch")
+  {
+    nnBatch(args);
+  }
   else if (command == "analogies")
   {
     analogies(args);
@@ -613,6 +785,10 @@ int main(int argc, char** argv)
   {
     predict(args);
   }
+  else if (command == "serve")
+  {
+    serve(args);
+  }
   else if (command == "dump")
   {
     dump(args);
@@ -7,6 +7,7 @@
  */
 
 #include "matrix.h"
+#include "vector.h"
 
 namespace fasttext {
 
@@ -27,4 +28,53 @@ int64_t Matrix::size(int64_t dim) const
   return n_;
 }
 
+void Matrix::dotRows(const Vector& vec, Vector& out) const
+{
+  assert(out.size() == m_);
+  for (int64_t i = 0; i < m_; i++) {
+    out[i] = dotRow(vec, i);
+  }
+}
+
+void Matrix::addVectorToRows(
+    const Vector& vec,
+    const Vector& alpha,
+    Vector& grad)
+{
+  assert(alpha.size() == m_);
+  for (int64_t i = 0; i < m_; i++) {
+    addRowToVector(grad, i, alpha[i]);
+    addVectorToRow(vec, i, alpha[i]);
+  }
+}
+
+void Matrix::dotRows(
+    const Vector& vec,
+    const int32_t* rows,
+    int64_t count,
+    real* out) const
+{
+  for (int64_t k = 0; k < count; k++) {
+    out[k] = dotRow(vec, rows[k]);
+  }
+}
+
+void Matrix::addVectorToRows(
+    const Vector& vec,
+    const int32_t* rows,
+    const real* alpha,
+    int64_t count,
+    Vector& grad)
+{
+  for (int64_t k = 0; k < count; k++) {
+    addRowToVector(grad, rows[k], alpha[k]);
+    addVectorToRow(vec, rows[k], alpha[k]);
+  }
+}
+
+void Matrix::load(std::istream& in, std::shared_ptr<utils::MappedFile>)
+{
+  load(in);
+}
+
 } // namespace fasttext
@@ -10,6 +10,7 @@
 
 #include <cstdint>
 #include <istream>
+#include <memory>
 #include <ostream>
 #include <vector>
 
@@ -20,6 +21,10 @@ namespace fasttext {
 
 class Vector;
 
+namespace utils {
+class MappedFile;
+}
+
 class Matrix {
  protected:
   int64_t m_;
@@ -36,8 +41,33 @@ class Matrix {
   virtual void addVectorToRow(const Vector&, int64_t, real) = 0;
   virtual void addRowToVector(Vector& x, int32_t i) const = 0;
   virtual void addRowToVector(Vector& x, int32_t i, real a) const = 0;
+  // out[i] = dotRow(vec, i) for every row i.
+  virtual void dotRows(const Vector& vec, Vector& out) const;
+  // For every row i, adds alpha[i] times the row to grad and then
+  // alpha[i] * vec to the row, as addRowToVector and addVectorToRow would.
+  virtual void addVectorToRows(
+      const Vector& vec,
+      const Vector& alpha,
+      Vector& grad);
+  // The same two operations on the count rows listed in rows, in order:
+  // out[k] = dotRow(vec, rows[k]), and the update of rows[k] by alpha[k].
+  virtual void dotRows(
+      const Vector& vec,
+      const int32_t* rows,
+      int64_t count,
+      real* out) const;
+  virtual void addVectorToRows(
+      const Vector& vec,
+      const int32_t* rows,
+      const real* alpha,
+      int64_t count,
+      Vector& grad);
   virtual void save(std::ostream&) const = 0;
   virtual void load(std::istream&) = 0;
+  // Loads from a stream reading the bytes of mapping from its start.
+  // Implementations may keep pointers into mapping instead of copying;
+  // without a mapping this is load(in).
+  virtual void load(std::istream& in, std::shared_ptr<utils::MappedFile>);
   virtual void dump(std::ostream&) const = 0;
 };
 
@@ -7,6 +7,7 @@
  */
 
 #include "model.h"
+#include "densematrix.h"
 #include "loss.h"
 #include "utils.h"
 
@@ -21,7 +22,10 @@ Model::State::State(int32_t hiddenSize, int32_t outputSize, int32_t seed)
       hidden(hiddenSize),
       output(outputSize),
       grad(hiddenSize),
-      rng(seed)
+      rng(seed),
+      fastRng(seed),
+      rows(),
+      scores()
 {}
 
 real Model::State::getLoss() const
@@ -46,7 +50,7 @@ Model::Model(
    , normalizeGradient_(normalizeGradient)
 {}
 
-void Model::computeHidden(const std::vector<int32_t>& input, Vector& hidden) const
+void Model::computeHidden(Span<int32_t> input, Vector& hidden) const
 {
   hidden.zero();
   for (auto it = input.cbegin(); it != input.cend(); ++it)
@@ -75,23 +79,64 @@ void Model::predict(
   loss_->predict(k, threshold, heap, state);
 }
 
+void Model::predict(
+    const std::vector<std::vector<int32_t>>& inputs,
+    int32_t k,
+    real threshold,
+    std::vector<Predictions>& heaps,
+    State& state) const
+{
+  if (k == Model::kUnlimitedPredictions) {
+    k = wo_->size(0); // output size
+  }
+  else if (k <= 0) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  heaps.resize(inputs.size());
+  std::vector<Vector> hiddens;
+  std::vector<Predictions> nonEmpty;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    heaps[i].clear();
+    if (!inputs[i].empty()) {
+      hiddens.emplace_back(state.hidden.size());
+      computeHidden(inputs[i], hiddens.back());
+      nonEmpty.emplace_back();
+      nonEmpty.back().reserve(k + 1);
+    }
+  }
+
+  loss_->predict(k, threshold, hiddens, nonEmpty, state);
+  for (size_t i = 0, j = 0; i < inputs.size(); i++) {
+    if (!inputs[i].empty()) {
+      heaps[i] = std::move(nonEmpty[j++]);
+    }
+  }
+}
+
 void Model::update(
-    const std::vector<int32_t>& input,
+    Span<int32_t> input,
     const std::vector<int32_t>& targets,
     int32_t targetIndex,
     real lr,
     State& state)
 {
-  if (input.size() == 0) {
+  update(input, targets, Span<int32_t>(&targetIndex, 1), lr, state);
+}
+
+void Model::update(
+    Span<int32_t> input,
+    const std::vector<int32_t>& targets,
+    Span<int32_t> targetIndices,
+    real lr,
+    State& state)
+{
+  if (input.size() == 0 || targetIndices.empty()) {
     return;
   }
   computeHidden(input, state.hidden);
+  updateOutput(targets, targetIndices, lr, state);
 
   Vector& grad = state.grad;
-  grad.zero();
-  real lossValue = loss_->forward(targets, targetIndex, state, lr, true);
-  state.incrementNExamples(lossValue);
-
   if (normalizeGradient_)
   {
     grad.mul(1.0 / input.size());
@@ -102,6 +147,25 @@ void Model::update(
   }
 }
 
+void Model::updateOutput(
+    const std::vector<int32_t>& targets,
+    Span<int32_t> targetIndices,
+    real lr,
+    State& state)
+{
+  Vector& grad = state.grad;
+  grad.zero();
+  for (int32_t targetIndex : targetIndices) {
+    real lossValue = loss_->forward(targets, targetIndex, state, lr, true);
+    state.incrementNExamples(lossValue);
+  }
+  // Scores are not checked for NaN one by one. Diverging weights reach the
+  // hidden layer or the gradient, which are checked once per input.
+  if (!state.hidden.isFinite() || !grad.isFinite()) {
+    throw DenseMatrix::EncounteredNaNError();
+  }
+}
+
 int32_t Model::getMaxTargetId(const std::vector<int32_t>& input, State& state) const
 {
    int32_t idm = -1;
@@ -15,6 +15,7 @@
 
 #include "matrix.h"
 #include "real.h"
+#include "span.h"
 #include "utils.h"
 #include "vector.h"
 
@@ -50,6 +51,11 @@ class Model {
     Vector output;
     Vector grad;
     std::minstd_rand rng;
+    utils::FastRandom fastRng;
+    // Scratch space of the loss: the output rows of an update and their
+    // scores.
+    std::vector<int32_t> rows;
+    std::vector<real> scores;
 
     State(int32_t hiddenSize, int32_t outputSize, int32_t seed);
     real getLoss() const;
@@ -62,16 +68,43 @@ class Model {
       real threshold,
       Predictions& heap,
       State& state) const;
+  // Predicts for several inputs at once, heaps[i] for inputs[i], which
+  // lets the loss share work between them. Empty inputs get no predictions.
+  void predict(
+      const std::vector<std::vector<int32_t>>& inputs,
+      int32_t k,
+      real threshold,
+      std::vector<Predictions>& heaps,
+      State& state) const;
   void update(
-      const std::vector<int32_t>& input,
+      Span<int32_t> input,
       const std::vector<int32_t>& targets,
       int32_t targetIndex,
       real lr,
       State& state);
+  // update for several targets of the same input: the hidden vector is
+  // computed once, and the gradients of all the targets are summed and
+  // added to the input rows once.
+  void update(
+      Span<int32_t> input,
+      const std::vector<int32_t>& targets,
+      Span<int32_t> targetIndices,
+      real lr,
+      State& state);
+
+  // The part of update after the hidden layer: the loss is computed for the
+  // hidden vector already in state.hidden and the output layer updated,
+  // while the input gradient, summed over the targets, is left in
+  // state.grad.
+  void updateOutput(
+      const std::vector<int32_t>& targets,
+      Span<int32_t> targetIndices,
+      real lr,
+      State& state);
 
   int32_t getMaxTargetId(const std::vector<int32_t>& input, State& state) const;
 
-  void computeHidden(const std::vector<int32_t>& input, Vector& hidden) const;
+  void computeHidden(Span<int32_t> input, Vector& hidden) const;
 
   real std_log(real) const;
 
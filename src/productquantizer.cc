@@ -7,31 +7,35 @@
  */
 
 #include "productquantizer.h"
+#include "kernels.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <iostream>
 #include <numeric>
 #include <stdexcept>
 #include <string>
+#include <thread>
 
 namespace fasttext {
 
-real distL2(const real* x, const real* y, int32_t d)
+// ct[j * k + i] = c[i * d + j], for the k centroids of d values of c.
+void transposeCentroids(const real* c, int32_t k, int32_t d, real* ct)
 {
-  real dist = 0;
-  for (auto i = 0; i < d; i++) {
-    auto tmp = x[i] - y[i];
-    dist += tmp * tmp;
+  for (auto i = 0; i < k; i++) {
+    for (auto j = 0; j < d; j++) {
+      ct[j * k + i] = c[i * d + j];
+    }
   }
-  return dist;
 }
 
-ProductQuantizer::ProductQuantizer(int32_t dim, int32_t dsub)
-    : dim_(dim),
+ProductQuantizer::ProductQuantizer(int32_t dim, int32_t dsub, int32_t nbits)
+    : nbits_(nbits),
+      dim_(dim),
       nsubq_(dim / dsub),
       dsub_(dsub),
-      centroids_(dim * ksub_),
-      rng(seed_)
+      centroids_(dim * ksub_)
 {
   lastdsub_ = dim_ % dsub;
   if (lastdsub_ == 0) {
@@ -41,6 +45,14 @@ ProductQuantizer::ProductQuantizer(int32_t dim, int32_t dsub)
   }
 }
 
+int64_t ProductQuantizer::code_size(int64_t n) const
+{
+  if (nbits_ == 8) {
+    return n * nsubq_;
+  }
+  return (n + 31) / 32 * packed_nsubq() * 16;
+}
+
 const real* ProductQuantizer::get_centroids(int32_t m, uint8_t i) const
 {
   if (m == nsubq_ - 1) {
@@ -59,21 +71,12 @@ real* ProductQuantizer::get_centroids(int32_t m, uint8_t i)
 
 real ProductQuantizer::assign_centroid(
     const real* x,
-    const real* c0,
+    const real* ct,
     uint8_t* code,
     int32_t d) const
 {
-  const real* c = c0;
-  real dis = distL2(x, c, d);
-  code[0] = 0;
-  for (auto j = 1; j < ksub_; j++) {
-    c += d;
-    real disij = distL2(x, c, d);
-    if (disij < dis) {
-      code[0] = (uint8_t)j;
-      dis = disij;
-    }
-  }
+  real dis;
+  code[0] = (uint8_t)kernels::nearest(ct, ksub_, d, x, &dis);
   return dis;
 }
 
@@ -84,8 +87,10 @@ void ProductQuantizer::Estep(
     int32_t d,
     int32_t n) const
 {
+  std::vector<real> ct(ksub_ * d);
+  transposeCentroids(centroids, ksub_, d, ct.data());
   for (auto i = 0; i < n; i++) {
-    assign_centroid(x + i * d, centroids, codes + i, d);
+    assign_centroid(x + i * d, ct.data(), codes + i, d);
   }
 }
 
@@ -94,7 +99,8 @@ void ProductQuantizer::MStep(
     real* centroids,
     const uint8_t* codes,
     int32_t d,
-    int32_t n)
+    int32_t n,
+    std::minstd_rand& rng) const
 {
   std::vector<int32_t> nelts(ksub_, 0);
   memset(centroids, 0, sizeof(real) * d * ksub_);
@@ -139,7 +145,12 @@ void ProductQuantizer::MStep(
   }
 }
 
-void ProductQuantizer::kmeans(const real* x, real* c, int32_t n, int32_t d)
+void ProductQuantizer::kmeans(
+    const real* x,
+    real* c,
+    int32_t n,
+    int32_t d,
+    std::minstd_rand& rng) const
 {
   std::vector<int32_t> perm(n, 0);
   std::iota(perm.begin(), perm.end(), 0);
@@ -151,11 +162,11 @@ void ProductQuantizer::kmeans(const real* x, real* c, int32_t n, int32_t d)
   auto codes = std::vector<uint8_t>(n);
   for (auto i = 0; i < niter_; i++) {
     Estep(x, c, codes.data(), d, n);
-    MStep(x, c, codes.data(), d, n);
+    MStep(x, c, codes.data(), d, n, rng);
   }
 }
 
-void ProductQuantizer::train(int32_t n, const real* x)
+void ProductQuantizer::train(int32_t n, const real* x, int32_t threads)
 {
   if (n < ksub_)
   {
@@ -163,26 +174,35 @@ void ProductQuantizer::train(int32_t n, const real* x)
         "Matrix too small for quantization, must have at least " +
         std::to_string(ksub_) + " rows");
   }
-  std::vector<int32_t> perm(n, 0);
-  std::iota(perm.begin(), perm.end(), 0);
-  auto d = dsub_;
   auto np = std::min(n, max_points_);
-  auto xslice = std::vector<real>(np * dsub_);
-  for (auto m = 0; m < nsubq_; m++)
-  {
-    if (m == nsubq_ - 1) {
-      d = lastdsub_;
-    }
-    if (np != n) {
-      std::shuffle(perm.begin(), perm.end(), rng);
-    }
-    for (auto j = 0; j < np; j++) {
-      memcpy(
-          xslice.data() + j * d,
-          x + perm[j] * dim_ + m * dsub_,
-          d * sizeof(real));
+  std::atomic<int32_t> next(0);
+  auto worker = [&]() {
+    std::vector<int32_t> perm(n);
+    auto xslice = std::vector<real>(np * dsub_);
+    for (int32_t m = next++; m < nsubq_; m = next++)
+    {
+      std::minstd_rand rng(seed_ + m);
+      auto d = m == nsubq_ - 1 ? lastdsub_ : dsub_;
+      std::iota(perm.begin(), perm.end(), 0);
+      if (np != n) {
+        std::shuffle(perm.begin(), perm.end(), rng);
+      }
+      for (auto j = 0; j < np; j++) {
+        memcpy(
+            xslice.data() + j * d,
+            x + int64_t(perm[j]) * dim_ + m * dsub_,
+            d * sizeof(real));
+      }
+      kmeans(xslice.data(), get_centroids(m, 0), np, d, rng);
     }
-    kmeans(xslice.data(), get_centroids(m, 0), np, d);
+  };
+  std::vector<std::thread> pool;
+  for (auto t = 1; t < std::min(threads, nsubq_); t++) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : pool) {
+    thread.join();
   }
 }
 
@@ -194,10 +214,9 @@ real ProductQuantizer::mulcode(
 {
   real res = 0.0;
   auto d = dsub_;
-  const uint8_t* code = codes + nsubq_ * t;
   for (auto m = 0; m < nsubq_; m++)
   {
-    const real* c = get_centroids(m, code[m]);
+    const real* c = get_centroids(m, get_code(codes, t, m));
     if (m == nsubq_ - 1) {
       d = lastdsub_;
     }
@@ -208,6 +227,95 @@ real ProductQuantizer::mulcode(
   return res * alpha;
 }
 
+void ProductQuantizer::compute_dot_table(
+    const real* x,
+    std::vector<real>& table) const
+{
+  table.resize(nsubq_ * ksub_);
+  auto d = dsub_;
+  for (auto m = 0; m < nsubq_; m++)
+  {
+    if (m == nsubq_ - 1) {
+      d = lastdsub_;
+    }
+    // the ksub_ centroids of a subquantizer are contiguous rows of d values
+    kernels::gemv(
+        get_centroids(m, 0),
+        nullptr,
+        ksub_,
+        d,
+        x + m * dsub_,
+        &table[m * ksub_]);
+  }
+}
+
+void ProductQuantizer::mulcodes(
+    const std::vector<real>& table,
+    const uint8_t* codes,
+    const int32_t* rows,
+    int64_t count,
+    real* out) const
+{
+  if (nbits_ == 4 && !rows) {
+    scan_codes(table, codes, count, out);
+    return;
+  }
+  const real* t = table.data();
+  for (int64_t k = 0; k < count; k++)
+  {
+    int64_t row = rows ? rows[k] : k;
+    // two sums, to overlap the latency of the lookups
+    real s0 = 0.0, s1 = 0.0;
+    auto m = 0;
+    for (; m + 2 <= nsubq_; m += 2) {
+      s0 += t[m * ksub_ + get_code(codes, row, m)];
+      s1 += t[(m + 1) * ksub_ + get_code(codes, row, m + 1)];
+    }
+    if (m < nsubq_) {
+      s0 += t[m * ksub_ + get_code(codes, row, m)];
+    }
+    out[k] = s0 + s1;
+  }
+}
+
+// The entries of each subquantizer are shifted to start at 0 and scaled by
+// a factor common to all of them, so that their sums are sums of bytes; the
+// shifts add up to a constant of every product.
+void ProductQuantizer::scan_codes(
+    const std::vector<real>& table,
+    const uint8_t* codes,
+    int64_t count,
+    real* out) const
+{
+  const int32_t nt = packed_nsubq();
+  std::vector<real> low(nsubq_);
+  real bias = 0.0, range = 0.0;
+  for (auto m = 0; m < nsubq_; m++) {
+    const real* t = &table[m * ksub_];
+    low[m] = *std::min_element(t, t + ksub_);
+    bias += low[m];
+    range = std::max(range, *std::max_element(t, t + ksub_) - low[m]);
+  }
+  // the largest entry for which nt of them still fit 16 bits
+  const real top = std::min(255, 65535 / nt);
+  const real scale = range > 0 ? top / range : 0.0;
+  std::vector<uint8_t> lut(nt * 16, 0);
+  for (auto m = 0; m < nsubq_; m++) {
+    for (auto j = 0; j < ksub_; j++) {
+      lut[m * 16 + j] =
+          (uint8_t)std::lround((table[m * ksub_ + j] - low[m]) * scale);
+    }
+  }
+
+  const int64_t blocks = (count + 31) / 32;
+  std::vector<uint16_t> sums(blocks * 32);
+  kernels::scan4(codes, blocks, nt, lut.data(), sums.data());
+  const real unit = scale > 0 ? 1.0 / scale : 0.0;
+  for (int64_t k = 0; k < count; k++) {
+    out[k] = bias + sums[k] * unit;
+  }
+}
+
 void ProductQuantizer::addcode(
     Vector& x,
     const uint8_t* codes,
@@ -215,10 +323,9 @@ void ProductQuantizer::addcode(
     real alpha) const
 {
   auto d = dsub_;
-  const uint8_t* code = codes + nsubq_ * t;
   for (auto m = 0; m < nsubq_; m++)
   {
-    const real* c = get_centroids(m, code[m]);
+    const real* c = get_centroids(m, get_code(codes, t, m));
     if (m == nsubq_ - 1) {
       d = lastdsub_;
     }
@@ -230,20 +337,49 @@ void ProductQuantizer::addcode(
 
 void ProductQuantizer::compute_code(const real* x, uint8_t* code) const
 {
-  auto d = dsub_;
-  for (auto m = 0; m < nsubq_; m++)
-  {
-    if (m == nsubq_ - 1) {
-      d = lastdsub_;
-    }
-    assign_centroid(x + m * dsub_, get_centroids(m, 0), code + m, d);
-  }
+  compute_codes(x, code, 1);
 }
 
-void ProductQuantizer::compute_codes(const real* x, uint8_t* codes, int32_t n) const
+void ProductQuantizer::compute_codes(
+    const real* x,
+    uint8_t* codes,
+    int32_t n,
+    int32_t threads) const
 {
-  for (auto i = 0; i < n; i++) {
-    compute_code(x + i * dim_, codes + i * nsubq_);
+  // the centroids by coordinate, at the offsets of centroids_
+  std::vector<real> ct(centroids_.size());
+  for (auto m = 0; m < nsubq_; m++) {
+    auto d = m == nsubq_ - 1 ? lastdsub_ : dsub_;
+    transposeCentroids(
+        get_centroids(m, 0), ksub_, d, ct.data() + m * ksub_ * dsub_);
+  }
+  auto worker = [&](int64_t start, int64_t end) {
+    for (auto i = start; i < end; i++) {
+      for (auto m = 0; m < nsubq_; m++) {
+        auto d = m == nsubq_ - 1 ? lastdsub_ : dsub_;
+        uint8_t code;
+        assign_centroid(
+            x + i * dim_ + m * dsub_,
+            ct.data() + m * ksub_ * dsub_,
+            &code,
+            d);
+        set_code(codes, i, m, code);
+      }
+    }
+  };
+  // threads take whole blocks of 32 rows, whose 4-bit codes share bytes
+  const int64_t blocks = (int64_t(n) + 31) / 32;
+  threads = std::max<int64_t>(1, std::min<int64_t>(threads, blocks));
+  auto start = [&](int64_t t) {
+    return std::min<int64_t>(n, blocks * t / threads * 32);
+  };
+  std::vector<std::thread> pool;
+  for (auto t = 1; t < threads; t++) {
+    pool.emplace_back(worker, start(t), start(t + 1));
+  }
+  worker(0, start(1));
+  for (auto& thread : pool) {
+    thread.join();
   }
 }
 
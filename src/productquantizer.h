@@ -19,6 +19,10 @@
 
 namespace fasttext {
 
+// Codes the subvectors of rows with the nearest of 2^nbits_ centroids each.
+// With 8 bits, the codes of a row are nsubq_ consecutive bytes. With 4 bits,
+// two codes share a byte and rows are stored in blocks of 32, laid out for
+// kernels::scan4 with the subquantizers padded to an even count.
 class ProductQuantizer {
  protected:
   const int32_t nbits_ = 8;
@@ -36,25 +40,85 @@ class ProductQuantizer {
 
   std::vector<real> centroids_;
 
-  std::minstd_rand rng;
+  // Number of 16-byte tables of a block of 4-bit codes.
+  inline int32_t packed_nsubq() const {
+    return nsubq_ + (nsubq_ & 1);
+  }
+  void scan_codes(
+      const std::vector<real>& table,
+      const uint8_t* codes,
+      int64_t count,
+      real* out) const;
 
  public:
-  ProductQuantizer() {}
-  ProductQuantizer(int32_t, int32_t);
+  explicit ProductQuantizer(int32_t nbits = 8) : nbits_(nbits) {}
+  ProductQuantizer(int32_t, int32_t, int32_t nbits = 8);
+
+  inline int32_t get_nbits() const {
+    return nbits_;
+  }
+  inline int32_t get_ksub() const {
+    return ksub_;
+  }
+  // Bytes taken by the codes of n rows.
+  int64_t code_size(int64_t n) const;
+  inline uint8_t get_code(const uint8_t* codes, int64_t t, int32_t m) const {
+    if (nbits_ == 8) {
+      return codes[nsubq_ * t + m];
+    }
+    uint8_t byte = codes[((t / 32) * packed_nsubq() + m) * 16 + t % 16];
+    return t % 32 < 16 ? byte & 15 : byte >> 4;
+  }
+  inline void set_code(uint8_t* codes, int64_t t, int32_t m, uint8_t code)
+      const {
+    if (nbits_ == 8) {
+      codes[nsubq_ * t + m] = code;
+      return;
+    }
+    uint8_t& byte = codes[((t / 32) * packed_nsubq() + m) * 16 + t % 16];
+    byte = t % 32 < 16 ? (byte & 0xf0) | code : (byte & 0x0f) | (code << 4);
+  }
 
   real* get_centroids(int32_t, uint8_t);
   const real* get_centroids(int32_t, uint8_t) const;
 
-  real assign_centroid(const real*, const real*, uint8_t*, int32_t) const;
+  // Codes x with the nearest of the centroids of a subquantizer, given by
+  // coordinate: value j of centroid c is ct[j * ksub_ + c].
+  real assign_centroid(const real* x, const real* ct, uint8_t*, int32_t)
+      const;
   void Estep(const real*, const real*, uint8_t*, int32_t, int32_t) const;
-  void MStep(const real*, real*, const uint8_t*, int32_t, int32_t);
-  void kmeans(const real*, real*, int32_t, int32_t);
-  void train(int, const real*);
+  void MStep(
+      const real*,
+      real*,
+      const uint8_t*,
+      int32_t,
+      int32_t,
+      std::minstd_rand& rng) const;
+  void kmeans(const real*, real*, int32_t, int32_t, std::minstd_rand& rng)
+      const;
+  // Subquantizers are trained in parallel, each with a generator seeded
+  // from its index, so the codebooks do not depend on threads.
+  void train(int32_t n, const real* x, int32_t threads = 1);
 
   real mulcode(const Vector&, const uint8_t*, int32_t, real) const;
+  // table[m * ksub_ + j] is the dot product of the m-th subvector of x with
+  // centroid j of subquantizer m: the dot product of x with a coded row is
+  // then the sum of nsubq_ table entries.
+  void compute_dot_table(const real* x, std::vector<real>& table) const;
+  // out[k] = dot product of x with row rows[k], or row k if rows is null,
+  // from the dot table of x. With 4 bits and all the rows, the table is
+  // rounded to bytes for kernels::scan4, so the products are approximate.
+  void mulcodes(
+      const std::vector<real>& table,
+      const uint8_t* codes,
+      const int32_t* rows,
+      int64_t count,
+      real* out) const;
   void addcode(Vector&, const uint8_t*, int32_t, real) const;
   void compute_code(const real*, uint8_t*) const;
-  void compute_codes(const real*, uint8_t*, int32_t) const;
+  // codes must hold code_size(n) bytes.
+  void compute_codes(const real*, uint8_t*, int32_t, int32_t threads = 1)
+      const;
 
   void save(std::ostream&) const;
   void load(std::istream&);
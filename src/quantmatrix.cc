@@ -12,24 +12,54 @@
 #include <iostream>
 #include <stdexcept>
 
+#include "utils.h"
+
 namespace fasttext {
 
-QuantMatrix::QuantMatrix()
-   : Matrix(), qnorm_(false), codesize_(0)
+// Rows per centroid of a subquantizer scored by a dotRows call from which a
+// table of dot products pays off: building it costs about as much as
+// scoring one row per centroid directly.
+constexpr int64_t QUANT_TABLE_ROWS_PER_CENTROID = 2;
+// First model file version that stores the bits of the codes.
+constexpr int32_t QUANT_NBITS_VERSION = 13;
+
+QuantMatrix::QuantMatrix() : QuantMatrix(QUANT_NBITS_VERSION) {}
+
+QuantMatrix::QuantMatrix(int32_t fileVersion)
+   : Matrix(),
+     codes_(nullptr),
+     norm_codes_(nullptr),
+     qnorm_(false),
+     codesize_(0),
+     fileVersion_(fileVersion)
 {}
 
-QuantMatrix::QuantMatrix(DenseMatrix&& mat, int32_t dsub, bool qnorm)
+QuantMatrix::QuantMatrix(
+    DenseMatrix&& mat,
+    int32_t dsub,
+    bool qnorm,
+    int32_t threads,
+    int32_t nbits)
     : Matrix(mat.size(0), mat.size(1)),
+      codes_(nullptr),
+      norm_codes_(nullptr),
       qnorm_(qnorm),
-      codesize_(mat.size(0) * ((mat.size(1) + dsub - 1) / dsub))
+      fileVersion_(QUANT_NBITS_VERSION)
 {
-  codes_.resize(codesize_);
-  pq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer(n_, dsub));
+  if (nbits != 4 && nbits != 8) {
+    throw std::invalid_argument("Codes must have 4 or 8 bits");
+  }
+  pq_ = std::unique_ptr<ProductQuantizer>(
+      new ProductQuantizer(n_, dsub, nbits));
+  codesize_ = pq_->code_size(m_);
+  codesStorage_.resize(codesize_);
+  codes_ = codesStorage_.data();
   if (qnorm_) {
-    norm_codes_.resize(m_);
+    normCodesStorage_.resize(m_);
+    norm_codes_ = normCodesStorage_.data();
     npq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer(1, 1));
   }
-  quantize(std::forward<DenseMatrix>(mat));
+  quantize(std::forward<DenseMatrix>(mat), threads);
 }
 
 void QuantMatrix::quantizeNorm(const Vector& norms)
@@ -38,10 +68,10 @@ void QuantMatrix::quantizeNorm(const Vector& norms)
   assert(norms.size() == m_);
   auto dataptr = norms.data();
   npq_->train(m_, dataptr);
-  npq_->compute_codes(dataptr, norm_codes_.data(), m_);
+  npq_->compute_codes(dataptr, normCodesStorage_.data(), m_);
 }
 
-void QuantMatrix::quantize(DenseMatrix&& mat)
+void QuantMatrix::quantize(DenseMatrix&& mat, int32_t threads)
 {
   if (qnorm_) {
     Vector norms(mat.size(0));
@@ -50,8 +80,16 @@ void QuantMatrix::quantize(DenseMatrix&& mat)
     quantizeNorm(norms);
   }
   auto dataptr = mat.data();
-  pq_->train(m_, dataptr);
-  pq_->compute_codes(dataptr, codes_.data(), m_);
+  pq_->train(m_, dataptr, threads);
+  pq_->compute_codes(dataptr, codesStorage_.data(), m_, threads);
+}
+
+real QuantMatrix::norm(int64_t i) const
+{
+  if (qnorm_) {
+    return npq_->get_centroids(0, norm_codes_[i])[0];
+  }
+  return 1.f;
 }
 
 real QuantMatrix::dotRow(const Vector& vec, int64_t i) const
@@ -59,11 +97,44 @@ real QuantMatrix::dotRow(const Vector& vec, int64_t i) const
   assert(i >= 0);
   assert(i < m_);
   assert(vec.size() == n_);
-  real norm = 1.f;
+  return pq_->mulcode(vec, codes_, i, norm(i));
+}
+
+void QuantMatrix::dotRows(const Vector& vec, Vector& out) const
+{
+  assert(out.size() == m_);
+  if (m_ < QUANT_TABLE_ROWS_PER_CENTROID * pq_->get_ksub()) {
+    Matrix::dotRows(vec, out);
+    return;
+  }
+  std::vector<real> table;
+  pq_->compute_dot_table(vec.data(), table);
+  pq_->mulcodes(table, codes_, nullptr, m_, out.data());
   if (qnorm_) {
-    norm = npq_->get_centroids(0, norm_codes_[i])[0];
+    for (int64_t i = 0; i < m_; i++) {
+      out[i] *= norm(i);
+    }
+  }
+}
+
+void QuantMatrix::dotRows(
+    const Vector& vec,
+    const int32_t* rows,
+    int64_t count,
+    real* out) const
+{
+  if (count < QUANT_TABLE_ROWS_PER_CENTROID * pq_->get_ksub()) {
+    Matrix::dotRows(vec, rows, count, out);
+    return;
+  }
+  std::vector<real> table;
+  pq_->compute_dot_table(vec.data(), table);
+  pq_->mulcodes(table, codes_, rows, count, out);
+  if (qnorm_) {
+    for (int64_t k = 0; k < count; k++) {
+      out[k] *= norm(rows[k]);
+    }
   }
-  return pq_->mulcode(vec, codes_.data(), i, norm);
 }
 
 void QuantMatrix::addVectorToRow(const Vector&, int64_t, real)
@@ -73,20 +144,12 @@ void QuantMatrix::addVectorToRow(const Vector&, int64_t, real)
 
 void QuantMatrix::addRowToVector(Vector& x, int32_t i, real a) const
 {
-  real norm = 1.f;
-  if (qnorm_) {
-    norm = npq_->get_centroids(0, norm_codes_[i])[0];
-  }
-  pq_->addcode(x, codes_.data(), i, a * norm);
+  pq_->addcode(x, codes_, i, a * norm(i));
 }
 
 void QuantMatrix::addRowToVector(Vector& x, int32_t i) const
 {
-  real norm = 1.f;
-  if (qnorm_) {
-    norm = npq_->get_centroids(0, norm_codes_[i])[0];
-  }
-  pq_->addcode(x, codes_.data(), i, norm);
+  pq_->addcode(x, codes_, i, norm(i));
 }
 
 void QuantMatrix::save(std::ostream& out) const
@@ -95,32 +158,66 @@ void QuantMatrix::save(std::ostream& out) const
   out.write((char*)&m_, sizeof(m_));
   out.write((char*)&n_, sizeof(n_));
   out.write((char*)&codesize_, sizeof(codesize_));
-  out.write((char*)codes_.data(), codesize_ * sizeof(uint8_t));
+  int32_t nbits = pq_->get_nbits();
+  out.write((char*)&nbits, sizeof(nbits));
+  out.write((char*)codes_, codesize_ * sizeof(uint8_t));
   pq_->save(out);
   if (qnorm_) {
-    out.write((char*)norm_codes_.data(), m_ * sizeof(uint8_t));
+    out.write((char*)norm_codes_, m_ * sizeof(uint8_t));
     npq_->save(out);
   }
 }
 
 void QuantMatrix::load(std::istream& in)
+{
+  load(in, nullptr);
+}
+
+// Codes are bytes, so unlike DenseMatrix they can always be used in place.
+void QuantMatrix::load(
+    std::istream& in,
+    std::shared_ptr<utils::MappedFile> mapping)
 {
   in.read((char*)&qnorm_, sizeof(qnorm_));
   in.read((char*)&m_, sizeof(m_));
   in.read((char*)&n_, sizeof(n_));
   in.read((char*)&codesize_, sizeof(codesize_));
-  codes_ = std::vector<uint8_t>(codesize_);
-  in.read((char*)codes_.data(), codesize_ * sizeof(uint8_t));
-  pq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer());
+  int32_t nbits = 8;
+  if (fileVersion_ >= QUANT_NBITS_VERSION) {
+    in.read((char*)&nbits, sizeof(nbits));
+    if (nbits != 4 && nbits != 8) {
+      throw std::invalid_argument("Invalid quantized matrix");
+    }
+  }
+  mapping_ = mapping;
+  codes_ = loadCodes(in, codesize_, codesStorage_);
+  pq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer(nbits));
   pq_->load(in);
   if (qnorm_) {
-    norm_codes_ = std::vector<uint8_t>(m_);
-    in.read((char*)norm_codes_.data(), m_ * sizeof(uint8_t));
+    norm_codes_ = loadCodes(in, m_, normCodesStorage_);
     npq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer());
     npq_->load(in);
   }
 }
 
+const uint8_t* QuantMatrix::loadCodes(
+    std::istream& in,
+    int64_t n,
+    std::vector<uint8_t>& storage)
+{
+  if (mapping_) {
+    int64_t offset = in.tellg();
+    if (offset >= 0 && offset + n <= mapping_->size()) {
+      storage = std::vector<uint8_t>();
+      in.seekg(offset + n);
+      return (const uint8_t*)mapping_->data() + offset;
+    }
+  }
+  storage = std::vector<uint8_t>(n);
+  in.read((char*)storage.data(), n * sizeof(uint8_t));
+  return storage.data();
+}
+
 void QuantMatrix::dump(std::ostream&) const
 {
   throw std::runtime_error("Operation not permitted on quantized matrices.");
@@ -30,15 +30,35 @@ class QuantMatrix : public Matrix {
   std::unique_ptr<ProductQuantizer> pq_;
   std::unique_ptr<ProductQuantizer> npq_;
 
-  std::vector<uint8_t> codes_;
-  std::vector<uint8_t> norm_codes_;
+  // codes_ and norm_codes_ point either into the storage vectors or, for a
+  // matrix loaded as a view of a model file, into mapping_.
+  const uint8_t* codes_;
+  const uint8_t* norm_codes_;
+  std::vector<uint8_t> codesStorage_;
+  std::vector<uint8_t> normCodesStorage_;
+  std::shared_ptr<utils::MappedFile> mapping_;
 
   bool qnorm_;
   int32_t codesize_;
+  // Version of the model file being loaded, which tells its layout.
+  int32_t fileVersion_;
+
+  const uint8_t*
+  loadCodes(std::istream&, int64_t, std::vector<uint8_t>& storage);
+  real norm(int64_t i) const;
 
  public:
   QuantMatrix();
-  QuantMatrix(DenseMatrix&&, int32_t, bool);
+  // For loading a matrix from a model file of the given version.
+  explicit QuantMatrix(int32_t fileVersion);
+  // nbits is 8, or 4 for half the codes and faster scoring of all the rows
+  // at the cost of accuracy.
+  QuantMatrix(
+      DenseMatrix&&,
+      int32_t dsub,
+      bool qnorm,
+      int32_t threads = 1,
+      int32_t nbits = 8);
   QuantMatrix(const QuantMatrix&) = delete;
   QuantMatrix(QuantMatrix&&) = delete;
   QuantMatrix& operator=(const QuantMatrix&) = delete;
@@ -46,14 +66,23 @@ class QuantMatrix : public Matrix {
   virtual ~QuantMatrix() noexcept override = default;
 
   void quantizeNorm(const Vector&);
-  void quantize(DenseMatrix&& mat);
+  void quantize(DenseMatrix&& mat, int32_t threads = 1);
 
   real dotRow(const Vector&, int64_t) const override;
+  // Many rows are scored from a table of the dot products of vec with every
+  // centroid, built once per call.
+  void dotRows(const Vector& vec, Vector& out) const override;
+  void dotRows(
+      const Vector& vec,
+      const int32_t* rows,
+      int64_t count,
+      real* out) const override;
   void addVectorToRow(const Vector&, int64_t, real) override;
   void addRowToVector(Vector& x, int32_t i) const override;
   void addRowToVector(Vector& x, int32_t i, real a) const override;
   void save(std::ostream&) const override;
   void load(std::istream&) override;
+  void load(std::istream&, std::shared_ptr<utils::MappedFile>) override;
   void dump(std::ostream&) const override;
 };
 
@@ -0,0 +1,290 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "tokenizer.h"
+#include "utils.h"
+#include "vector.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace fasttext {
+
+// Longest request line accepted; a longer one closes the connection.
+constexpr size_t SERVER_MAX_REQUEST = 1 << 24;
+
+namespace {
+
+// The rest of the request line, after the space that ends the last field.
+std::string remainder(std::istream& in)
+{
+  std::string text;
+  std::getline(in, text);
+  if (!text.empty() && text[0] == ' ') {
+    text.erase(0, 1);
+  }
+  return text;
+}
+
+} // namespace
+
+Server::Server(std::shared_ptr<FastText> fasttext, int32_t threads, int32_t ef)
+    : fasttext_(fasttext), threads_(std::max(threads, 1)), ef_(ef) {}
+
+void Server::handle(
+    const std::string& request,
+    Model::State& state,
+    std::string& response) const
+{
+  std::istringstream in(request);
+  std::ostringstream out;
+  std::string command;
+  in >> command;
+  try {
+    if (command == "predict") {
+      int32_t k;
+      real threshold;
+      if (!(in >> k >> threshold)) {
+        throw std::invalid_argument("usage: predict <k> <threshold> <text>");
+      }
+      std::string text = remainder(in);
+      utils::MemoryBuffer buffer(text.data(), text.size());
+      std::istream input(&buffer);
+      Tokenizer tokenizer(input);
+      std::shared_ptr<const Dictionary> dict = fasttext_->getDictionary();
+      std::vector<int32_t> words, labels;
+      dict->getLine(tokenizer, words, labels);
+      Predictions predictions;
+      fasttext_->predict(k, words, predictions, threshold, state);
+      for (size_t i = 0; i < predictions.size(); i++) {
+        if (i > 0) {
+          out << " ";
+        }
+        out << dict->getLabel(predictions[i].second) << " "
+            << std::exp(predictions[i].first);
+      }
+    } else if (command == "word-vector") {
+      std::string word;
+      if (!(in >> word)) {
+        throw std::invalid_argument("usage: word-vector <word>");
+      }
+      Vector vec(fasttext_->getDimension());
+      fasttext_->getWordVector(vec, word);
+      out << vec;
+    } else if (command == "sentence-vector") {
+      std::string text = remainder(in);
+      utils::MemoryBuffer buffer(text.data(), text.size());
+      std::istream input(&buffer);
+      Tokenizer tokenizer(input);
+      Vector vec(fasttext_->getDimension());
+      fasttext_->getSentenceVector(tokenizer, vec);
+      out << vec;
+    } else if (command == "nn") {
+      int32_t k;
+      std::string word;
+      if (!(in >> k >> word)) {
+        throw std::invalid_argument("usage: nn <k> <word>");
+      }
+      if (k < 1) {
+        throw std::invalid_argument("k needs to be 1 or higher!");
+      }
+      bool first = true;
+      for (const auto& neighbor : fasttext_->getNN(word, k, ef_)) {
+        if (!first) {
+          out << " ";
+        }
+        first = false;
+        out << neighbor.second << " " << neighbor.first;
+      }
+    } else {
+      throw std::invalid_argument("unknown request '" + command + "'");
+    }
+  } catch (const std::exception& e) {
+    out.str("");
+    out << "error " << e.what();
+  }
+  response += out.str();
+  response += '\n';
+}
+
+#ifdef _WIN32
+
+void Server::serve(const std::string&)
+{
+  throw std::runtime_error("serve needs Unix domain sockets");
+}
+
+#else
+
+namespace {
+
+// The Model::States of the requests being answered; taking one waits until
+// fewer than `threads` requests are.
+class StatePool {
+ public:
+  StatePool(const FastText& fasttext, int32_t size) {
+    for (int32_t i = 0; i < size; i++) {
+      free_.emplace_back(new Model::State(fasttext.createState()));
+    }
+  }
+
+  std::unique_ptr<Model::State> take() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_.wait(lock, [this]() { return !free_.empty(); });
+    std::unique_ptr<Model::State> state = std::move(free_.back());
+    free_.pop_back();
+    return state;
+  }
+
+  void give(std::unique_ptr<Model::State> state) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(std::move(state));
+    ready_.notify_one();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::vector<std::unique_ptr<Model::State>> free_;
+};
+
+bool writeAll(int fd, const std::string& data)
+{
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    written += n;
+  }
+  return true;
+}
+
+// Answers the requests of a connection until the client closes it. A state
+// is only held while answering the complete requests of one read.
+void serveConnection(const Server& server, StatePool& states, int fd)
+{
+  std::vector<char> chunk(1 << 16);
+  std::string pending, response;
+  while (true) {
+    ssize_t n = ::read(fd, chunk.data(), chunk.size());
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+    pending.append(chunk.data(), n);
+
+    // all the complete requests read so far are answered with one write
+    size_t start = 0;
+    size_t end = pending.find('\n');
+    if (end != std::string::npos) {
+      std::unique_ptr<Model::State> state = states.take();
+      do {
+        size_t stop = end;
+        if (stop > start && pending[stop - 1] == '\r') {
+          stop--;
+        }
+        server.handle(pending.substr(start, stop - start), *state, response);
+        start = end + 1;
+      } while ((end = pending.find('\n', start)) != std::string::npos);
+      states.give(std::move(state));
+    }
+    pending.erase(0, start);
+    if (pending.size() > SERVER_MAX_REQUEST) {
+      return;
+    }
+    if (!writeAll(fd, response)) {
+      return;
+    }
+    response.clear();
+  }
+}
+
+} // namespace
+
+void Server::serve(const std::string& path)
+{
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::invalid_argument(path + " is too long for a socket path!");
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+  // the word vectors of nn are computed before the threads share them
+  fasttext_->lazyComputeWordVectors();
+  // a client going away must not stop the server
+  ::signal(SIGPIPE, SIG_IGN);
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+  }
+  ::unlink(path.c_str());
+  if (::bind(fd, (sockaddr*)&address, sizeof(address)) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0) {
+    std::string error = std::strerror(errno);
+    ::close(fd);
+    throw std::runtime_error(path + " cannot be listened on: " + error);
+  }
+
+  // shared with the detached connection threads
+  std::shared_ptr<StatePool> states =
+      std::make_shared<StatePool>(*fasttext_, threads_);
+  while (true) {
+    int connection = ::accept(fd, nullptr, nullptr);
+    if (connection < 0) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        // e.g. out of file descriptors: wait for connections to close
+        std::cerr << "accept: " << std::strerror(errno) << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      continue;
+    }
+    try {
+      std::thread([this, states, connection]() {
+        serveConnection(*this, *states, connection);
+        ::close(connection);
+      }).detach();
+    } catch (const std::system_error& e) {
+      std::cerr << "thread: " << e.what() << std::endl;
+      ::close(connection);
+    }
+  }
+}
+
+#endif
+
+} // namespace fasttext
@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "fasttext.h"
+#include "model.h"
+
+namespace fasttext {
+
+// Answers requests on a Unix domain socket with a model loaded once, for
+// clients that would otherwise reload it on every call.
+//
+// A client sends requests of one line each and reads one line per request,
+// in order; several requests may be sent before reading. The requests are
+//
+//   predict <k> <threshold> <text>   labels and probabilities, as
+//                                    predict-prob
+//   word-vector <word>               the values of the word vector
+//   sentence-vector <text>           the values of the sentence vector
+//   nn <k> <word>                    nearest words and similarities, as nn
+//
+// A request that cannot be answered gets a line starting with "error".
+// Every connection has its own thread, so idle clients block no one, and
+// answers at most `threads` requests at once with one of as many
+// Model::States.
+class Server {
+ public:
+  Server(std::shared_ptr<FastText> fasttext, int32_t threads, int32_t ef);
+
+  // Listens on path, replacing a stale socket file, until the process is
+  // stopped.
+  void serve(const std::string& path);
+
+  // Answers one request, given without its newline; appends the answer and
+  // its newline to response.
+  void handle(
+      const std::string& request,
+      Model::State& state,
+      std::string& response) const;
+
+ private:
+  std::shared_ptr<FastText> fasttext_;
+  int32_t threads_;
+  int32_t ef_;
+};
+
+} // namespace fasttext
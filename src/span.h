@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace fasttext {
+
+// Read-only view of a contiguous array owned by someone else (a vector, the
+// subword table of a Dictionary, ...). It stays valid as long as the owner
+// is not modified.
+template <typename T>
+class Span {
+ protected:
+  const T* data_;
+  size_t size_;
+
+ public:
+  typedef const T* const_iterator;
+
+  Span() : data_(nullptr), size_(0) {}
+  Span(const T* data, size_t size) : data_(data), size_(size) {}
+  Span(const std::vector<T>& v) : data_(v.data()), size_(v.size()) {}
+
+  inline const T* data() const {
+    return data_;
+  }
+  inline size_t size() const {
+    return size_;
+  }
+  inline bool empty() const {
+    return size_ == 0;
+  }
+  inline const T& operator[](size_t i) const {
+    assert(i < size_);
+    return data_[i];
+  }
+  inline const T& front() const {
+    return data_[0];
+  }
+  inline const T* begin() const {
+    return data_;
+  }
+  inline const T* end() const {
+    return data_ + size_;
+  }
+  inline const T* cbegin() const {
+    return data_;
+  }
+  inline const T* cend() const {
+    return data_ + size_;
+  }
+};
+
+} // namespace fasttext
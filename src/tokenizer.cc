@@ -0,0 +1,416 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "tokenizer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FASTTEXT_TOKENIZER_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "strutils.h"
+
+namespace fasttext {
+
+namespace {
+
+// Normalised characters are stored as the byte appended to the word
+// (translateChar / transformChar truncated to char, as push_back did) plus
+// the kind of the character.
+const uint16_t CHAR_WORD = 0;
+const uint16_t CHAR_SPACE = 1 << 8;
+const uint16_t CHAR_NEWLINE = 2 << 8;
+const uint16_t CHAR_KIND = 3 << 8;
+
+// Code points below this limit (all one- and two-byte sequences) are looked
+// up; translateChar maps the rest to a few fixed values.
+const int32_t TABLE_SIZE = 0x800;
+const int32_t INVALID_CHAR = 0xFFFD;
+
+// Bits of the trimming classes of a byte.
+const uint8_t TRIM_LEFT = 1;   // "#@"
+const uint8_t TRIM_RIGHT = 2;  // "?!.,:;-", ends the sentence
+const uint8_t TRIM_QUOTE = 4;  // "'/)(\""
+
+uint16_t encodeChar(wchar_t c)
+{
+   const uint16_t byte = static_cast<uint8_t>(c & 0xFF);
+   if (c == '\n') {
+      return CHAR_NEWLINE | byte;
+   }
+   if (c == ' ' || c == '\r' || c == '\t' || c == '\v' || c == '\f' ||
+       c == '\0') {
+      return CHAR_SPACE | byte;
+   }
+   return CHAR_WORD | byte;
+}
+
+struct Tables
+{
+   uint16_t chars[2][TABLE_SIZE];
+   uint8_t trim[256];
+
+   Tables()
+   {
+      for (int32_t c = 0; c < TABLE_SIZE; c++) {
+         chars[0][c] = encodeChar(translateChar(static_cast<wchar_t>(c)));
+         chars[1][c] = encodeChar(transformChar(static_cast<wchar_t>(c)));
+      }
+      std::memset(trim, 0, sizeof(trim));
+      for (const char* s = "#@"; *s; s++) {
+         trim[static_cast<uint8_t>(*s)] |= TRIM_LEFT;
+      }
+      for (const char* s = "?!.,:;-"; *s; s++) {
+         trim[static_cast<uint8_t>(*s)] |= TRIM_RIGHT;
+      }
+      for (const char* s = "'/)(\""; *s; s++) {
+         trim[static_cast<uint8_t>(*s)] |= TRIM_QUOTE;
+      }
+   }
+};
+
+const Tables& tables()
+{
+   static const Tables t;
+   return t;
+}
+
+inline uint16_t normalizeChar(int32_t c, const uint16_t* table)
+{
+   if (c < TABLE_SIZE) {
+      return table[c];
+   }
+   if (c > 0xFFFF) {
+      return CHAR_SPACE | ' ';
+   }
+   // Above the table only A-Z differ between translate and transform.
+   return encodeChar(translateChar(static_cast<wchar_t>(c)));
+}
+
+inline uint32_t countTrailingZeros(uint32_t x)
+{
+#ifdef _MSC_VER
+   unsigned long i;
+   _BitScanForward(&i, x);
+   return i;
+#else
+   return __builtin_ctz(x);
+#endif
+}
+
+// Length of the run of bytes in [0x21, 0x7f] at p: ASCII characters that
+// never end a word. They are still normalised through the tables.
+size_t asciiWordRun(const char* p, size_t n)
+{
+   size_t i = 0;
+#if defined(__AVX2__)
+   const __m256i space32 = _mm256_set1_epi8(0x20);
+   for (; i + 32 <= n; i += 32) {
+      const __m256i v =
+         _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+      const uint32_t mask = ~static_cast<uint32_t>(
+         _mm256_movemask_epi8(_mm256_cmpgt_epi8(v, space32)));
+      if (mask) {
+         return i + countTrailingZeros(mask);
+      }
+   }
+#endif
+#ifdef FASTTEXT_TOKENIZER_SSE2
+   // Signed compare: bytes >= 0x80 are negative and end the run as well.
+   const __m128i space = _mm_set1_epi8(0x20);
+   for (; i + 16 <= n; i += 16) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+      const uint32_t mask =
+         ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(v, space))) &
+         0xFFFF;
+      if (mask) {
+         return i + countTrailingZeros(mask);
+      }
+   }
+#endif
+   while (i < n && static_cast<int8_t>(p[i]) > 0x20) {
+      i++;
+   }
+   return i;
+}
+
+inline bool isContinuation(uint8_t b)
+{
+   return (b & 0xC0) == 0x80;
+}
+
+// Decodes the UTF-8 sequence at p into c and returns its length. Returns 0
+// if the n available bytes are a valid but incomplete prefix. Malformed
+// bytes (overlong forms, surrogates, stray continuation bytes) decode one at
+// a time to INVALID_CHAR.
+size_t decodeUtf8(const uint8_t* p, size_t n, int32_t& c)
+{
+   const uint8_t b = p[0];
+   size_t len;
+   uint8_t lo = 0x80, hi = 0xBF;
+
+   if (b < 0x80) {
+      c = b;
+      return 1;
+   } else if (b >= 0xC2 && b <= 0xDF) {
+      len = 2;
+      c = b & 0x1F;
+   } else if (b >= 0xE0 && b <= 0xEF) {
+      len = 3;
+      c = b & 0x0F;
+      if (b == 0xE0) {
+         lo = 0xA0;
+      } else if (b == 0xED) {
+         hi = 0x9F;
+      }
+   } else if (b >= 0xF0 && b <= 0xF4) {
+      len = 4;
+      c = b & 0x07;
+      if (b == 0xF0) {
+         lo = 0x90;
+      } else if (b == 0xF4) {
+         hi = 0x8F;
+      }
+   } else {
+      c = INVALID_CHAR;
+      return 1;
+   }
+   for (size_t i = 1; i < len; i++) {
+      if (i == n) {
+         return 0;
+      }
+      const uint8_t b1 = p[i];
+      if (i == 1 ? (b1 < lo || b1 > hi) : !isContinuation(b1)) {
+         c = INVALID_CHAR;
+         return 1;
+      }
+      c = (c << 6) | (b1 & 0x3F);
+   }
+   return len;
+}
+
+// Applies ltrim("#@"), rtrim("?!.,:;-") and trim("'/)(\"") to word, in
+// that order. Returns true if rtrim removed anything.
+bool trimWord(std::string& word, const uint8_t* trim)
+{
+   size_t b = 0, e = word.size();
+   while (b < e && (trim[static_cast<uint8_t>(word[b])] & TRIM_LEFT)) {
+      b++;
+   }
+   const size_t prev = e;
+   while (e > b && (trim[static_cast<uint8_t>(word[e - 1])] & TRIM_RIGHT)) {
+      e--;
+   }
+   const bool trimmed = (e != prev);
+   while (e > b && (trim[static_cast<uint8_t>(word[e - 1])] & TRIM_QUOTE)) {
+      e--;
+   }
+   while (b < e && (trim[static_cast<uint8_t>(word[b])] & TRIM_QUOTE)) {
+      b++;
+   }
+   word.erase(e);
+   word.erase(0, b);
+   return trimmed;
+}
+
+} // namespace
+
+Tokenizer::Tokenizer(std::istream& in, int64_t limit)
+   : in_(in), buffer_(BUFFER_SIZE), pos_(0), end_(0), limit_(limit),
+     remaining_(limit), eof_(false), pendingEOS_(false)
+{}
+
+// Moves the unread bytes (at most an incomplete UTF-8 sequence when called
+// from readWord) to the front of the buffer and appends what the stream
+// has. Returns false, and marks the end of the input, if nothing was read.
+bool Tokenizer::refill()
+{
+   typedef std::char_traits<char> traits;
+
+   const size_t left = end_ - pos_;
+   std::memmove(buffer_.data(), buffer_.data() + pos_, left);
+   pos_ = 0;
+   end_ = left;
+
+   size_t room = buffer_.size() - end_;
+   if (remaining_ >= 0) {
+      room = std::min<size_t>(room, remaining_);
+   }
+   std::streambuf& sb = *in_.rdbuf();
+   const std::streamsize avail = room > 0 ? sb.in_avail() : 0;
+   if (avail > 0) {
+      const std::streamsize n = std::min<std::streamsize>(avail, room);
+      end_ += sb.sgetn(buffer_.data() + end_, n);
+   } else {
+      // Unbuffered source (e.g. stdin synced with stdio): read up to the end
+      // of the line, so interactive input is answered line by line.
+      traits::int_type c;
+      while (end_ < left + room &&
+             !traits::eq_int_type(c = sb.sbumpc(), traits::eof())) {
+         buffer_[end_++] = traits::to_char_type(c);
+         if (c == '\n') {
+            break;
+         }
+      }
+   }
+   if (end_ == left) {
+      eof_ = true;
+      in_.setstate(std::ios::eofbit);
+      return false;
+   }
+   if (remaining_ >= 0) {
+      remaining_ -= end_ - left;
+   }
+   return true;
+}
+
+bool Tokenizer::eof()
+{
+   return pos_ == end_ && !refill();
+}
+
+bool Tokenizer::exhausted() const
+{
+   return eof_;
+}
+
+void Tokenizer::rewind()
+{
+   in_.clear();
+   in_.seekg(std::streampos(0));
+   pos_ = 0;
+   end_ = 0;
+   remaining_ = limit_;
+   eof_ = false;
+   pendingEOS_ = false;
+}
+
+bool Tokenizer::readWord(std::string& word, bool lower)
+{
+   const Tables& t = tables();
+   const uint16_t* table = t.chars[lower ? 1 : 0];
+
+   word.clear();
+   if (pendingEOS_)
+   {
+      pendingEOS_ = false;
+      return true;
+   }
+   while (pos_ < end_ || refill())
+   {
+      const char* p = buffer_.data() + pos_;
+      const size_t n = end_ - pos_;
+
+      const size_t run = asciiWordRun(p, n);
+      if (run > 0)
+      {
+         // both tables change some of these bytes, e.g. '`' becomes '\''
+         const size_t size = word.size();
+         word.append(p, run);
+         for (size_t i = size; i < word.size(); i++) {
+            word[i] = static_cast<char>(table[static_cast<uint8_t>(word[i])]);
+         }
+         pos_ += run;
+         continue;
+      }
+
+      int32_t c;
+      size_t len = decodeUtf8(reinterpret_cast<const uint8_t*>(p), n, c);
+      if (len == 0)
+      {
+         if (refill()) {
+            continue;
+         }
+         c = INVALID_CHAR;
+         len = 1;
+      }
+      pos_ += len;
+
+      const uint16_t ch = normalizeChar(c, table);
+      if ((ch & CHAR_KIND) == CHAR_WORD)
+      {
+         word.push_back(static_cast<char>(ch & 0xFF));
+         continue;
+      }
+      bool newline = (ch & CHAR_KIND) == CHAR_NEWLINE;
+      if (trimWord(word, t.trim)) {
+         newline = true;
+      }
+      if (word.empty())
+      {
+         if (newline) {
+            return true;
+         }
+         continue;
+      }
+      pendingEOS_ = newline;
+      return true;
+   }
+   return !word.empty();
+}
+
+bool Tokenizer::readLine(std::string& line)
+{
+   line.clear();
+   while (pos_ < end_ || refill())
+   {
+      const char* p = buffer_.data() + pos_;
+      const size_t n = end_ - pos_;
+      const char* nl = static_cast<const char*>(std::memchr(p, '\n', n));
+      if (nl)
+      {
+         line.append(p, nl - p);
+         pos_ += nl - p + 1;
+         return true;
+      }
+      line.append(p, n);
+      pos_ = end_;
+   }
+   return !line.empty();
+}
+
+// Same as translate_wstr / transform_wstr on the decoded text: every
+// normalised character but '\0' is kept.
+std::string Tokenizer::normalize(const std::string& text, bool lower)
+{
+   const uint16_t* table = tables().chars[lower ? 1 : 0];
+   const uint8_t* p = reinterpret_cast<const uint8_t*>(text.data());
+   const size_t n = text.size();
+   std::string result;
+   result.reserve(n);
+
+   for (size_t i = 0; i < n;)
+   {
+      int32_t c;
+      size_t len = decodeUtf8(p + i, n - i, c);
+      if (len == 0) {
+         c = INVALID_CHAR;
+         len = 1;
+      }
+      i += len;
+      const char ch = static_cast<char>(normalizeChar(c, table) & 0xFF);
+      if (ch) {
+         result.push_back(ch);
+      }
+   }
+   return result;
+}
+
+} // namespace fasttext
@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace fasttext {
+
+// Splits UTF-8 text into the words used by Dictionary. Input is read in
+// blocks and decoded byte-wise: runs of plain ASCII are found with SIMD
+// compares, other characters are normalised through tables built from
+// translateChar / transformChar, so the words are those of the former
+// wide-stream reader.
+//
+// A Tokenizer also holds the reading state of its stream: a word may end on
+// a sentence boundary, which is reported by the following call. Every reader
+// (a training thread, test, predict) owns its Tokenizer and readers never
+// share state. A limit makes the Tokenizer stop after that many bytes, e.g.
+// at the end of the byte range assigned to a thread.
+class Tokenizer {
+ protected:
+  static const size_t BUFFER_SIZE = 1 << 16;
+
+  std::istream& in_;
+  std::vector<char> buffer_;
+  size_t pos_;
+  size_t end_;
+  int64_t limit_;
+  int64_t remaining_;
+  bool eof_;
+  bool pendingEOS_;
+
+  bool refill();
+
+ public:
+  explicit Tokenizer(std::istream& in, int64_t limit = -1);
+  Tokenizer(const Tokenizer&) = delete;
+  Tokenizer& operator=(const Tokenizer&) = delete;
+
+  inline std::istream& stream() {
+    return in_;
+  }
+  bool eof();
+  bool exhausted() const;
+  void rewind();
+  bool readWord(std::string& word, bool lower);
+  bool readLine(std::string& line);
+
+  static std::string normalize(const std::string& text, bool lower);
+};
+
+} // namespace fasttext
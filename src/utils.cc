@@ -8,11 +8,25 @@
 
 #include "utils.h"
 
+#include <cstdio>
+#include <cstring>
 #include <iomanip>
 #include <ios>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace fasttext {
 
 namespace utils {
@@ -29,6 +43,27 @@ void seek(std::ifstream& ifs, int64_t pos)
   ifs.seekg(std::streampos(pos));
 }
 
+// Returns the offset of the first line starting at or after pos. Since '\n'
+// never occurs inside a multi-byte UTF-8 sequence, the result is also a
+// character boundary.
+int64_t nextLine(std::ifstream& ifs, int64_t pos)
+{
+  if (pos <= 0) {
+    return 0;
+  }
+  int64_t offset = pos - 1;
+  seek(ifs, offset);
+  std::streambuf& sb = *ifs.rdbuf();
+  int c;
+  while ((c = sb.sbumpc()) != std::char_traits<char>::eof()) {
+    offset++;
+    if (c == '\n') {
+      return offset;
+    }
+  }
+  return offset;
+}
+
 double getDuration(
     const std::chrono::steady_clock::time_point& start,
     const std::chrono::steady_clock::time_point& end)
@@ -56,6 +91,199 @@ bool compareFirstLess(const std::pair<double, double>& l, const double& r)
   return l.first < r;
 }
 
+bool replaceFile(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+  // rename does not replace an existing file on Windows
+  return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filename, bool copyOnWrite)
+   : data_(nullptr), size_(0), file_(nullptr), mapping_(nullptr)
+{
+  HANDLE file = CreateFileA(
+      filename.c_str(),
+      GENERIC_READ,
+      // saving a model replaces the file, which may be this one
+      FILE_SHARE_READ | FILE_SHARE_DELETE,
+      nullptr,
+      OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL,
+      nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw std::invalid_argument(filename + " cannot be opened for mapping!");
+  }
+  file_ = file;
+  LARGE_INTEGER size;
+  GetFileSizeEx(file, &size);
+  size_ = size.QuadPart;
+  if (size_ == 0) {
+    return;
+  }
+  HANDLE mapping = CreateFileMappingA(
+      file,
+      nullptr,
+      copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY,
+      0,
+      0,
+      nullptr);
+  if (mapping == nullptr) {
+    CloseHandle(file);
+    throw std::invalid_argument(filename + " cannot be mapped!");
+  }
+  mapping_ = mapping;
+  data_ = (char*)MapViewOfFile(
+      mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+  if (data_ == nullptr) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    throw std::invalid_argument(filename + " cannot be mapped!");
+  }
+}
+
+MappedFile::~MappedFile()
+{
+  if (data_) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_) {
+    CloseHandle((HANDLE)mapping_);
+  }
+  if (file_) {
+    CloseHandle((HANDLE)file_);
+  }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filename, bool copyOnWrite)
+   : data_(nullptr), size_(0)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::invalid_argument(filename + " cannot be opened for mapping!");
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::invalid_argument(filename + " cannot be opened for mapping!");
+  }
+  size_ = st.st_size;
+  if (size_ > 0) {
+    int prot = PROT_READ;
+    int flags = MAP_SHARED;
+    if (copyOnWrite) {
+      prot |= PROT_WRITE;
+      flags = MAP_PRIVATE;
+#ifdef MAP_NORESERVE
+      // pages are only copied when written, which loaded models rarely are
+      flags |= MAP_NORESERVE;
+#endif
+    }
+    void* addr = mmap(nullptr, size_, prot, flags, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      throw std::invalid_argument(filename + " cannot be mapped!");
+    }
+    data_ = (char*)addr;
+  }
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+  if (data_) {
+    munmap((void*)data_, size_);
+  }
+}
+
+#endif
+
+MemoryBuffer::MemoryBuffer(const char* data, int64_t size)
+{
+  char* begin = const_cast<char*>(data);
+  setg(begin, begin, begin + size);
+}
+
+MemoryBuffer::pos_type MemoryBuffer::seekoff(
+    off_type off,
+    std::ios_base::seekdir dir,
+    std::ios_base::openmode which)
+{
+  if (!(which & std::ios_base::in)) {
+    return pos_type(off_type(-1));
+  }
+  off_type base = 0;
+  if (dir == std::ios_base::cur) {
+    base = gptr() - eback();
+  } else if (dir == std::ios_base::end) {
+    base = egptr() - eback();
+  }
+  off_type pos = base + off;
+  if (pos < 0 || pos > egptr() - eback()) {
+    return pos_type(off_type(-1));
+  }
+  setg(eback(), eback() + pos, egptr());
+  return pos_type(pos);
+}
+
+MemoryBuffer::pos_type MemoryBuffer::seekpos(
+    pos_type pos,
+    std::ios_base::openmode which)
+{
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+HashBuffer::HashBuffer() : hash_(0x84222325cbf29ce4ULL), size_(0)
+{
+  setp(buffer_, buffer_ + BUFFER_SIZE);
+}
+
+void HashBuffer::consume()
+{
+  const int64_t bytes = pptr() - pbase();
+  const int64_t words = bytes / sizeof(uint64_t);
+  for (int64_t i = 0; i < words; i++) {
+    uint64_t word;
+    std::memcpy(&word, buffer_ + i * sizeof(uint64_t), sizeof(uint64_t));
+    hash_ = (hash_ ^ word) * 0x9e3779b97f4a7c15ULL;
+    hash_ ^= hash_ >> 29;
+  }
+  const int64_t rest = bytes - words * sizeof(uint64_t);
+  std::memmove(buffer_, buffer_ + words * sizeof(uint64_t), rest);
+  size_ += words * sizeof(uint64_t);
+  setp(buffer_, buffer_ + BUFFER_SIZE);
+  pbump(rest);
+}
+
+HashBuffer::int_type HashBuffer::overflow(int_type c)
+{
+  consume();
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+uint64_t HashBuffer::digest()
+{
+  consume();
+  // the last bytes, padded with zeros, and the length
+  uint64_t last = 0;
+  const int64_t rest = pptr() - pbase();
+  std::memcpy(&last, buffer_, rest);
+  uint64_t hash = (hash_ ^ last) * 0x9e3779b97f4a7c15ULL;
+  hash = (hash ^ (hash >> 29) ^ (size_ + rest)) * 0xbf58476d1ce4e5b9ULL;
+  return hash ^ (hash >> 32);
+}
+
 } // namespace utils
 
 } // namespace fasttext
@@ -12,8 +12,12 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <fstream>
+#include <ios>
 #include <ostream>
+#include <streambuf>
+#include <string>
 #include <vector>
 #include <utility>
 
@@ -35,6 +39,8 @@ int64_t size(std::ifstream&);
 
 void seek(std::ifstream&, int64_t);
 
+int64_t nextLine(std::ifstream&, int64_t);
+
 template <typename T>
 bool contains(const std::vector<T>& container, const T& value) {
   return std::find(container.begin(), container.end(), value) !=
@@ -68,6 +74,103 @@ class ClockPrint {
 
 bool compareFirstLess(const std::pair<double, double>& l, const double& r);
 
+// Renames from over to, replacing to in one step if it exists. Returns false
+// on failure.
+bool replaceFile(const std::string& from, const std::string& to);
+
+// xorshift64* generator. It takes a few instructions per 64 random bits,
+// for draws in the inner loop of training where std::minstd_rand and the
+// standard distributions cost more than the work they select.
+class FastRandom {
+ public:
+  explicit FastRandom(uint64_t seed) {
+    // splitmix64 of the seed, so that close seeds give unrelated streams
+    // and the state is never 0
+    uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    state_ = (z ^ (z >> 31)) | 1;
+  }
+
+  inline uint64_t operator()() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 0x2545f4914f6cdd1dULL;
+  }
+
+ private:
+  uint64_t state_;
+};
+
+// Mapping of a whole file into memory. The mapping is read-only, unless
+// copyOnWrite is set: pages may then be written, and a written page becomes
+// private to the process while the file itself is left untouched.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& filename, bool copyOnWrite = false);
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile();
+
+  inline const char* data() const {
+    return data_;
+  }
+  inline char* data() {
+    return data_;
+  }
+  inline int64_t size() const {
+    return size_;
+  }
+
+ private:
+  char* data_;
+  int64_t size_;
+#ifdef _WIN32
+  void* file_;
+  void* mapping_;
+#endif
+};
+
+// Input stream buffer over a block of memory, e.g. a MappedFile. Reads do not
+// copy anything but what is asked for, and tellg() on a stream using it gives
+// the offset of the next byte in the block.
+class MemoryBuffer : public std::streambuf {
+ public:
+  MemoryBuffer(const char* data, int64_t size);
+
+ protected:
+  pos_type seekoff(
+      off_type off,
+      std::ios_base::seekdir dir,
+      std::ios_base::openmode which) override;
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+};
+
+// Output stream buffer that keeps a 64-bit hash of the bytes written to it
+// instead of the bytes, e.g. to fingerprint what a save writes.
+class HashBuffer : public std::streambuf {
+ public:
+  HashBuffer();
+  HashBuffer(const HashBuffer&) = delete;
+  HashBuffer& operator=(const HashBuffer&) = delete;
+
+  // Hash of all the bytes written so far.
+  uint64_t digest();
+
+ protected:
+  int_type overflow(int_type c) override;
+
+ private:
+  static constexpr int64_t BUFFER_SIZE = 4096;
+  // Hashes the whole words of the buffer and keeps the other bytes.
+  void consume();
+
+  char buffer_[BUFFER_SIZE];
+  uint64_t hash_;
+  uint64_t size_;
+};
+
 } // namespace utils
 
 } // namespace fasttext
@@ -48,6 +48,7 @@ class Vector {
   void zero();
   void mul(real);
   real norm() const;
+  bool isFinite() const;
   void addVector(const Vector& source);
   void addVector(const Vector&, real);
   void addRow(const Matrix&, int64_t);
@@ -0,0 +1,22 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+// Stops the test with the failed condition, whatever NDEBUG says.
+#define CHECK(cond)                                                       \
+  do {                                                                    \
+    if (!(cond)) {                                                        \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #cond \
+                << std::endl;                                             \
+      std::exit(1);                                                       \
+    }                                                                     \
+  } while (0)
@@ -0,0 +1,113 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "check.h"
+#include "densematrix.h"
+#include "utils.h"
+
+using namespace fasttext;
+
+DenseMatrix testMatrix(int64_t m, int64_t n)
+{
+  DenseMatrix matrix(m, n);
+  matrix.uniform(1.0, 1, m);
+  return matrix;
+}
+
+bool sameValues(const DenseMatrix& a, const DenseMatrix& b)
+{
+  if (a.rows() != b.rows() || a.cols() != b.cols()) {
+    return false;
+  }
+  for (int64_t i = 0; i < a.rows(); i++) {
+    for (int64_t j = 0; j < a.cols(); j++) {
+      if (a.at(i, j) != b.at(i, j)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Writes prefix bytes, then the matrices, and loads them back from a mapping
+// of the file: the values must be used in place, at an aligned address.
+void testMapped(const std::string& filename, int32_t prefix)
+{
+  DenseMatrix first = testMatrix(7, 3);
+  DenseMatrix second = testMatrix(5, 11);
+  {
+    std::ofstream ofs(filename, std::ofstream::binary);
+    ofs << std::string(prefix, 'x');
+    first.save(ofs);
+    second.save(ofs);
+  }
+  auto mapping = std::make_shared<utils::MappedFile>(filename, true);
+  utils::MemoryBuffer buffer(mapping->data(), mapping->size());
+  std::istream in(&buffer);
+  in.ignore(prefix);
+  DenseMatrix loadedFirst, loadedSecond;
+  loadedFirst.load(in, mapping);
+  loadedSecond.load(in, mapping);
+  CHECK(in.tellg() == mapping->size());
+  for (const DenseMatrix* loaded : {&loadedFirst, &loadedSecond}) {
+    const char* data = (const char*)loaded->data();
+    CHECK(data >= mapping->data());
+    CHECK(data < mapping->data() + mapping->size());
+    CHECK((data - mapping->data()) % 64 == 0);
+  }
+  CHECK(sameValues(first, loadedFirst));
+  CHECK(sameValues(second, loadedSecond));
+  std::remove(filename.c_str());
+}
+
+// Files before version 13 have no padding after the header.
+void testUnpadded(const std::string& filename)
+{
+  DenseMatrix matrix = testMatrix(6, 5);
+  {
+    std::ofstream ofs(filename, std::ofstream::binary);
+    ofs << "x";
+    const int64_t m = matrix.rows(), n = matrix.cols();
+    ofs.write((char*)&m, sizeof(int64_t));
+    ofs.write((char*)&n, sizeof(int64_t));
+    ofs.write((char*)matrix.data(), m * n * sizeof(real));
+  }
+  auto mapping = std::make_shared<utils::MappedFile>(filename, true);
+  utils::MemoryBuffer buffer(mapping->data(), mapping->size());
+  std::istream in(&buffer);
+  in.ignore(1);
+  DenseMatrix loaded(12);
+  loaded.load(in, mapping);
+  CHECK(in.tellg() == mapping->size());
+  CHECK(sameValues(matrix, loaded));
+  std::remove(filename.c_str());
+}
+
+int main()
+{
+  DenseMatrix matrix = testMatrix(9, 4);
+  std::stringstream stream;
+  matrix.save(stream);
+  DenseMatrix loaded;
+  loaded.load(stream);
+  CHECK(sameValues(matrix, loaded));
+
+  const std::string filename = "fasttext-densematrix-test.bin";
+  for (int32_t prefix = 0; prefix < 70; prefix += 3) {
+    testMapped(filename, prefix);
+  }
+  testUnpadded(filename);
+  return 0;
+}
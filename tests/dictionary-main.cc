@@ -7,8 +7,6 @@
 #include <iostream>
 #include <fstream>
 
-#include <codecvt>
-#include <locale>
 #include <cassert>
 
 #include "fasttext.h"
@@ -74,16 +72,17 @@ void test_nn()
    bool printProb = true;
    std::vector<std::pair<real, std::string>> predictions;
 
-   std::wstringstream s0(L"data specialist");   // science
-   std::wstringstream s1(L"data structures");   // entity
-   std::wstringstream s2(L"data algorithms");   // entity
-   std::wstringstream s3(L"learn language");    // 10:[c++, python, java, javascript, kotlin, php, golang, swift, c-language, c#]
-   std::wstringstream s4(L"data entity");       // 4:[structures, algorithms, mathematical, science]
-   std::wistream& in = s4;
+   std::stringstream s0("data specialist");   // science
+   std::stringstream s1("data structures");   // entity
+   std::stringstream s2("data algorithms");   // entity
+   std::stringstream s3("learn language");    // 10:[c++, python, java, javascript, kotlin, php, golang, swift, c-language, c#]
+   std::stringstream s4("data entity");       // 4:[structures, algorithms, mathematical, science]
+   std::istream& in = s4;
+   fasttext::Tokenizer tokenizer(in);
   
    while (in.good())
    {
-      if (!ft->predictNext(in, predictions, 10, threshold))
+      if (!ft->predictNext(tokenizer, predictions, 10, threshold))
       {
          break;
       }
@@ -104,8 +103,7 @@ int main()
 
    auto stopwords = std::make_shared<fasttext::Dictionary>(args, VOCAB_SZ);
    {
-      std::wifstream wsw(cstr_to_wstr(args->stopwords));
-      wsw.imbue(std::locale(std::locale::empty(), new std::codecvt_utf8<wchar_t>));
+      std::ifstream wsw(cstr_to_wstr(args->stopwords));
       stopwords->readFromFile(wsw, nullptr);
       wsw.close();
    }
@@ -113,21 +111,20 @@ int main()
 
    fasttext::Dictionary dictionary(args, VOCAB_SZ);
    {
-      std::wifstream wsw(L"train-data.txt");
-      wsw.imbue(std::locale(std::locale::empty(), new std::codecvt_utf8<wchar_t>));
+      std::ifstream wsw("train-data.txt");
       dictionary.readFromFile(wsw, stopwords);
       wsw.close();
       dictionary.dump(std::cout);
    }
    printf("<<-------------\n");
    {
-      std::wifstream wsw(L"train-data.txt");
+      std::ifstream wsw("train-data.txt");
       std::vector<int32_t> line;
-      wsw.imbue(std::locale(std::locale::empty(), new std::codecvt_utf8<wchar_t>));
+      fasttext::Tokenizer tokenizer(wsw);
 
       int32_t tokens = 0;
       int32_t ntokens = 0;
-      while ((tokens = dictionary.getLine(wsw, line, stopwords)) > 0)
+      while ((tokens = dictionary.getLine(tokenizer, line, stopwords)) > 0)
       {
          ntokens += tokens;
          if (!line.empty())
@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "check.h"
+#include "dictionary.h"
+
+using namespace fasttext;
+
+const int32_t NWORDS = 100000;
+
+std::string wordOf(int32_t i)
+{
+  return "w" + std::to_string(i);
+}
+
+// Word i is added 1 + i % 3 times.
+int64_t addWords(Dictionary& dict)
+{
+  int64_t ntokens = 0;
+  for (int32_t pass = 0; pass < 3; pass++) {
+    for (int32_t i = 0; i < NWORDS; i++) {
+      if (i % 3 >= pass) {
+        dict.add(wordOf(i));
+        ntokens++;
+      }
+    }
+  }
+  return ntokens;
+}
+
+// Every word kept by the dictionary is found, with its count, and the
+// others are not.
+void checkWords(const Dictionary& dict, int64_t minCount)
+{
+  std::vector<int64_t> counts = dict.getCounts(entry_type::word);
+  int32_t kept = 0;
+  for (int32_t i = 0; i < NWORDS; i++) {
+    const int32_t id = dict.getId(wordOf(i));
+    if (1 + i % 3 < minCount) {
+      CHECK(id == -1);
+      continue;
+    }
+    CHECK(id >= 0 && id < dict.nwords());
+    CHECK(dict.getWord(id) == wordOf(i));
+    CHECK(counts[id] == 1 + i % 3);
+    kept++;
+  }
+  CHECK(kept == dict.nwords());
+  CHECK(dict.getId("w") == -1);
+  CHECK(dict.getId(wordOf(NWORDS)) == -1);
+}
+
+int main()
+{
+  auto args = std::make_shared<Args>();
+  args->minCount = 1;
+  args->maxn = 0;
+
+  // from the smallest table, through many doublings
+  Dictionary dict(args);
+  CHECK(addWords(dict) == dict.ntokens());
+  dict.threshold(1, 1);
+  checkWords(dict, 1);
+
+  // sized up front, as for -vocabSz and stopword lists
+  Dictionary sized(args, NWORDS);
+  addWords(sized);
+  sized.threshold(1, 1);
+  checkWords(sized, 1);
+
+  // threshold rebuilds the table with the kept words only
+  dict.threshold(2, 1);
+  checkWords(dict, 2);
+
+  std::stringstream stream;
+  dict.save(stream);
+  Dictionary loaded(args, stream);
+  checkWords(loaded, 2);
+  return 0;
+}
@@ -0,0 +1,131 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "args.h"
+#include "check.h"
+#include "densematrix.h"
+#include "fasttext.h"
+#include "matrix.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace fasttext {
+
+// Supervised model of dim dimensions, trained on a file written at input:
+// lines of red fruits labeled __label__red and of green plants labeled
+// __label__green.
+inline std::shared_ptr<FastText> trainModel(
+    const std::string& input,
+    int dim)
+{
+  std::ofstream out(input);
+  for (int i = 0; i < 50; i++) {
+    out << "__label__red apple cherry tomato\n"
+        << "__label__green leaf grass lime\n";
+  }
+  out.close();
+  Args args;
+  args.input = input;
+  args.model = model_name::sup;
+  args.loss = loss_name::softmax;
+  args.minCount = 1;
+  args.dim = dim;
+  args.epoch = 5;
+  args.thread = 1;
+  args.verbose = 0;
+  auto fasttext = std::make_shared<FastText>();
+  fasttext->train(args);
+  return fasttext;
+}
+
+// Matrix of m rows of n values uniform in [-1, 1], different for each shape.
+inline DenseMatrix randomMatrix(int64_t m, int64_t n)
+{
+  DenseMatrix matrix(m, n);
+  matrix.uniform(1.0, 1, m + n);
+  return matrix;
+}
+
+// Vector of n values with no two the same, to score rows with.
+inline Vector testVector(int64_t n)
+{
+  Vector vec(n);
+  for (int64_t j = 0; j < n; j++) {
+    vec[j] = std::sin(j + 1);
+  }
+  return vec;
+}
+
+// Row i of matrix, as its Matrix::addRowToVector decodes it.
+inline Vector decodedRow(const Matrix& matrix, int64_t i)
+{
+  Vector x(matrix.size(1));
+  x.zero();
+  matrix.addRowToVector(x, i);
+  return x;
+}
+
+// Checks that other decodes and scores every row as matrix does.
+inline void checkSameRows(const Matrix& matrix, const Matrix& other)
+{
+  CHECK(other.size(0) == matrix.size(0));
+  CHECK(other.size(1) == matrix.size(1));
+  const int64_t m = matrix.size(0), n = matrix.size(1);
+  Vector vec = testVector(n);
+  Vector scores(m), otherScores(m);
+  matrix.dotRows(vec, scores);
+  other.dotRows(vec, otherScores);
+  for (int64_t i = 0; i < m; i++) {
+    CHECK(scores[i] == otherScores[i]);
+    CHECK(matrix.dotRow(vec, i) == other.dotRow(vec, i));
+    Vector a = decodedRow(matrix, i), b = decodedRow(other, i);
+    for (int64_t j = 0; j < n; j++) {
+      CHECK(a[j] == b[j]);
+    }
+  }
+}
+
+// Saves matrix and checks that loading it back, from a stream and from a
+// mapping of a file at an odd offset, gives the same rows.
+template <typename T>
+void checkSaveLoad(const T& matrix, const std::string& filename)
+{
+  std::stringstream stream;
+  matrix.save(stream);
+  T loaded;
+  loaded.load(stream);
+  checkSameRows(matrix, loaded);
+
+  {
+    std::ofstream ofs(filename, std::ofstream::binary);
+    ofs << "x";
+    matrix.save(ofs);
+  }
+  {
+    auto mapping = std::make_shared<utils::MappedFile>(filename, true);
+    utils::MemoryBuffer buffer(mapping->data(), mapping->size());
+    std::istream in(&buffer);
+    in.ignore(1);
+    T mapped;
+    mapped.load(in, mapping);
+    CHECK(in.tellg() == mapping->size());
+    checkSameRows(matrix, mapped);
+  }
+  std::remove(filename.c_str());
+}
+
+} // namespace fasttext
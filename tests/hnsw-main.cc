@@ -0,0 +1,233 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "args.h"
+#include "check.h"
+#include "densematrix.h"
+#include "fasttext.h"
+#include "hnsw.h"
+#include "vector.h"
+
+using namespace fasttext;
+
+const int64_t ROWS = 3000;
+const int64_t DIM = 16;
+const int32_t K = 10;
+const int32_t M = 8;
+const uint64_t CHECKSUM = 42;
+
+// Unit rows of random directions, as the word vectors of getNN.
+DenseMatrix randomVectors(int64_t m, int64_t n, int32_t seed)
+{
+  std::minstd_rand rng(seed);
+  std::normal_distribution<real> normal;
+  DenseMatrix vectors(m, n);
+  for (int64_t i = 0; i < m; i++) {
+    real norm = 0;
+    for (int64_t j = 0; j < n; j++) {
+      vectors.at(i, j) = normal(rng);
+      norm += vectors.at(i, j) * vectors.at(i, j);
+    }
+    for (int64_t j = 0; j < n; j++) {
+      vectors.at(i, j) /= std::sqrt(norm);
+    }
+  }
+  return vectors;
+}
+
+std::vector<int32_t> exactSearch(
+    const DenseMatrix& vectors,
+    const Vector& query,
+    int32_t k)
+{
+  std::vector<std::pair<real, int32_t>> scores;
+  for (int32_t i = 0; i < vectors.rows(); i++) {
+    scores.emplace_back(vectors.dotRow(query, i), i);
+  }
+  std::partial_sort(
+      scores.begin(),
+      scores.begin() + k,
+      scores.end(),
+      std::greater<std::pair<real, int32_t>>());
+  std::vector<int32_t> rows;
+  for (int32_t i = 0; i < k; i++) {
+    rows.push_back(scores[i].second);
+  }
+  return rows;
+}
+
+std::vector<int32_t> indexSearch(
+    const HnswIndex& index,
+    const Vector& query,
+    int32_t k)
+{
+  std::vector<int32_t> rows;
+  for (const auto& result : index.search(query, k, 64)) {
+    rows.push_back(result.second);
+  }
+  return rows;
+}
+
+// Fraction of the exact k best rows that the index finds.
+double recall(const DenseMatrix& vectors, const HnswIndex& index)
+{
+  DenseMatrix queries = randomVectors(200, DIM, 7);
+  int64_t found = 0, wanted = 0;
+  for (int64_t q = 0; q < queries.rows(); q++) {
+    Vector query(DIM);
+    query.zero();
+    queries.addRowToVector(query, q);
+    std::vector<int32_t> exact = exactSearch(vectors, query, K);
+    std::vector<int32_t> approximate = indexSearch(index, query, K);
+    CHECK(approximate.size() == size_t(K));
+    for (int32_t row : exact) {
+      found += std::count(approximate.begin(), approximate.end(), row);
+    }
+    wanted += K;
+  }
+  return double(found) / wanted;
+}
+
+bool loads(const DenseMatrix& vectors, uint64_t checksum, std::string bytes)
+{
+  HnswIndex index(vectors, checksum);
+  std::istringstream in(bytes);
+  try {
+    index.load(in);
+  } catch (const std::invalid_argument&) {
+    return false;
+  }
+  return true;
+}
+
+// Offsets in a saved index: the header, then a level byte per row, then
+// the bottom layer links of each row, a count and 2M slots.
+const size_t HEADER_SIZE = 48;
+
+size_t bottomLinks(int64_t row)
+{
+  return HEADER_SIZE + ROWS + row * (2 * M + 1) * sizeof(int32_t);
+}
+
+std::string withInt32(std::string bytes, size_t offset, int32_t value)
+{
+  std::memcpy(&bytes[offset], &value, sizeof(int32_t));
+  return bytes;
+}
+
+void testIndex()
+{
+  DenseMatrix vectors = randomVectors(ROWS, DIM, 1);
+  HnswIndex index(vectors, CHECKSUM);
+  index.build(M, 100, 1, 0);
+  CHECK(recall(vectors, index) >= 0.95);
+
+  std::ostringstream out;
+  index.save(out);
+  const std::string saved = out.str();
+  HnswIndex loaded(vectors, CHECKSUM);
+  std::istringstream in(saved);
+  loaded.load(in);
+  DenseMatrix queries = randomVectors(20, DIM, 3);
+  for (int64_t q = 0; q < queries.rows(); q++) {
+    Vector query(DIM);
+    query.zero();
+    queries.addRowToVector(query, q);
+    CHECK(indexSearch(index, query, K) == indexSearch(loaded, query, K));
+  }
+
+  CHECK(loads(vectors, CHECKSUM, saved));
+  CHECK(!loads(vectors, CHECKSUM + 1, saved));
+  CHECK(!loads(randomVectors(ROWS + 1, DIM, 1), CHECKSUM, saved));
+  CHECK(!loads(vectors, CHECKSUM, saved.substr(0, saved.size() - 1)));
+  CHECK(!loads(vectors, CHECKSUM, saved.substr(0, HEADER_SIZE + 10)));
+
+  // a level above the top one
+  std::string corrupted = saved;
+  corrupted[HEADER_SIZE + 5] = 100;
+  CHECK(!loads(vectors, CHECKSUM, corrupted));
+  corrupted[HEADER_SIZE + 5] = -1;
+  CHECK(!loads(vectors, CHECKSUM, corrupted));
+  // more links than slots, and links to no row
+  CHECK(!loads(vectors, CHECKSUM, withInt32(saved, bottomLinks(9), 2 * M + 1)));
+  CHECK(!loads(vectors, CHECKSUM, withInt32(saved, bottomLinks(9), -1)));
+  CHECK(!loads(
+      vectors, CHECKSUM, withInt32(saved, bottomLinks(9) + 4, int32_t(ROWS))));
+  CHECK(!loads(vectors, CHECKSUM, withInt32(saved, bottomLinks(9) + 4, -2)));
+  // an entry point past the rows
+  CHECK(!loads(vectors, CHECKSUM, withInt32(saved, 40, int32_t(ROWS))));
+}
+
+// The index saved for a model is rejected by a model trained again, with
+// the same words and dimension.
+void testStaleIndex()
+{
+  const std::string input = "fasttext-hnsw-test.txt";
+  const std::string indexFile = "fasttext-hnsw-test.hnsw";
+  std::ofstream text(input);
+  std::minstd_rand rng(5);
+  for (int i = 0; i < 2000; i++) {
+    for (int j = 0; j < 10; j++) {
+      text << "w" << rng() % 200 << " ";
+    }
+    text << "\n";
+  }
+  text.close();
+  Args args;
+  args.input = input;
+  args.model = model_name::sg;
+  args.minCount = 1;
+  args.dim = DIM;
+  args.epoch = 1;
+  args.thread = 1;
+  args.verbose = 0;
+
+  FastText first;
+  first.train(args);
+  first.buildNNIndex(M, 50);
+  first.saveNNIndex(indexFile);
+  CHECK(first.wordVectorsChecksum() == first.wordVectorsChecksum());
+
+  args.seed = 2;
+  FastText second;
+  second.train(args);
+  CHECK(second.getWordsAmount() == first.getWordsAmount());
+  CHECK(second.wordVectorsChecksum() != first.wordVectorsChecksum());
+  bool rejected = false;
+  try {
+    second.loadNNIndex(indexFile);
+  } catch (const std::invalid_argument&) {
+    rejected = true;
+  }
+  CHECK(rejected && !second.hasNNIndex());
+
+  first.loadNNIndex(indexFile);
+  CHECK(first.hasNNIndex());
+
+  std::remove(input.c_str());
+  std::remove(indexFile.c_str());
+}
+
+int main()
+{
+  testIndex();
+  testStaleIndex();
+  return 0;
+}
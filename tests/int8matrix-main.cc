@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "densematrix.h"
+#include "fixtures.h"
+#include "int8matrix.h"
+#include "vector.h"
+
+using namespace fasttext;
+
+// Random rows, with a row of zeros and a row with one large value.
+DenseMatrix testMatrix(int64_t m, int64_t n)
+{
+  DenseMatrix matrix = randomMatrix(m, n);
+  for (int64_t j = 0; j < n; j++) {
+    matrix.at(1, j) = 0;
+  }
+  matrix.at(2, n / 2) = 50;
+  return matrix;
+}
+
+real largest(const real* x, int64_t n)
+{
+  real value = 0;
+  for (int64_t j = 0; j < n; j++) {
+    value = std::max(value, std::abs(x[j]));
+  }
+  return value;
+}
+
+void testMatrixOf(int64_t n)
+{
+  const int64_t m = 300;
+  DenseMatrix dense = testMatrix(m, n);
+  Int8Matrix quant(dense);
+  CHECK(quant.size(0) == m && quant.size(1) == n);
+
+  Vector vec = testVector(n);
+  const real vecLargest = largest(vec.data(), n);
+  Vector all(m);
+  quant.dotRows(vec, all);
+  for (int64_t i = 0; i < m; i++) {
+    const real* x = dense.data() + i * n;
+    const real step = largest(x, n) / 127;
+    // each value is off by at most half a step
+    Vector decoded = decodedRow(quant, i);
+    for (int64_t j = 0; j < n; j++) {
+      CHECK(std::abs(decoded[j] - x[j]) <= 0.5 * step * (1 + 1e-5));
+    }
+    // and so are the dot products, from the values of the row, and of the
+    // row and vec in dotRows
+    double exact = 0, rowBound = 0, bothBound = 0;
+    for (int64_t j = 0; j < n; j++) {
+      exact += double(x[j]) * vec[j];
+      rowBound += 0.5 * step * std::abs(vec[j]);
+      bothBound += 0.5 * step * std::abs(vec[j]) +
+          0.5 * vecLargest / 127 * (std::abs(x[j]) + 0.5 * step);
+    }
+    CHECK(std::abs(quant.dotRow(vec, i) - exact) <= rowBound * 1.001 + 1e-5);
+    CHECK(std::abs(all[i] - exact) <= bothBound * 1.001 + 1e-5);
+
+    Vector scaled(n);
+    scaled.zero();
+    quant.addRowToVector(scaled, i, 0.5);
+    for (int64_t j = 0; j < n; j++) {
+      CHECK(std::abs(scaled[j] - 0.5 * decoded[j]) <= 1e-6);
+    }
+  }
+
+  std::vector<int32_t> rows;
+  for (int32_t i = m - 1; i >= 0; i -= 3) {
+    rows.push_back(i);
+  }
+  std::vector<real> chosen(rows.size());
+  quant.dotRows(vec, rows.data(), rows.size(), chosen.data());
+  for (size_t r = 0; r < rows.size(); r++) {
+    CHECK(chosen[r] == all[rows[r]]);
+  }
+
+  bool thrown = false;
+  try {
+    quant.addVectorToRow(vec, 0, 1);
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  CHECK(thrown);
+
+  checkSaveLoad(quant, "fasttext-int8matrix-test.bin");
+}
+
+int main()
+{
+  for (int64_t n : {3, 16, 33, 100, 300}) {
+    testMatrixOf(n);
+  }
+  return 0;
+}
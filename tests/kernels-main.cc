@@ -0,0 +1,360 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "kernels.h"
+
+using namespace fasttext;
+
+// Compares every kernel with a plain double precision loop. The kernels are
+// picked once per process, so ctest runs this once per FASTTEXT_ISA level.
+
+std::minstd_rand rng(1);
+
+int64_t randomInt(int64_t lo, int64_t hi)
+{
+  return std::uniform_int_distribution<int64_t>(lo, hi)(rng);
+}
+
+real randomReal(real lo, real hi)
+{
+  return std::uniform_real_distribution<real>(lo, hi)(rng);
+}
+
+// n random values starting at a random offset of up to 15 values, so that
+// the kernels see every alignment.
+class Buffer {
+ public:
+  Buffer(int64_t n, real lo, real hi)
+      : storage_(n + 16), data_(storage_.data() + randomInt(0, 15))
+  {
+    for (int64_t i = 0; i < n; i++) {
+      data_[i] = randomReal(lo, hi);
+    }
+  }
+  real* data() {
+    return data_;
+  }
+  real& operator[](int64_t i) {
+    return data_[i];
+  }
+
+ private:
+  std::vector<real> storage_;
+  real* data_;
+};
+
+bool close(double got, double want, double tolerance)
+{
+  return std::fabs(got - want) <= tolerance;
+}
+
+// Tolerance of float sums of the given terms, for any order of summation.
+double sumTolerance(double absSum)
+{
+  return 1e-5 * absSum + 1e-6;
+}
+
+void testDense()
+{
+  for (int32_t it = 0; it < 500; it++) {
+    const int64_t n = randomInt(0, 300);
+    Buffer x(n, -1, 1), y(n, -1, 1);
+    const real a = randomReal(-2, 2);
+
+    double dot = 0, norm = 0, absSum = 0;
+    for (int64_t i = 0; i < n; i++) {
+      dot += double(x[i]) * y[i];
+      norm += double(x[i]) * x[i];
+      absSum += std::fabs(double(x[i]) * y[i]);
+    }
+    CHECK(close(kernels::dot(x.data(), y.data(), n), dot, sumTolerance(absSum)));
+    CHECK(close(kernels::squaredNorm(x.data(), n), norm, sumTolerance(norm)));
+
+    std::vector<real> before(y.data(), y.data() + n);
+    kernels::add(x.data(), y.data(), n);
+    for (int64_t i = 0; i < n; i++) {
+      CHECK(y[i] == before[i] + x[i]);
+    }
+    before.assign(y.data(), y.data() + n);
+    kernels::axpy(a, x.data(), y.data(), n);
+    for (int64_t i = 0; i < n; i++) {
+      CHECK(close(y[i], before[i] + double(a) * x[i], 1e-6));
+    }
+    before.assign(y.data(), y.data() + n);
+    kernels::scale(a, y.data(), n);
+    for (int64_t i = 0; i < n; i++) {
+      CHECK(y[i] == a * before[i]);
+    }
+
+    if (n > 0) {
+      real max = x[0];
+      for (int64_t i = 1; i < n; i++) {
+        max = std::max(max, x[i]);
+      }
+      CHECK(kernels::maxValue(x.data(), n) == max);
+    }
+
+    CHECK(kernels::allFinite(x.data(), n));
+    if (n > 0) {
+      const real bad[] = {std::numeric_limits<real>::quiet_NaN(),
+                          std::numeric_limits<real>::infinity(),
+                          -std::numeric_limits<real>::infinity()};
+      const int64_t i = randomInt(0, n - 1);
+      const real saved = x[i];
+      x[i] = bad[it % 3];
+      CHECK(!kernels::allFinite(x.data(), n));
+      x[i] = saved;
+    }
+  }
+}
+
+void testRows()
+{
+  for (int32_t it = 0; it < 300; it++) {
+    const int64_t m = randomInt(0, 40), n = randomInt(1, 200);
+    Buffer a(m * n, -1, 1), x(n, -1, 1), alpha(m, -1, 1);
+    std::vector<int32_t> rows(m);
+    for (int64_t r = 0; r < m; r++) {
+      rows[r] = randomInt(0, m - 1);
+    }
+    const int32_t* selected = it % 2 ? rows.data() : nullptr;
+    auto row = [&](int64_t r) {
+      return selected ? selected[r] : r;
+    };
+
+    std::vector<real> y(m);
+    kernels::gemv(a.data(), selected, m, n, x.data(), y.data());
+    for (int64_t r = 0; r < m; r++) {
+      double want = 0, absSum = 0;
+      for (int64_t j = 0; j < n; j++) {
+        want += double(a[row(r) * n + j]) * x[j];
+        absSum += std::fabs(double(a[row(r) * n + j]) * x[j]);
+      }
+      CHECK(close(y[r], want, sumTolerance(absSum)));
+    }
+
+    // rows may repeat: each update sees the ones before it
+    std::vector<double> a2(a.data(), a.data() + m * n), g2(n);
+    Buffer g(n, -1, 1);
+    for (int64_t j = 0; j < n; j++) {
+      g2[j] = g[j];
+    }
+    for (int64_t r = 0; r < m; r++) {
+      for (int64_t j = 0; j < n; j++) {
+        g2[j] += double(alpha[r]) * a2[row(r) * n + j];
+        a2[row(r) * n + j] += double(alpha[r]) * x[j];
+      }
+    }
+    kernels::updateRows(
+        alpha.data(), x.data(), a.data(), selected, m, n, g.data());
+    for (int64_t j = 0; j < n; j++) {
+      CHECK(close(g[j], g2[j], 1e-4));
+    }
+    for (int64_t i = 0; i < m * n; i++) {
+      CHECK(close(a[i], a2[i], 1e-5));
+    }
+
+    const int64_t p = randomInt(0, 20);
+    Buffer b(p * n, -1, 1);
+    std::vector<real> c(m * p);
+    kernels::gemm(a.data(), m, b.data(), p, n, c.data());
+    for (int64_t i = 0; i < p; i++) {
+      for (int64_t r = 0; r < m; r++) {
+        double want = 0, absSum = 0;
+        for (int64_t j = 0; j < n; j++) {
+          want += double(a[r * n + j]) * b[i * n + j];
+          absSum += std::fabs(double(a[r * n + j]) * b[i * n + j]);
+        }
+        CHECK(close(c[i * m + r], want, sumTolerance(absSum)));
+      }
+    }
+  }
+}
+
+void testNearest()
+{
+  for (int32_t it = 0; it < 2000; it++) {
+    const int64_t m = randomInt(1, 300), n = randomInt(1, 8);
+    Buffer ct(m * n, -1, 1), x(n, -1, 1);
+    // copies of the first point, which must not win over it
+    if (it % 5 == 0) {
+      for (int64_t r = m / 2; r < m; r++) {
+        for (int64_t j = 0; j < n; j++) {
+          ct[j * m + r] = ct[j * m];
+        }
+      }
+    }
+    std::vector<double> distances(m);
+    double best = std::numeric_limits<double>::infinity();
+    for (int64_t r = 0; r < m; r++) {
+      for (int64_t j = 0; j < n; j++) {
+        const double d = double(x[j]) - ct[j * m + r];
+        distances[r] += d * d;
+      }
+      best = std::min(best, distances[r]);
+    }
+    real distance;
+    const int64_t got = kernels::nearest(ct.data(), m, n, x.data(), &distance);
+    CHECK(got >= 0 && got < m);
+    CHECK(close(distance, distances[got], 1e-5));
+    CHECK(distances[got] <= best + 1e-5);
+    if (it % 5 == 0 && got >= m / 2) {
+      CHECK(distances[got] < distances[0]);
+    }
+  }
+}
+
+void testScan4()
+{
+  for (int32_t it = 0; it < 300; it++) {
+    const int64_t blocks = randomInt(1, 5), nt = 2 * randomInt(1, 30);
+    std::vector<uint8_t> codes(blocks * nt * 16), lut(nt * 16);
+    for (auto& code : codes) {
+      code = randomInt(0, 255);
+    }
+    for (auto& entry : lut) {
+      entry = randomInt(0, 255);
+    }
+    std::vector<uint16_t> out(blocks * 32);
+    kernels::scan4(codes.data(), blocks, nt, lut.data(), out.data());
+    for (int64_t b = 0; b < blocks; b++) {
+      for (int64_t i = 0; i < 32; i++) {
+        uint32_t want = 0;
+        for (int64_t t = 0; t < nt; t++) {
+          const uint8_t byte = codes[(b * nt + t) * 16 + i % 16];
+          want += lut[t * 16 + (i < 16 ? byte & 15 : byte >> 4)];
+        }
+        CHECK(out[b * 32 + i] == want);
+      }
+    }
+  }
+}
+
+void testInt8()
+{
+  for (int32_t it = 0; it < 300; it++) {
+    const int64_t m = randomInt(1, 20), n = randomInt(0, 300);
+    std::vector<int8_t> a(m * n), x8(n);
+    for (auto& v : a) {
+      v = randomInt(-127, 127);
+    }
+    for (auto& v : x8) {
+      v = randomInt(-127, 127);
+    }
+    Buffer x(n, -1, 1), y(n, -1, 1);
+    const real alpha = randomReal(-1, 1);
+
+    double dot = 0, absSum = 0;
+    for (int64_t j = 0; j < n; j++) {
+      dot += a[j] * double(x[j]);
+      absSum += std::fabs(a[j] * double(x[j]));
+    }
+    CHECK(close(kernels::dotInt8(a.data(), x.data(), n), dot, sumTolerance(absSum)));
+
+    std::vector<real> before(y.data(), y.data() + n);
+    kernels::axpyInt8(alpha, a.data(), y.data(), n);
+    for (int64_t j = 0; j < n; j++) {
+      CHECK(close(y[j], before[j] + double(alpha) * a[j], 1e-4));
+    }
+
+    std::vector<int32_t> rows(m), out(m);
+    for (auto& r : rows) {
+      r = randomInt(0, m - 1);
+    }
+    const int32_t* selected = it % 2 ? rows.data() : nullptr;
+    kernels::gemvInt8(a.data(), selected, m, n, x8.data(), out.data());
+    for (int64_t r = 0; r < m; r++) {
+      const int64_t row = selected ? selected[r] : r;
+      int32_t want = 0;
+      for (int64_t j = 0; j < n; j++) {
+        want += a[row * n + j] * x8[j];
+      }
+      CHECK(out[r] == want);
+    }
+  }
+}
+
+void testTranscendental()
+{
+  for (int32_t it = 0; it < 300; it++) {
+    const int64_t n = randomInt(0, 300);
+
+    Buffer x(n, -100, 0);
+    const real shift = randomReal(-1, 1);
+    std::vector<double> want(n);
+    double sum = 0;
+    for (int64_t i = 0; i < n; i++) {
+      // the kernels take the exponent in float too
+      want[i] = std::exp(double(real(x[i] - shift)));
+      sum += want[i];
+    }
+    const real got = kernels::expSum(shift, x.data(), n);
+    for (int64_t i = 0; i < n; i++) {
+      CHECK(close(x[i], want[i], 1e-6 * want[i] + 1e-36));
+    }
+    CHECK(close(got, sum, 1e-6 * sum + 1e-36));
+
+    Buffer y(n, 0, 1);
+    const real offset = randomReal(0, 1e-4);
+    for (int64_t i = 0; i < n; i++) {
+      // positive values from 1e-30 to 1e4
+      y[i] = std::pow(10.0, y[i] * 34 - 30);
+      want[i] = std::log(double(y[i]) + offset);
+    }
+    kernels::log(offset, y.data(), n);
+    for (int64_t i = 0; i < n; i++) {
+      CHECK(close(y[i], want[i], 1e-6 * std::fabs(want[i]) + 1e-6));
+    }
+
+    Buffer z(n, -30, 30);
+    for (int64_t i = 0; i < n; i++) {
+      want[i] = 1 / (1 + std::exp(-double(z[i])));
+    }
+    kernels::sigmoid(z.data(), n);
+    for (int64_t i = 0; i < n; i++) {
+      CHECK(close(z[i], want[i], 1e-6));
+    }
+  }
+}
+
+int main()
+{
+  // FASTTEXT_ISA only lowers the choice, and the CPU may not have the level
+  const char* const levels[] = {"scalar", "sse", "avx2", "avx512"};
+  const char* requested = std::getenv("FASTTEXT_ISA");
+  int32_t selected = -1, allowed = 3;
+  for (int32_t l = 0; l < 4; l++) {
+    if (std::strcmp(kernels::isa(), levels[l]) == 0) {
+      selected = l;
+    }
+    if (requested && std::strcmp(requested, levels[l]) == 0) {
+      allowed = l;
+    }
+  }
+  CHECK(selected >= 0 && selected <= allowed);
+  std::cout << "kernels: " << kernels::isa() << std::endl;
+
+  testDense();
+  testRows();
+  testNearest();
+  testScan4();
+  testInt8();
+  testTranscendental();
+  return 0;
+}
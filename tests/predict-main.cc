@@ -0,0 +1,125 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <ios>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+
+#include "check.h"
+#include "fasttext.h"
+#include "fixtures.h"
+
+using namespace fasttext;
+
+// Output that fails once more than limit bytes are written to it.
+class FailingOutput : public std::streambuf {
+ public:
+  explicit FailingOutput(size_t limit) : limit_(limit) {}
+
+ protected:
+  int_type overflow(int_type c) override {
+    if (written_++ >= limit_) {
+      return traits_type::eof();
+    }
+    return traits_type::not_eof(c);
+  }
+
+ private:
+  size_t limit_;
+  size_t written_ = 0;
+};
+
+// Input whose reads fail after the first block of text.
+class FailingInput : public std::streambuf {
+ public:
+  explicit FailingInput(const std::string& text) : text_(text) {}
+
+ protected:
+  int_type underflow() override {
+    if (served_) {
+      throw std::runtime_error("read failed");
+    }
+    served_ = true;
+    char* data = &text_[0];
+    setg(data, data, data + text_.size());
+    return traits_type::to_int_type(*data);
+  }
+
+ private:
+  std::string text_;
+  bool served_ = false;
+};
+
+std::string testInput(int lines)
+{
+  std::string text;
+  for (int i = 0; i < lines; i++) {
+    text += i % 2 ? "leaf grass lime\n" : "apple cherry tomato\n";
+  }
+  return text;
+}
+
+template <typename Exception>
+bool throws(
+    const FastText& fasttext,
+    std::istream& in,
+    std::ostream& out,
+    int32_t k)
+{
+  try {
+    fasttext.predict(in, out, k, 0.0, false, 3);
+  } catch (const Exception&) {
+    return true;
+  }
+  return false;
+}
+
+int main()
+{
+  const std::string input = "fasttext-predict-test.txt";
+  auto fasttext = trainModel(input, 8);
+  std::remove(input.c_str());
+
+  // many chunks, printed in the order of the lines
+  const int lines = 150000;
+  std::istringstream in(testInput(lines));
+  std::ostringstream out;
+  fasttext->predict(in, out, 1, 0.0, false, 3);
+  std::istringstream printed(out.str());
+  std::string label;
+  int count = 0;
+  while (std::getline(printed, label)) {
+    CHECK(label == (count % 2 ? "__label__green" : "__label__red"));
+    count++;
+  }
+  CHECK(count == lines);
+
+  // errors are thrown to the caller, not left to the threads
+  for (int32_t k : {0, -1}) {
+    std::istringstream some(testInput(10));
+    std::ostringstream none;
+    CHECK(throws<std::invalid_argument>(*fasttext, some, none, k));
+    CHECK(none.str().empty());
+  }
+
+  FailingOutput failingOutput(1000);
+  std::ostream brokenOut(&failingOutput);
+  brokenOut.exceptions(std::ios_base::badbit);
+  std::istringstream more(testInput(lines));
+  CHECK(throws<std::ios_base::failure>(*fasttext, more, brokenOut, 1));
+
+  FailingInput failingInput(testInput(10));
+  std::istream brokenIn(&failingInput);
+  brokenIn.exceptions(std::ios_base::badbit);
+  std::ostringstream ignored;
+  CHECK(throws<std::runtime_error>(*fasttext, brokenIn, ignored, 1));
+  return 0;
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "densematrix.h"
+#include "fixtures.h"
+#include "quantmatrix.h"
+#include "vector.h"
+
+using namespace fasttext;
+
+// Bytes of a saved matrix before its number of bits: qnorm, m, n and the
+// size of the codes.
+const size_t NBITS_OFFSET = 1 + 8 + 8 + 4;
+
+void testQuantization(int64_t n, int32_t dsub, bool qnorm, int32_t nbits)
+{
+  // not a multiple of the 32 rows of a 4-bit block
+  const int64_t m = 700;
+  DenseMatrix dense = randomMatrix(m, n);
+  QuantMatrix quant(DenseMatrix(dense), dsub, qnorm, 2, nbits);
+
+  // rows are coded to about their values
+  double error = 0, total = 0;
+  for (int64_t i = 0; i < m; i++) {
+    Vector x = decodedRow(quant, i);
+    for (int64_t j = 0; j < n; j++) {
+      error += (x[j] - dense.at(i, j)) * (x[j] - dense.at(i, j));
+      total += dense.at(i, j) * dense.at(i, j);
+    }
+  }
+  CHECK(std::sqrt(error / total) < (nbits == 8 ? 0.1 : 0.6));
+
+  // scoring all the rows at once, which 4-bit codes do from a table of
+  // bytes, agrees with scoring them one by one; so does scoring chosen rows
+  Vector vec = testVector(n);
+  Vector all(m);
+  quant.dotRows(vec, all);
+  std::vector<int32_t> rows;
+  for (int32_t i = m - 1; i >= 0; i -= 3) {
+    rows.push_back(i);
+  }
+  std::vector<real> chosen(rows.size());
+  quant.dotRows(vec, rows.data(), rows.size(), chosen.data());
+  real maxScore = 0;
+  for (int64_t i = 0; i < m; i++) {
+    maxScore = std::max(maxScore, std::abs(quant.dotRow(vec, i)));
+  }
+  const real tolerance = (nbits == 8 ? 1e-5 : 2e-2) * maxScore;
+  for (int64_t i = 0; i < m; i++) {
+    CHECK(std::abs(all[i] - quant.dotRow(vec, i)) <= tolerance);
+  }
+  for (size_t r = 0; r < rows.size(); r++) {
+    CHECK(std::abs(chosen[r] - quant.dotRow(vec, rows[r])) <= 1e-5 * maxScore);
+  }
+
+  checkSaveLoad(quant, "fasttext-quantmatrix-test.bin");
+
+  // files before version 13 have 8-bit codes, without their number of bits
+  if (nbits == 8) {
+    std::ostringstream out;
+    quant.save(out);
+    std::string bytes = out.str();
+    bytes.erase(NBITS_OFFSET, sizeof(int32_t));
+    std::istringstream in(bytes);
+    QuantMatrix old(12);
+    old.load(in);
+    checkSameRows(quant, old);
+  }
+}
+
+int main()
+{
+  for (int32_t nbits : {8, 4}) {
+    for (bool qnorm : {false, true}) {
+      testQuantization(32, 2, qnorm, nbits);
+      // a shorter last subvector
+      testQuantization(33, 2, qnorm, nbits);
+      // an odd number of subvectors, which 4-bit codes pad
+      testQuantization(30, 2, qnorm, nbits);
+      testQuantization(40, 4, qnorm, nbits);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "check.h"
+
+#ifdef _WIN32
+
+int main()
+{
+  // serve needs Unix domain sockets
+  return 0;
+}
+
+#else
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fasttext.h"
+#include "fixtures.h"
+#include "server.h"
+
+using namespace fasttext;
+
+const int32_t DIM = 8;
+
+int connectTo(const std::string& path)
+{
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  std::strcpy(address.sun_path, path.c_str());
+  for (int attempt = 0; attempt < 100; attempt++) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(fd >= 0);
+    if (::connect(fd, (sockaddr*)&address, sizeof(address)) == 0) {
+      return fd;
+    }
+    ::close(fd);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  CHECK(false);
+  return -1;
+}
+
+// Reads count answer lines, failing if they do not come within 5 seconds.
+std::vector<std::string> readLines(int fd, size_t count)
+{
+  std::string data;
+  std::vector<std::string> lines;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (lines.size() < count) {
+    int left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                   deadline - std::chrono::steady_clock::now())
+                   .count();
+    pollfd p = {fd, POLLIN, 0};
+    CHECK(left > 0 && ::poll(&p, 1, left) == 1);
+    char chunk[4096];
+    ssize_t n = ::read(fd, chunk, sizeof(chunk));
+    CHECK(n > 0);
+    data.append(chunk, n);
+    size_t end;
+    while ((end = data.find('\n')) != std::string::npos) {
+      lines.push_back(data.substr(0, end));
+      data.erase(0, end + 1);
+    }
+  }
+  CHECK(lines.size() == count && data.empty());
+  return lines;
+}
+
+void send(int fd, const std::string& requests)
+{
+  CHECK(::write(fd, requests.data(), requests.size()) ==
+        (ssize_t)requests.size());
+}
+
+size_t countFields(const std::string& line)
+{
+  std::istringstream in(line);
+  std::string field;
+  size_t count = 0;
+  while (in >> field) {
+    count++;
+  }
+  return count;
+}
+
+int main()
+{
+  const std::string prefix = "/tmp/fasttext-server-test-" +
+      std::to_string(::getpid());
+  auto fasttext = trainModel(prefix + ".txt", DIM);
+  const std::string path = prefix + ".sock";
+  Server server(fasttext, 2, 10);
+  std::thread([&server, path]() { server.serve(path); }).detach();
+
+  // more idle connections than threads must not keep others waiting
+  int idle0 = connectTo(path);
+  int idle1 = connectTo(path);
+  int client = connectTo(path);
+  send(client, "predict 1 0 apple cherry\n");
+  std::vector<std::string> lines = readLines(client, 1);
+  CHECK(lines[0].compare(0, 14, "__label__red 0") == 0 ||
+        lines[0].compare(0, 14, "__label__red 1") == 0);
+
+  // pipelined requests are answered in order
+  send(
+      idle0,
+      "word-vector apple\r\nsentence-vector leaf lime\nnn 2 apple\n"
+      "bogus request\npredict x\n");
+  lines = readLines(idle0, 5);
+  CHECK(countFields(lines[0]) == DIM);
+  CHECK(countFields(lines[1]) == DIM);
+  CHECK(countFields(lines[2]) == 4);
+  CHECK(lines[3] == "error unknown request 'bogus'");
+  CHECK(lines[4].compare(0, 6, "error ") == 0);
+
+  // a request split across writes
+  send(idle1, "predict 2 0 gra");
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  send(idle1, "ss leaf\n");
+  lines = readLines(idle1, 1);
+  CHECK(lines[0].compare(0, 16, "__label__green 0") == 0 ||
+        lines[0].compare(0, 16, "__label__green 1") == 0);
+  CHECK(countFields(lines[0]) == 4);
+
+  // bad k is an error for the client, not the end of the server
+  send(client, "nn 0 apple\nnn -3 apple\npredict 0 0 apple\nnn 1 apple\n");
+  lines = readLines(client, 4);
+  CHECK(lines[0] == "error k needs to be 1 or higher!");
+  CHECK(lines[1] == "error k needs to be 1 or higher!");
+  CHECK(lines[2] == "error k needs to be 1 or higher!");
+  CHECK(countFields(lines[3]) == 2);
+
+  ::close(idle0);
+  ::close(idle1);
+  ::close(client);
+  ::unlink(path.c_str());
+  std::remove((prefix + ".txt").c_str());
+  // the server thread never returns
+  _exit(0);
+}
+
+#endif
@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "strutils.h"
+#include "tokenizer.h"
+
+using namespace fasttext;
+
+// The words of the wide-stream reader that Tokenizer replaced, with an empty
+// word for each end of sentence.
+std::vector<std::string> referenceWords(const std::wstring& text, bool lower)
+{
+  std::vector<std::string> words;
+  std::string word;
+  bool pendingEOS = false;
+  size_t i = 0;
+  while (true) {
+    word.clear();
+    if (pendingEOS) {
+      pendingEOS = false;
+      words.push_back(word);
+      continue;
+    }
+    bool found = false;
+    while (i < text.size()) {
+      wchar_t c = lower ? transformChar(text[i]) : translateChar(text[i]);
+      i++;
+      if (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' ||
+          c == '\f' || c == '\0') {
+        ltrim("#@", word);
+        const size_t size = word.size();
+        rtrim("?!.,:;-", word);
+        if (size != word.size()) {
+          c = '\n';
+        }
+        trim("'/)(\"", word);
+        if (word.empty()) {
+          if (c == '\n') {
+            found = true;
+            break;
+          }
+          continue;
+        }
+        pendingEOS = c == '\n';
+        found = true;
+        break;
+      }
+      word.push_back(static_cast<char>(c));
+    }
+    if (!found) {
+      if (!word.empty()) {
+        words.push_back(word);
+      }
+      return words;
+    }
+    words.push_back(word);
+  }
+}
+
+std::vector<std::string> tokenizerWords(const std::string& text, bool lower)
+{
+  std::istringstream in(text);
+  Tokenizer tokenizer(in);
+  std::vector<std::string> words;
+  std::string word;
+  while (tokenizer.readWord(word, lower)) {
+    words.push_back(word);
+  }
+  return words;
+}
+
+void checkText(const std::string& text)
+{
+  for (bool lower : {false, true}) {
+    CHECK(
+        tokenizerWords(text, lower) ==
+        referenceWords(convert_utf8_to_utf16(text), lower));
+  }
+}
+
+// Every ASCII byte alone, inside a word, and next to the trimmed characters.
+void testAsciiBytes()
+{
+  for (int b = 1; b < 0x80; b++) {
+    const std::string c(1, static_cast<char>(b));
+    const std::wstring wc(1, static_cast<wchar_t>(b));
+    CHECK(Tokenizer::normalize(c, false) == translate_wstr(wc));
+    CHECK(Tokenizer::normalize(c, true) == transform_wstr(wc));
+    checkText(c);
+    checkText("ab" + c + "cd efgh\n");
+    checkText("I don" + c + "t like " + c + "quoted" + c + " words.\n");
+    // runs long enough for the SIMD paths of the tokenizer
+    checkText(std::string(40, 'x') + c + std::string(40, 'Y') + " z\n");
+  }
+}
+
+void testMixedText()
+{
+  checkText("I don`t like `quoted` words don't you\n");
+  checkText("#tag @user (paren) \"quote\" end. Next, line;\r\nlast-");
+  checkText("Gr\xc3\xbc\xc3\x9f" "e \xd0\x9c\xd0\xb8\xd1\x80 caf\xc3\xa9\n");
+  std::mt19937 rng(7);
+  const std::string alphabet =
+      "abcXYZ019 \n\t.,;:!?-'\"`()#@/\\\xc3\xa9\xd0\xb8";
+  for (int t = 0; t < 200; t++) {
+    std::string text;
+    const int length = rng() % 300;
+    for (int i = 0; i < length; i++) {
+      char c = alphabet[rng() % alphabet.size()];
+      if (static_cast<unsigned char>(c) >= 0xc0) {
+        // keep the two-byte sequences whole
+        text.push_back(c);
+        c = c == '\xc3' ? '\xa9' : '\xb8';
+      } else if (static_cast<unsigned char>(c) >= 0x80) {
+        continue;
+      }
+      text.push_back(c);
+    }
+    checkText(text);
+  }
+}
+
+int main()
+{
+  testAsciiBytes();
+  testMixedText();
+  return 0;
+}